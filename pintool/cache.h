@@ -2,27 +2,33 @@
 #define CACHE_H
 
 #include <iostream>  // std::cout ...
-#include <cstdlib>   // rand()
-
-/*****************************************************************************/
-/* Policy about L2 inclusion of L1's content                                 */
-/*****************************************************************************/
-#ifndef L2_INCLUSIVE
-#  define L2_INCLUSIVE 1
-#endif
-/*****************************************************************************/
+#include <cstdlib>
+#include <cstring>   // memset
+#include <limits>    // std::numeric_limits
+#include <vector>
+#include <algorithm> // std::sort
+#include <cmath>     // std::sqrt
 
+#include "simd.h"
+#include "prefetch.h"
+#include "profile.h"
 
 /*****************************************************************************/
-/* Cache allocation strategy on stores                                       */
+/* Write and inclusion policies of the L1 and the L2, chosen at runtime      */
 /*****************************************************************************/
-enum {
-    STORE_ALLOCATE = 0,
-    STORE_NO_ALLOCATE
+struct WRITE_POLICY
+{
+    bool l1WriteThrough;   // stores also write the L2, L1 lines stay clean
+    bool l1WriteAllocate;  // store misses bring the line into the L1
+    bool l2WriteThrough;   // writes to the L2 also go to the level below
+    bool l2WriteAllocate;  // stores reaching the L2 bring the line in on a miss
+    bool l2Inclusive;      // L2 evictions remove the line from the L1
+
+    // Write-back, write-allocate, inclusive
+    WRITE_POLICY()
+      : l1WriteThrough(false), l1WriteAllocate(true),
+        l2WriteThrough(false), l2WriteAllocate(true), l2Inclusive(true) {}
 };
-#ifndef STORE_ALLOCATION
-#  define STORE_ALLOCATION STORE_ALLOCATE
-#endif
 /*****************************************************************************/
 
 typedef UINT64 CACHE_STATS; // type of cache hit/miss counters
@@ -51,519 +57,1340 @@ CACHE_TAG INVALID_TAG(-1);
 namespace CACHE_SET
 {
 
-// ************************
-// Change this class and implement policy to evict random block!
-// ************************
-/*
-class LRU 
+/**
+ * `SET_ARRAY` keeps the lines of every set of a cache level in one flat,
+ * set-major array of tags, with a parallel array of one metadata word per
+ * line (RRPV, LRU age or access frequency, depending on the policy).
+ * Both arrays are sized once at construction; empty ways hold INVALID_TAG.
+ * The policies below derive from it and only move metadata around, so a
+ * hit never allocates or shifts memory.
+ **/
+class SET_ARRAY
 {
   protected:
-    std::vector<CACHE_TAG> _tags;
-    UINT32 _associativity;
+    static const UINT32 LINE_ALIGN = 64; // host cache line size in bytes
 
- public:
-    LRU(UINT32 associativity = 8)
+    UINT8 *_storage;       // backing allocation of _tags and _meta
+    ADDRINT *_tags;        // _numSets x _associativity tags
+    UINT32 *_meta;         // _numSets x _associativity metadata words
+    const UINT32 _numSets;
+    const UINT32 _associativity;
+
+    static UINT8 *AlignUp(UINT8 *p)
     {
-        _associativity = associativity;
-        _tags.clear();
+        return (UINT8 *)(((ADDRINT)p + LINE_ALIGN - 1) & ~(ADDRINT)(LINE_ALIGN - 1));
     }
 
-    VOID SetAssociativity(UINT32 associativity)
+    ADDRINT *Tags(UINT32 set) const { return _tags + set * _associativity; }
+    UINT32 *Meta(UINT32 set) const { return _meta + set * _associativity; }
+
+    // Returns the first empty way of `set`, or -1 if the set is full.
+    INT32 FindInvalidWay(UINT32 set) const { return FindWay(set, INVALID_TAG); }
+
+    UINT32 NumValid(UINT32 set) const
     {
-        _associativity = associativity;
-        _tags.clear();
+        return _associativity - __builtin_popcountll(MatchTags(Tags(set), INVALID_TAG, _associativity));
     }
-    UINT32 GetAssociativity() { return _associativity; }
 
-    string Name() { return "LRU"; }
-    
-    UINT32 Find(CACHE_TAG tag)
+    // First way of `set` whose metadata is the minimum/maximum of the set
+    UINT32 MinMetaWay(UINT32 set) const
     {
-        for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it)
-        {
-            if (*it == tag) { // Tag found, lets make it MRU
-                _tags.erase(it);
-                _tags.push_back(tag);
-                return true;
-            }
+        const UINT32 *meta = Meta(set);
+        return FirstWay(MatchMeta(meta, MinMeta(meta, _associativity), _associativity));
+    }
+    UINT32 MaxMetaWay(UINT32 set) const
+    {
+        const UINT32 *meta = Meta(set);
+        return FirstWay(MatchMeta(meta, MaxMeta(meta, _associativity), _associativity));
+    }
+
+  public:
+    // Whether Replace() updates state shared by all the sets, so that sets
+    // cannot be replaced in concurrently (see SHARED_L2_CACHE)
+    static const bool SHARED_REPLACEMENT_STATE = false;
+    // Whether the policy predicts from the instruction of the accesses,
+    // which it must then be given with SetPC()
+    static const bool USES_PC = false;
+    // Whether the policy needs the future of the references, given with
+    // SetNextUse() (OPT)
+    static const bool USES_NEXT_USE = false;
+
+    SET_ARRAY(UINT32 numSets, UINT32 associativity)
+      : _numSets(numSets), _associativity(associativity)
+    {
+        ASSERTX(associativity > 0 && associativity <= SIMD_MAX_WAYS);
+
+        const UINT32 lines = numSets * associativity;
+
+        _storage = new UINT8[lines * (sizeof(ADDRINT) + sizeof(UINT32)) + 2 * LINE_ALIGN];
+        _tags = (ADDRINT *)AlignUp(_storage);
+        _meta = (UINT32 *)AlignUp((UINT8 *)(_tags + lines));
+
+        for (UINT32 i = 0; i < lines; i++) {
+            _tags[i] = INVALID_TAG;
+            _meta[i] = 0;
         }
+    }
+    ~SET_ARRAY() { delete [] _storage; }
 
-        return false;
+    SET_ARRAY(const SET_ARRAY &) = delete;
+    SET_ARRAY & operator=(const SET_ARRAY &) = delete;
+
+    UINT32 GetAssociativity() const { return _associativity; }
+    UINT32 NumSets() const { return _numSets; }
+
+    // Returns the way holding `tag` in `set`, or -1 if it is not there.
+    // No replacement update: also used for state kept next to the lines.
+    INT32 FindWay(UINT32 set, CACHE_TAG tag) const
+    {
+        UINT64 hits = MatchTags(Tags(set), tag, _associativity);
+        return hits ? INT32(FirstWay(hits)) : -1;
     }
 
-    CACHE_TAG Replace(CACHE_TAG tag)
+    // Delete a specific tag if it's present in the set (e.g., for L2 inclusivity)
+    VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
     {
-        CACHE_TAG ret = INVALID_TAG;
-        _tags.push_back(tag);
-        if (_tags.size() > _associativity) {
-            ret = *_tags.begin();
-            _tags.erase(_tags.begin());
+        INT32 way = FindWay(set, tag);
+        if (way >= 0)
+            Tags(set)[way] = INVALID_TAG;
+    }
+
+    // The address of the instruction the next Find() and Replace() are for,
+    // 0 if unknown
+    VOID SetPC(ADDRINT pc) {}
+
+    // The next reference is to `tag` in `set`, and its block is used again
+    // `distance` references later, NEVER if it is not. Called for every
+    // reference, whichever levels it reaches, so that the lines the levels
+    // above serve stay up to date.
+    static const UINT64 NEVER = ~UINT64(0);
+    VOID SetNextUse(UINT32 set, CACHE_TAG tag, UINT64 distance) {}
+
+    // Statistics of the policy itself, for the adaptive ones: the lines of
+    // the StatsLong() report of cache level `level`, and their reset
+    std::string Report(const std::string &level, const std::string &prefix) const { return ""; }
+    VOID ResetStats() {}
+};
+const UINT64 SET_ARRAY::NEVER;
+
+
+/**
+ * Bimodal insertion: one in EPSILON insertions is made by the regular
+ * policy, the others at the distant end (BIP, BRRIP). A counter stands for
+ * the random choice, so runs are reproducible.
+ **/
+class BIMODAL_THROTTLE
+{
+  private:
+    static const UINT32 EPSILON = 32;
+    UINT32 _count;
+
+  public:
+    BIMODAL_THROTTLE() : _count(0) {}
+
+    // Whether the next insertion is a regular one
+    bool Regular() { return ++_count % EPSILON == 0; }
+};
+
+
+/**
+ * Folds the address of an instruction into a `bits` wide signature, for
+ * the policies that predict from it (SHiP, Hawkeye)
+ **/
+static inline UINT32 PcSignature(ADDRINT pc, UINT32 bits)
+{
+    return UINT32((UINT64(pc) * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+}
+
+
+/**
+ * Set dueling between two policies A and B (DIP, DRRIP): in every
+ * constituency of sets, one leader set always fills with A and another one
+ * with B, and the misses of the leaders move a saturating PSEL counter,
+ * up for A and down for B. The other sets, the followers, fill with the
+ * policy whose leaders miss less. The leaders are at a different offset
+ * in every constituency, so strides do not hit them all.
+ *
+ * The choice of the followers is recorded over time, in epochs of
+ * follower fills. Epochs double in length whenever the history is full.
+ **/
+class SET_DUELING
+{
+  private:
+    static const UINT32 LEADER_SETS = 32;   // per policy
+    static const UINT32 PSEL_MAX = 1023;    // 10 bits
+    static const UINT32 HISTORY = 64;       // epochs kept
+
+    const UINT32 _region;       // sets per constituency
+    UINT32 _psel;
+
+    UINT64 _epoch_length;       // in follower fills
+    UINT64 _epoch_fills;
+    UINT64 _epoch_b_fills;
+    std::vector<UINT64> _history; // fills with B in every complete epoch
+    CACHE_STATS _fills[2];        // of the followers, with A and with B
+
+  public:
+    SET_DUELING(UINT32 numSets)
+      : _region(numSets >= 4 * LEADER_SETS ? numSets / LEADER_SETS : 4),
+        _psel(PSEL_MAX / 2 + 1)
+    {
+        ResetStats();
+    }
+
+    // Picks the policy filling `set` on a miss, true for B, and counts the
+    // miss if it is a leader set
+    bool UseB(UINT32 set)
+    {
+        const UINT32 offset = set % _region;
+        const UINT32 leader = (set / _region) % _region;
+        if (offset == leader) {
+            _psel += _psel < PSEL_MAX;
+            return false;
         }
-        return ret;
+        if (offset == _region - 1 - leader) {
+            _psel -= _psel > 0;
+            return true;
+        }
+
+        const bool b = _psel > PSEL_MAX / 2;
+        _fills[b]++;
+        _epoch_b_fills += b;
+        if (++_epoch_fills == _epoch_length) {
+            _history.push_back(_epoch_b_fills);
+            _epoch_fills = _epoch_b_fills = 0;
+            if (_history.size() == HISTORY) {
+                for (UINT32 i = 0; i < HISTORY / 2; i++)
+                    _history[i] = _history[2 * i] + _history[2 * i + 1];
+                _history.resize(HISTORY / 2);
+                _epoch_length *= 2;
+            }
+        }
+        return b;
     }
-    
-    VOID DeleteIfPresent(CACHE_TAG tag)
+
+    std::string Report(const std::string &level, const std::string &prefix,
+                       const std::string &a, const std::string &b) const
     {
-        for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it)
-        {
-            if (*it == tag) { // Tag found
-                _tags.erase(it);
+        const CACHE_STATS fills = _fills[false] + _fills[true];
+        std::string out = prefix + level + " Set Dueling (" + a + " vs " + b + "):\n";
+        out += prefix + ljstr(level + "-PSEL: ", 24) + dec2str(_psel, 12) + " of " +
+               dec2str(PSEL_MAX, 1) + " (" + (_psel > PSEL_MAX / 2 ? b : a) + ")\n";
+        out += prefix + ljstr(level + "-" + a + "-Fills: ", 24) + dec2str(_fills[false], 12) + "\n";
+        out += prefix + ljstr(level + "-" + b + "-Fills: ", 24) + dec2str(_fills[true], 12) + "  " +
+               fltstr(fills ? 100.0 * _fills[true] / fills : 0, 2, 6) + "%\n";
+
+        // Share of B in the follower fills of every epoch, the current one last
+        out += prefix + level + "-" + b + "-Share per " + dec2str(_epoch_length, 1) + " follower fills:";
+        for (UINT32 i = 0; i <= _history.size(); i++) {
+            if (i == _history.size() && _epoch_fills == 0)
                 break;
-            }
+            const double share = i < _history.size() ? (double)_history[i] / _epoch_length
+                                                      : (double)_epoch_b_fills / _epoch_fills;
+            out += (i % 16 == 0 ? "\n" + prefix + "   " : "") + fltstr(share, 2, 5);
         }
+        out += "\n" + prefix + "\n";
+        return out;
+    }
+
+    // The history restarts, the policy choice stays
+    VOID ResetStats()
+    {
+        _epoch_length = 4096;
+        _epoch_fills = _epoch_b_fills = 0;
+        _history.clear();
+        _fills[false] = _fills[true] = 0;
     }
 };
 
 
 // ************************
-// Random Replacement Policy (New implementation)
+// LRU Replacement Policy
 // ************************
-class Random
+// Metadata is the line's position in the recency stack: 0 is MRU and
+// the LRU line of a full set has age associativity-1.
+class LRU : public SET_ARRAY
 {
   protected:
-    std::vector<CACHE_TAG> _tags; // Stores the tags in the set
-    UINT32 _associativity;
+    // Make `way` the MRU line: everything younger than it ages by one.
+    VOID Promote(UINT32 set, UINT32 way)
+    {
+        UINT32 *meta = Meta(set);
+        const UINT32 age = meta[way];
+        for (UINT32 i = 0; i < _associativity; i++)
+            meta[i] += (meta[i] < age);
+        meta[way] = 0;
+    }
+
+    UINT32 OldestWay(UINT32 set) const { return MaxMetaWay(set); }
 
   public:
-    // Constructor
-    Random(UINT32 associativity = 8) : _associativity(associativity)
+    LRU(UINT32 numSets, UINT32 associativity) : SET_ARRAY(numSets, associativity) {}
+
+    std::string Name() const { return "LRU"; }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
     {
-        _tags.clear();
-        _tags.reserve(associativity); // Reserve space for associativity
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return false;
+        Promote(set, way); // Tag found, lets make it MRU
+        return true;
     }
 
-    // Set associativity and clear existing tags
-    VOID SetAssociativity(UINT32 associativity)
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
     {
-        _associativity = associativity;
-        _tags.clear();
-        if (_associativity > 0) {
-            _tags.reserve(associativity);
+        CACHE_TAG ret = INVALID_TAG;
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            way = OldestWay(set);
+            ret = Tags(set)[way];
         }
+
+        // The new line is MRU, everybody else gets one step older
+        UINT32 *meta = Meta(set);
+        for (UINT32 i = 0; i < _associativity; i++)
+            meta[i]++;
+        Tags(set)[way] = tag;
+        meta[way] = 0;
+        return ret;
     }
 
-    // Get associativity
-    UINT32 GetAssociativity() const { return _associativity; }
+    VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return;
+
+        // Close the gap in the recency stack
+        UINT32 *meta = Meta(set);
+        const UINT32 age = meta[way];
+        for (UINT32 i = 0; i < _associativity; i++)
+            meta[i] -= (meta[i] > age);
+        Tags(set)[way] = INVALID_TAG;
+    }
+};
+
+
+// ************************
+// Random Replacement Policy
+// ************************
+// Each cache has its own generator, so caches simulated side by side pick
+// the same victims as they would alone.
+class Random : public SET_ARRAY
+{
+  protected:
+    UINT32 _seed;
+
+    // xorshift32
+    UINT32 NextRandom()
+    {
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        return _seed;
+    }
+
+  public:
+    static const bool SHARED_REPLACEMENT_STATE = true;
+
+    Random(UINT32 numSets, UINT32 associativity)
+      : SET_ARRAY(numSets, associativity), _seed(21089) {}
 
-    // Return policy name
     std::string Name() const { return "Random"; }
 
-    // Find a tag in the set
-    // Returns true if found (hit), false otherwise (miss).
     // No reordering needed for Random policy on hit.
-    bool Find(CACHE_TAG tag) const // Made const as it doesn't modify state
+    bool Find(UINT32 set, CACHE_TAG tag) const { return FindWay(set, tag) >= 0; }
+
+    // Fill an empty way if there is one, otherwise evict a random way.
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
     {
-        for (const auto& existing_tag : _tags) {
-            if (existing_tag == tag) {
-                return true; // Tag found (hit)
-            }
+        CACHE_TAG evicted_tag = INVALID_TAG;
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            way = NextRandom() % _associativity;
+            evicted_tag = Tags(set)[way];
         }
-        return false; // Tag not found (miss)
+        Tags(set)[way] = tag;
+        return evicted_tag;
     }
+};
 
-    // Replace a block in the set following Random policy.
-    // Returns the evicted tag, or INVALID_TAG if no eviction occurred.
-    CACHE_TAG Replace(CACHE_TAG tag)
+
+// ************************
+// LFU (Least Frequently Used) Replacement Policy
+// ************************
+// Metadata is the number of accesses since the line was brought in.
+class LFU : public SET_ARRAY
+{
+  public:
+    LFU(UINT32 numSets, UINT32 associativity) : SET_ARRAY(numSets, associativity) {}
+
+    std::string Name() const { return "LFU"; }
+
+    // On hit the frequency counter is incremented (saturating).
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return false;
+        UINT32 &frequency = Meta(set)[way];
+        frequency += (frequency != std::numeric_limits<UINT32>::max());
+        return true;
+    }
+
+    // The victim is the first way with the minimum frequency. The new line
+    // starts with frequency 1, since its insertion counts as its first use.
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
     {
         CACHE_TAG evicted_tag = INVALID_TAG;
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            way = MinMetaWay(set);
+            evicted_tag = Tags(set)[way];
+        }
+        Tags(set)[way] = tag;
+        Meta(set)[way] = 1;
+        return evicted_tag;
+    }
+};
+
 
-        if (_tags.size() < _associativity) {
-            // Set is not full, just add the new tag
-            _tags.push_back(tag);
-        } else if (_associativity > 0) { // Check associativity > 0 to avoid modulo by zero
-            // Set is full, need to replace a random tag
-            // Generate a random index between 0 and associativity-1
-            UINT32 victim_index = std::rand() % _associativity;
+// ************************
+// LIP (LRU Insertion Policy) Replacement Policy
+// ************************
+// Same recency stack as LRU, but new lines are inserted at the LRU position.
+class LIP : public LRU
+{
+  public:
+    LIP(UINT32 numSets, UINT32 associativity) : LRU(numSets, associativity) {}
 
-            // Store the tag being evicted
-            evicted_tag = _tags[victim_index];
+    std::string Name() const { return "LIP"; }
 
-            // Replace the tag at the victim index with the new tag
-            _tags[victim_index] = tag;
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        CACHE_TAG evicted_tag = INVALID_TAG;
+        UINT32 age;
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            // The set is full: the new line takes the place of the LRU one
+            way = OldestWay(set);
+            evicted_tag = Tags(set)[way];
+            age = Meta(set)[way];
+        } else {
+            // Below all valid lines
+            age = NumValid(set);
         }
+        Tags(set)[way] = tag;
+        Meta(set)[way] = age;
         return evicted_tag;
     }
+};
 
-    // Delete a specific tag if it's present in the set (e.g., for L2 inclusivity)
-    VOID DeleteIfPresent(CACHE_TAG tag)
-    {
-        // Iterate through the vector and erase the element if found
-        for (auto it = _tags.begin(); it != _tags.end(); ++it) {
-            if (*it == tag) { // Tag found
-                _tags.erase(it); // Remove the tag
-                // Assume tags are unique within a set for cache simulation, so we can stop.
-                // If duplicates were possible, we'd continue or use std::remove/erase idiom.
-                break;
+
+// ************************
+// SRRIP (Static Re-reference Interval Prediction) Replacement Policy
+// ************************
+// Metadata is the line's RRPV, an M-bit counter (M = SRRIP::RRPVBits).
+class SRRIP : public SET_ARRAY
+{
+  protected:
+    const UINT32 _rmax; // maximum RRPV value (Rmax = 2^M - 1)
+
+  public:
+    // RRPV width in bits for every SRRIP set array, set from the -rrpv knob
+    static UINT32 RRPVBits;
+
+    SRRIP(UINT32 numSets, UINT32 associativity)
+      : SET_ARRAY(numSets, associativity), _rmax((1U << RRPVBits) - 1)
+    {
+        ASSERTX(RRPVBits >= 1 && RRPVBits <= 31);
+    }
+
+    std::string Name() const { return "SRRIP"; }
+
+    // On hit, the RRPV of the line is set to 0.
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return false;
+        Meta(set)[way] = 0;
+        return true;
+    }
+
+    // New lines are inserted with RRPV = Rmax - 1
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag) { return Insert(set, tag, _rmax - 1); }
+
+  protected:
+    // Inserts `tag` with RRPV `rrpv`. On a full set the victim is the first
+    // line with RRPV == Rmax. If there is none, the whole set is aged by
+    // the distance of its oldest line from Rmax in a single pass, which is
+    // what repeated increments by one would end up with.
+    CACHE_TAG Insert(UINT32 set, CACHE_TAG tag, UINT32 rrpv)
+    {
+        CACHE_TAG evicted_tag = INVALID_TAG;
+        UINT32 *meta = Meta(set);
+        INT32 way = FindInvalidWay(set);
+
+        if (way < 0) {
+            const UINT32 oldest = MaxMeta(meta, _associativity);
+            if (oldest < _rmax) {
+                const UINT32 delta = _rmax - oldest;
+                for (UINT32 i = 0; i < _associativity; i++)
+                    meta[i] += delta;
             }
+            way = FirstWay(MatchMeta(meta, _rmax, _associativity));
+            evicted_tag = Tags(set)[way];
         }
+
+        Tags(set)[way] = tag;
+        meta[way] = rrpv;
+        return evicted_tag;
     }
-}; // End class Random
+};
+UINT32 SRRIP::RRPVBits = 2;
 
 
+// ************************
+// BIP (Bimodal Insertion Policy) Replacement Policy
+// ************************
+// LIP, but one in 32 new lines is inserted at the MRU position, so that
+// the cache adapts to a working set that changes.
+class BIP : public LIP
+{
+  protected:
+    BIMODAL_THROTTLE _throttle;
+
+  public:
+    static const bool SHARED_REPLACEMENT_STATE = true;
+
+    BIP(UINT32 numSets, UINT32 associativity) : LIP(numSets, associativity) {}
+
+    std::string Name() const { return "BIP"; }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        return _throttle.Regular() ? LRU::Replace(set, tag) : LIP::Replace(set, tag);
+    }
+};
+
 
 // ************************
-// LFU (Least Frequently Used) Replacement Policy
+// BRRIP (Bimodal RRIP) Replacement Policy
 // ************************
-class LFU
+// SRRIP with new lines inserted at the distant RRPV Rmax, except one in 32
+// at Rmax - 1: thrashing working sets keep part of their lines.
+class BRRIP : public SRRIP
 {
   protected:
-    // Δομή για την αποθήκευση του tag και της συχνότητας πρόσβασής του
-    struct CacheEntry {
-        CACHE_TAG tag;      // Το tag της γραμμής της cache
-        UINT64 frequency;   // Μετρητής συχνότητας χρήσης (αριθμός hits)
+    BIMODAL_THROTTLE _throttle;
+
+  public:
+    static const bool SHARED_REPLACEMENT_STATE = true;
+
+    BRRIP(UINT32 numSets, UINT32 associativity) : SRRIP(numSets, associativity) {}
+
+    std::string Name() const { return "BRRIP"; }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        return Insert(set, tag, _throttle.Regular() ? _rmax - 1 : _rmax);
+    }
+};
 
-        // Constructor για εύκολη δημιουργία (αρχική συχνότητα 1)
-        CacheEntry(CACHE_TAG t, UINT64 f = 1) : tag(t), frequency(f) {}
-    };
-    std::vector<CacheEntry> _entries; // Αποθηκεύει τα entries (tag + frequency) του set
-    UINT32 _associativity;            // Η συσχετιστικότητα του set
+
+// ************************
+// DIP (Dynamic Insertion Policy) Replacement Policy
+// ************************
+// Set dueling between LRU and BIP insertion.
+class DIP : public BIP
+{
+  private:
+    SET_DUELING _dueling;
 
   public:
-    // Constructor
-    LFU(UINT32 associativity = 8) : _associativity(associativity)
+    DIP(UINT32 numSets, UINT32 associativity) : BIP(numSets, associativity), _dueling(numSets) {}
+
+    std::string Name() const { return "DIP"; }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
     {
-        // Προαιρετική δέσμευση χώρου στο vector για αποδοτικότητα
-        if (_associativity > 0) {
-             _entries.reserve(associativity);
-        }
+        return _dueling.UseB(set) ? BIP::Replace(set, tag) : LRU::Replace(set, tag);
     }
 
-    // Ορισμός συσχετιστικότητας και καθαρισμός των entries
-    VOID SetAssociativity(UINT32 associativity)
+    std::string Report(const std::string &level, const std::string &prefix) const
     {
-        _associativity = associativity;
-        _entries.clear();
-        if (_associativity > 0) {
-             _entries.reserve(associativity);
-        }
+        return _dueling.Report(level, prefix, "LRU", "BIP");
     }
+    VOID ResetStats() { _dueling.ResetStats(); }
+};
 
-    // Επιστροφή συσχετιστικότητας
-    UINT32 GetAssociativity() const { return _associativity; }
 
-    // Επιστροφή ονόματος πολιτικής
-    std::string Name() const { return "LFU"; }
+// ************************
+// DRRIP (Dynamic RRIP) Replacement Policy
+// ************************
+// Set dueling between SRRIP and BRRIP insertion.
+class DRRIP : public BRRIP
+{
+  private:
+    SET_DUELING _dueling;
+
+  public:
+    DRRIP(UINT32 numSets, UINT32 associativity) : BRRIP(numSets, associativity), _dueling(numSets) {}
 
-    // Εύρεση ενός tag στο set.
-    // Επιστρέφει true αν βρεθεί (hit), false αλλιώς (miss).
-    // **Σημαντικό**: Αυξάνει τον μετρητή frequency σε περίπτωση hit.
-    bool Find(CACHE_TAG tag)
+    std::string Name() const { return "DRRIP"; }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
     {
-        // Διατρέχουμε τα entries με αναφορά (&) για να μπορούμε να αλλάξουμε τη συχνότητα
-        for (auto& entry : _entries) {
-            if (entry.tag == tag) {
-                entry.frequency++; // *** Αύξηση συχνότητας στο hit ***
-                return true; // Το tag βρέθηκε
-            }
+        return _dueling.UseB(set) ? BRRIP::Replace(set, tag) : SRRIP::Replace(set, tag);
+    }
+
+    std::string Report(const std::string &level, const std::string &prefix) const
+    {
+        return _dueling.Report(level, prefix, "SRRIP", "BRRIP");
+    }
+    VOID ResetStats() { _dueling.ResetStats(); }
+};
+
+
+// ************************
+// SHiP (Signature-based Hit Predictor) Replacement Policy
+// ************************
+// SRRIP with the insertion RRPV predicted from the instruction that misses
+// (SHiP-PC). A table of saturating counters indexed by the signature of
+// that instruction learns whether its lines are re-referenced: every hit
+// counts up, and every line evicted without a hit counts down. The lines
+// of the signatures down to 0 are inserted at the distant RRPV Rmax.
+class SHiP : public SRRIP
+{
+  private:
+    static const UINT32 SIGNATURE_BITS = 14;
+    static const UINT32 COUNTER_MAX = 7;      // 3 bits
+    static const UINT16 REUSED = 0x8000;      // flag of the line signatures
+
+    std::vector<UINT8> _shct;     // signature history counter table
+    std::vector<UINT16> _lines;   // per line, the signature that inserted it
+    UINT32 _signature;            // of the current access
+    CACHE_STATS _insertions[2];   // at Rmax - 1 and at Rmax
+
+  public:
+    static const bool SHARED_REPLACEMENT_STATE = true;
+    static const bool USES_PC = true;
+
+    // Counters start at 1: the first lines of a signature are inserted as
+    // by SRRIP, until one of them is evicted without a hit
+    SHiP(UINT32 numSets, UINT32 associativity)
+      : SRRIP(numSets, associativity),
+        _shct(1U << SIGNATURE_BITS, 1),
+        _lines(numSets * associativity, 0),
+        _signature(0)
+    {
+        ResetStats();
+    }
+
+    std::string Name() const { return "SHiP"; }
+
+    VOID SetPC(ADDRINT pc) { _signature = PcSignature(pc, SIGNATURE_BITS); }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return false;
+        Meta(set)[way] = 0;
+        UINT16 &line = _lines[set * _associativity + way];
+        UINT8 &counter = _shct[line & ~REUSED];
+        counter += counter < COUNTER_MAX;
+        line |= REUSED;
+        return true;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        const bool distant = _shct[_signature] == 0;
+        _insertions[distant]++;
+        const CACHE_TAG evicted = Insert(set, tag, distant ? _rmax : _rmax - 1);
+
+        // The way still holds the signature of the line evicted from it
+        UINT16 &line = _lines[set * _associativity + FindWay(set, tag)];
+        if (!(evicted == INVALID_TAG) && !(line & REUSED)) {
+            UINT8 &counter = _shct[line];
+            counter -= counter > 0;
         }
-        return false; // Το tag δεν βρέθηκε
+        line = _signature;
+        return evicted;
     }
 
-    // Αντικατάσταση ενός block στο set ακολουθώντας την πολιτική LFU.
-    // Επιστρέφει το tag που αφαιρέθηκε, ή INVALID_TAG αν δεν έγινε αφαίρεση.
-    CACHE_TAG Replace(CACHE_TAG tag)
+    std::string Report(const std::string &level, const std::string &prefix) const
     {
-        CACHE_TAG evicted_tag = INVALID_TAG;
+        const CACHE_STATS insertions = _insertions[false] + _insertions[true];
+        std::string out = prefix + level + " SHiP:\n";
+        out += prefix + ljstr(level + "-Distant-Insertions: ", 28) + dec2str(_insertions[true], 12) + "  " +
+               fltstr(insertions ? 100.0 * _insertions[true] / insertions : 0, 2, 6) + "%\n";
+        out += prefix + "\n";
+        return out;
+    }
+    VOID ResetStats() { _insertions[false] = _insertions[true] = 0; }
+};
+
+
+// ************************
+// Hawkeye Replacement Policy
+// ************************
+// Learns from Belady's OPT on a sample of the sets which instructions
+// insert lines that OPT would keep (cache-friendly) or not (cache-averse).
+//
+// OPTgen replays OPT on every sampled set over the last 8 x associativity
+// accesses to it: an occupancy vector counts the lines OPT keeps at every
+// one of these times. A reuse is an OPT hit if the line fits in the cache
+// from its previous access on, in which case it is kept there. The
+// predictor, saturating counters indexed by the signature of the
+// instruction of the previous access, counts up on OPT hits and down on
+// OPT misses, reuses too far apart included.
+//
+// Lines are managed with 3-bit RRPVs: averse lines are inserted and hit at
+// 7, friendly ones at 0, aging the other friendly lines at each friendly
+// insertion. Averse lines are evicted first; when there is none, the
+// oldest friendly line goes, and its instruction is trained down.
+class Hawkeye : public SET_ARRAY
+{
+  private:
+    static const UINT32 RRPV_AVERSE = 7;
+    static const UINT32 SIGNATURE_BITS = 13;
+    static const UINT32 COUNTER_MAX = 7;      // 3 bits, friendly from 4
+    static const UINT32 SAMPLED_SETS = 64;
+
+    // An access of OPTgen's history
+    struct SAMPLE
+    {
+        ADDRINT tag;
+        UINT32 time;
+        UINT32 signature;
+    };
+
+    const UINT32 _history;          // accesses of a sampled set OPTgen sees
+    const UINT32 _sample_region;    // sets per sampled set
+    std::vector<UINT8> _predictor;
+    std::vector<UINT16> _signatures;    // per line, of its last access
+    std::vector<UINT32> _time;          // per sampled set, its accesses
+    std::vector<UINT8> _occupancy;      // per sampled set, _history times
+    std::vector<SAMPLE> _samples;       // per sampled set, _history lines
+    UINT32 _signature;                  // of the current access
+
+    CACHE_STATS _opt_accesses;
+    CACHE_STATS _opt_hits;
+    CACHE_STATS _insertions[2];         // friendly and averse
 
-        if (_entries.size() < _associativity) {
-            // Το set δεν είναι γεμάτο. Απλά προσθέτουμε το νέο entry.
-            // Χρησιμοποιούμε emplace_back για να κατασκευάσουμε το CacheEntry απευθείας μέσα στο vector.
-            // Η αρχική συχνότητα είναι 1 (η τρέχουσα πρόσβαση).
-            _entries.emplace_back(tag, 1);
-        } else if (_associativity > 0) {
-            // Το set είναι γεμάτο. Πρέπει να βρούμε και να αντικαταστήσουμε το LFU entry.
-
-            // Βρίσκουμε τον δείκτη (index) του entry με τη μικρότερη συχνότητα.
-            // Tie-breaking: Αν υπάρχουν πολλά με την ίδια ελάχιστη συχνότητα,
-            // αυτή η υλοποίηση επιλέγει το *πρώτο* που θα συναντήσει στον vector.
-            UINT64 min_freq = std::numeric_limits<UINT64>::max(); // Αρχικοποίηση με τη μέγιστη δυνατή τιμή
-            UINT32 victim_index = 0; // Δείκτης του "θύματος" προς αντικατάσταση
-
-            if (!_entries.empty()) { // Ασφάλεια για την περίπτωση assoc=0 ή άδειου vector
-                 for (UINT32 i = 0; i < _entries.size(); ++i) {
-                     if (_entries[i].frequency < min_freq) {
-                         min_freq = _entries[i].frequency;
-                         victim_index = i;
-                     }
-                 }
-
-                 // Αποθηκεύουμε το tag του θύματος που θα αφαιρεθεί
-                 evicted_tag = _entries[victim_index].tag;
-
-                 // Αντικαθιστούμε το θύμα με το νέο tag και **μηδενίζουμε/αρχικοποιούμε** τη συχνότητά του.
-                 // Η νέα συχνότητα τίθεται σε 1, γιατί αυτή η εισαγωγή μετράει ως η πρώτη του χρήση.
-                 _entries[victim_index].tag = tag;
-                 _entries[victim_index].frequency = 1;
+    bool Friendly(UINT32 signature) const { return _predictor[signature] > COUNTER_MAX / 2; }
+
+    VOID Train(UINT32 signature, bool optHit)
+    {
+        UINT8 &counter = _predictor[signature];
+        if (optHit)
+            counter += counter < COUNTER_MAX;
+        else
+            counter -= counter > 0;
+    }
+
+    // Runs OPTgen on an access to sampled set `sampled`
+    VOID OptGen(UINT32 sampled, CACHE_TAG tag)
+    {
+        const UINT32 now = _time[sampled]++;
+        UINT8 *occupancy = &_occupancy[sampled * _history];
+        SAMPLE *samples = &_samples[sampled * _history];
+        occupancy[now % _history] = 0;
+
+        // The previous access to the line, else the oldest sample, which
+        // the line replaces
+        SAMPLE *sample = NULL;
+        SAMPLE *oldest = &samples[0];
+        for (UINT32 i = 0; i < _history; i++) {
+            if (samples[i].tag == tag) {
+                sample = &samples[i];
+                break;
             }
+            if (oldest->tag != INVALID_TAG &&
+                (samples[i].tag == INVALID_TAG || samples[i].time < oldest->time))
+                oldest = &samples[i];
         }
-        return evicted_tag;
+
+        if (sample) {
+            bool hit = now - sample->time < _history;
+            for (UINT32 t = sample->time; hit && t != now; t++)
+                hit = occupancy[t % _history] < _associativity;
+            if (hit)
+                for (UINT32 t = sample->time; t != now; t++)
+                    occupancy[t % _history]++;
+            Train(sample->signature, hit);
+            _opt_accesses++;
+            _opt_hits += hit;
+        } else {
+            // With as many samples as accesses in the history, the oldest
+            // one is out of it: its line would have been an OPT miss
+            sample = oldest;
+            if (sample->tag != INVALID_TAG)
+                Train(sample->signature, false);
+        }
+
+        sample->tag = tag;
+        sample->time = now;
+        sample->signature = _signature;
     }
 
-    // Διαγραφή ενός συγκεκριμένου tag αν υπάρχει στο set (π.χ., για την L2 inclusivity)
-    VOID DeleteIfPresent(CACHE_TAG tag)
+  public:
+    static const bool SHARED_REPLACEMENT_STATE = true;
+    static const bool USES_PC = true;
+
+    Hawkeye(UINT32 numSets, UINT32 associativity)
+      : SET_ARRAY(numSets, associativity),
+        _history(8 * associativity),
+        _sample_region(numSets > SAMPLED_SETS ? numSets / SAMPLED_SETS : 1),
+        _predictor(1U << SIGNATURE_BITS, COUNTER_MAX / 2 + 1),
+        _signatures(numSets * associativity, 0),
+        _time(numSets / _sample_region, 0),
+        _occupancy(_time.size() * _history, 0),
+        _signature(0)
     {
-        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
-            // it->tag για πρόσβαση στο μέλος tag του struct CacheEntry
-            if (it->tag == tag) { // Βρέθηκε το tag
-                _entries.erase(it); // Αφαιρούμε το στοιχείο CacheEntry
-                break;              // Υποθέτουμε μοναδικότητα των tags
+        SAMPLE empty = { INVALID_TAG, 0, 0 };
+        _samples.assign(_time.size() * _history, empty);
+        ResetStats();
+    }
+
+    std::string Name() const { return "Hawkeye"; }
+
+    VOID SetPC(ADDRINT pc) { _signature = PcSignature(pc, SIGNATURE_BITS); }
+
+    // Sampled sets are at a different offset in every region of sets, so
+    // strides do not hit them all
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        if (set % _sample_region == (set / _sample_region) % _sample_region)
+            OptGen(set / _sample_region, tag);
+
+        INT32 way = FindWay(set, tag);
+        if (way < 0)
+            return false;
+        Meta(set)[way] = Friendly(_signature) ? 0 : RRPV_AVERSE;
+        _signatures[set * _associativity + way] = _signature;
+        return true;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        CACHE_TAG evicted = INVALID_TAG;
+        UINT32 *meta = Meta(set);
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            const UINT64 averse = MatchMeta(meta, RRPV_AVERSE, _associativity);
+            if (averse) {
+                way = FirstWay(averse);
+            } else {
+                way = MaxMetaWay(set);
+                Train(_signatures[set * _associativity + way], false);
             }
+            evicted = Tags(set)[way];
         }
+
+        const bool friendly = Friendly(_signature);
+        _insertions[!friendly]++;
+        if (friendly) {
+            for (UINT32 i = 0; i < _associativity; i++)
+                meta[i] += meta[i] < RRPV_AVERSE - 1;
+        }
+        Tags(set)[way] = tag;
+        meta[way] = friendly ? 0 : RRPV_AVERSE;
+        _signatures[set * _associativity + way] = _signature;
+        return evicted;
+    }
+
+    std::string Report(const std::string &level, const std::string &prefix) const
+    {
+        const CACHE_STATS insertions = _insertions[false] + _insertions[true];
+        std::string out = prefix + level + " Hawkeye:\n";
+        out += prefix + ljstr(level + "-Averse-Insertions: ", 28) + dec2str(_insertions[true], 12) + "  " +
+               fltstr(insertions ? 100.0 * _insertions[true] / insertions : 0, 2, 6) + "%\n";
+        out += prefix + ljstr(level + "-OPTgen-Reuses: ", 28) + dec2str(_opt_accesses, 12) + "\n";
+        out += prefix + ljstr(level + "-OPTgen-Hits: ", 28) + dec2str(_opt_hits, 12) + "  " +
+               fltstr(_opt_accesses ? 100.0 * _opt_hits / _opt_accesses : 0, 2, 6) + "%\n";
+        out += prefix + "\n";
+        return out;
     }
-}; // End class LFU
+    VOID ResetStats()
+    {
+        _opt_accesses = _opt_hits = 0;
+        _insertions[false] = _insertions[true] = 0;
+    }
+};
 
 
 // ************************
-// LIP (LRU Insertion Policy) Replacement Policy
+// OPT (Belady) Replacement Policy
 // ************************
-class LIP
+// Evicts the line used again the farthest in the future. Only the replay
+// tool knows the future, from a first pass over the trace (see opt.h). New
+// lines are always inserted, as the hierarchy fills every miss: this is OPT
+// without bypass, the bound of the policies that do not bypass either.
+class OPT : public SET_ARRAY
 {
-  protected:
-    std::vector<CACHE_TAG> _tags; // Αποθηκεύει τα tags. front()=LRU, back()=MRU
-    UINT32 _associativity;        // Η συσχετιστικότητα του set
+  private:
+    std::vector<UINT64> _next_uses;   // per line, in references
+    UINT64 _now;                      // references so far
+    UINT64 _next_use;                 // of the current reference's block
+
+  public:
+    static const bool USES_NEXT_USE = true;
 
+    OPT(UINT32 numSets, UINT32 associativity)
+      : SET_ARRAY(numSets, associativity),
+        _next_uses(numSets * associativity, NEVER),
+        _now(0), _next_use(NEVER) {}
+
+    std::string Name() const { return "OPT"; }
+
+    VOID SetNextUse(UINT32 set, CACHE_TAG tag, UINT64 distance)
+    {
+        _now++;
+        _next_use = distance == NEVER ? NEVER : _now + distance;
+        INT32 way = FindWay(set, tag);
+        if (way >= 0)
+            _next_uses[set * _associativity + way] = _next_use;
+    }
+
+    // SetNextUse() already updated the next use of a hit
+    bool Find(UINT32 set, CACHE_TAG tag) const { return FindWay(set, tag) >= 0; }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        CACHE_TAG evicted = INVALID_TAG;
+        UINT64 *nextUses = &_next_uses[set * _associativity];
+        INT32 way = FindInvalidWay(set);
+        if (way < 0) {
+            way = 0;
+            for (UINT32 i = 1; i < _associativity; i++)
+                if (nextUses[i] > nextUses[way])
+                    way = i;
+            evicted = Tags(set)[way];
+        }
+        Tags(set)[way] = tag;
+        nextUses[way] = _next_use;
+        return evicted;
+    }
+};
+
+
+/**
+ * Every replacement policy that can be selected at runtime
+ **/
+#define CACHE_SET_POLICIES(X) X(LRU) X(Random) X(LFU) X(LIP) X(SRRIP) X(BIP) X(BRRIP) X(DIP) X(DRRIP) \
+                              X(SHiP) X(Hawkeye) X(OPT)
+
+} // namespace CACHE_SET
+
+
+/**
+ * Set array of a write-back cache level, with a dirty bit for every line
+ * next to the replacement policy SET. Lines must be brought in with Fill()
+ * and removed with Invalidate(), which keep the bits of empty ways clear.
+ **/
+template <class SET>
+class DIRTY_SET : public SET
+{
+  private:
+    std::vector<UINT64> _dirty; // per set, bit w for way w
+
+  public:
+    DIRTY_SET(UINT32 numSets, UINT32 associativity)
+      : SET(numSets, associativity), _dirty(numSets, 0) {}
+
+    // Brings `tag` in, dirty or clean, returning the tag of the line it
+    // evicted (INVALID_TAG if none) and in `evictedDirty` whether that
+    // line was dirty
+    CACHE_TAG Fill(UINT32 set, CACHE_TAG tag, bool dirty, bool &evictedDirty)
+    {
+        const CACHE_TAG evicted = SET::Replace(set, tag);
+        const UINT64 bit = UINT64(1) << this->FindWay(set, tag);
+        evictedDirty = !(evicted == INVALID_TAG) && (_dirty[set] & bit);
+        _dirty[set] = dirty ? _dirty[set] | bit : _dirty[set] & ~bit;
+        return evicted;
+    }
+
+    // Marks the line of `tag` dirty. Returns false if it is not there.
+    bool MarkDirty(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        if (way < 0)
+            return false;
+        _dirty[set] |= UINT64(1) << way;
+        return true;
+    }
+
+    // Removes `tag` if it is there, returning whether it was dirty
+    bool Invalidate(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        if (way < 0)
+            return false;
+        const UINT64 bit = UINT64(1) << way;
+        const bool dirty = (_dirty[set] & bit) != 0;
+        _dirty[set] &= ~bit;
+        SET::DeleteIfPresent(set, tag);
+        return dirty;
+    }
+};
+
+
+/**
+ * Policy independent interface of a cache hierarchy, for setup and
+ * reporting code that does not know the concrete type. Accesses go through
+ * the concrete TWO_LEVEL_CACHE type (see DispatchPolicies()) so they are
+ * not virtual calls.
+ **/
+class CACHE_BASE
+{
+  public:
+    typedef enum 
+    {
+        ACCESS_TYPE_LOAD,
+        ACCESS_TYPE_STORE,
+        ACCESS_TYPE_NUM
+    } ACCESS_TYPE;
+
+    static const UINT32 HIT_MISS_NUM = 2;
+
+    // Hit/miss counters of both levels, indexed by [access type][hit]
+    struct COUNTERS
+    {
+        CACHE_STATS l1[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+        CACHE_STATS l2[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    };
+
+    virtual ~CACHE_BASE() {}
+
+    virtual string StatsLong(string prefix = "") const = 0;
+    virtual string PrintCache(string prefix = "") const = 0;
+
+    // Zeroes the statistics, keeping the cache contents (end of a warmup)
+    virtual VOID ResetStats() = 0;
+
+    // The current counters, to measure intervals of the simulation
+    virtual COUNTERS Stats() const = 0;
+
+    // The bytes read from and written to memory so far. Returns false if
+    // the hierarchy does not model its memory traffic.
+    virtual bool MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const
+    {
+        return false;
+    }
+
+    // Attributes the L1 misses to their instructions and data regions from
+    // now on (see profile.h), `profile` reset with the statistics. Returns
+    // false if the hierarchy does not support it.
+    virtual bool SetProfile(MISS_PROFILE *profile) { return false; }
+
+    // The StatsLong() report of a hierarchy with the given counters
+    static string FormatStats(const COUNTERS &stats, string prefix = "");
+
+    // The hits, misses and accesses of one level, by access type
+    static string FormatLevelStats(const CACHE_STATS access[ACCESS_TYPE_NUM][HIT_MISS_NUM],
+                                   const string &level, const string &prefix);
+};
+
+
+/**
+ * Geometry of one cache level, and how it splits addresses
+ **/
+struct CACHE_GEOMETRY
+{
+    UINT32 cacheSize;
+    UINT32 blockSize;
+    UINT32 associativity;
+    UINT32 lineShift;     // i.e., no of block offset bits
+    UINT32 setIndexMask;  // mask applied to get the set index
+
+    CACHE_GEOMETRY(UINT32 size, UINT32 block, UINT32 assoc)
+      : cacheSize(size), blockSize(block), associativity(assoc),
+        lineShift(FloorLog2(block)), setIndexMask((size / (assoc * block)) - 1)
+    {
+        // They all need to be power of 2
+        ASSERTX(IsPowerOf2(blockSize));
+        ASSERTX(IsPowerOf2(setIndexMask + 1));
+    }
+
+    UINT32 NumSets() const { return setIndexMask + 1; }
+
+    VOID SplitAddress(const ADDRINT addr, CACHE_TAG & tag, UINT32 & setIndex) const
+    {
+        tag = addr >> lineShift;
+        setIndex = tag & setIndexMask;
+        tag = tag >> FloorLog2(setIndexMask + 1);
+    }
+
+    // Address of the block with `tag` in set `setIndex`
+    ADDRINT BlockAddress(CACHE_TAG tag, UINT32 setIndex) const
+    {
+        ADDRINT addr = ADDRINT(tag) << FloorLog2(NumSets());
+        addr = addr | setIndex;
+        return addr << lineShift;
+    }
+
+    // The geometry block of PrintCache()
+    string Print(const string &title, const string &prefix) const
+    {
+        string out;
+        out += prefix + "  " + title + ":\n";
+        out += prefix + "    Size(KB):       " + dec2str(cacheSize/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(blockSize, 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(associativity, 5) + "\n";
+        out += prefix + "\n";
+        return out;
+    }
+};
+
+
+/**
+ * Cache levels below the L2 (L3 and beyond), which TWO_LEVEL_CACHE only
+ * reaches on L2 misses. Levels are chained at compile time, with the
+ * concrete CACHE_LEVEL type of the next level as NEXT, or at runtime
+ * through this interface, in which case only the hops between levels are
+ * virtual calls.
+ **/
+class LOWER_LEVEL_BASE
+{
   public:
-    // Constructor
-    LIP(UINT32 associativity = 8) : _associativity(associativity)
+    typedef CACHE_BASE::ACCESS_TYPE ACCESS_TYPE;
+
+    // What an access counts: everything for demand accesses, only the
+    // data moved for prefetch fills, nothing while warming up
+    enum COUNT_MODE
     {
-        // Προαιρετική δέσμευση χώρου στο vector για αποδοτικότητα
-        if (_associativity > 0) {
-            _tags.reserve(associativity);
-        }
-    }
+        COUNT_NONE = 0,
+        COUNT_TRAFFIC,
+        COUNT_ALL
+    };
 
-    // Ορισμός συσχετιστικότητας και καθαρισμός των tags
-    VOID SetAssociativity(UINT32 associativity)
+    // Blocks evicted by inclusive levels: the levels above them drop every
+    // block in [addr, addr + size). `dirty` blocks were written back whole
+    // by the level that evicted them, dirty copies above included.
+    struct EVICTIONS
     {
-        _associativity = associativity;
-        _tags.clear();
-        if (_associativity > 0) {
-            _tags.reserve(associativity);
+        static const UINT32 MAX = 8;
+        UINT32 num;
+        ADDRINT addr[MAX];
+        UINT32 size[MAX];
+        bool dirty[MAX];
+
+        EVICTIONS() : num(0) {}
+
+        VOID Add(ADDRINT blockAddr, UINT32 blockSize, bool blockDirty)
+        {
+            ASSERTX(num < MAX);
+            addr[num] = blockAddr;
+            size[num] = blockSize;
+            dirty[num++] = blockDirty;
         }
-    }
+    };
 
-    // Επιστροφή συσχετιστικότητας
-    UINT32 GetAssociativity() const { return _associativity; }
+    virtual ~LOWER_LEVEL_BASE() {}
 
-    // Επιστροφή ονόματος πολιτικής
-    std::string Name() const { return "LIP"; }
+    // Serves a miss of the level above by the instruction at `pc`, reaching
+    // this level at cycle `now`. Returns the cycles spent from this level
+    // down, and adds the blocks inclusion removes to `evictions`.
+    virtual UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc, UINT64 now, COUNT_MODE count,
+                          EVICTIONS &evictions) = 0;
 
-    // Εύρεση ενός tag στο set.
-    // Επιστρέφει true αν βρεθεί (hit), false αλλιώς (miss).
-    // **Σε περίπτωση hit, προωθεί το tag στη θέση MRU (όπως η LRU).**
-    bool Find(CACHE_TAG tag)
-    {
-        for (auto it = _tags.begin(); it != _tags.end(); ++it) {
-            if (*it == tag) { // Το tag βρέθηκε (Hit)
-                _tags.erase(it);           // Αφαιρούμε το tag από την τρέχουσα θέση του
-                _tags.push_back(tag);// Το προσθέτουμε στο τέλος (το κάνουμε MRU)
-                return true;
-            }
-        }
-        return false; // Το tag δεν βρέθηκε (Miss)
-    }
+    // Takes `bytes` of data written back or through by the level above at
+    // cycle `now`. Writes are posted: they take no cycles, and go on below
+    // without allocating when they miss. Traffic is only counted if `count`
+    // is set.
+    virtual VOID Write(ADDRINT addr, UINT32 bytes, UINT64 now, bool count) = 0;
 
-    // Αντικατάσταση ενός block στο set ακολουθώντας την πολιτική LIP.
-    // Επιστρέφει το tag που αφαιρέθηκε, ή INVALID_TAG αν δεν έγινε αφαίρεση.
-    // **Σημαντική διαφορά από LRU: Εισάγει το νέο tag στη θέση LRU.**
-    CACHE_TAG Replace(CACHE_TAG tag)
-    {
-        CACHE_TAG evicted_tag = INVALID_TAG;
+    // The bytes the last level read from and wrote to memory
+    virtual VOID MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const = 0;
 
-        // Έλεγχος αν το set είναι γεμάτο (και η associativity > 0)
-        if (_tags.size() >= _associativity && _associativity > 0) {
-            // Το set είναι γεμάτο. Πρέπει να αφαιρέσουμε το LRU block (αυτό που είναι στην αρχή).
-            evicted_tag = _tags.front(); // Παίρνουμε το tag του LRU
-            _tags.erase(_tags.begin());  // Αφαιρούμε το LRU στοιχείο
-        }
-        // Αν associativity == 0, δεν κάνουμε τίποτα εδώ.
+    virtual UINT32 BlockSize() const = 0;
+    virtual string PrintCache(string prefix) const = 0;
+    virtual string StatsLong(string prefix) const = 0;
+    virtual VOID ResetStats() = 0;
 
-        // Εισάγουμε το νέο tag στην αρχή του vector (στη θέση LRU).
-        // Αυτό γίνεται είτε το set ήταν γεμάτο (και μόλις αδειάσαμε μια θέση) είτε όχι.
-        if (_associativity > 0) { // Εισάγουμε μόνο αν η cache μπορεί να κρατήσει στοιχεία
-            _tags.insert(_tags.begin(), tag);
-        }
+    // The next reference is to `addr` (see CACHE_SET::SET_ARRAY::SetNextUse())
+    virtual VOID SetNextUse(ADDRINT addr, UINT64 distance) {}
+};
 
-        // Επιστρέφουμε το tag που (πιθανώς) αφαιρέθηκε
-        return evicted_tag;
+/**
+ * One cache level below the L2, with its own replacement policy, hit
+ * latency and inclusion mode. Misses go on to the next level, or to memory
+ * for the last one. Loads and stores always allocate, and the level is
+ * write-back: lines written by the levels above are written below when
+ * they are evicted.
+ **/
+template <class SET, class NEXT = LOWER_LEVEL_BASE>
+class CACHE_LEVEL final : public LOWER_LEVEL_BASE
+{
+  private:
+    const std::string _name;         // "L3", ...
+    const CACHE_GEOMETRY _geometry;
+    const UINT32 _hit_latency;
+    const UINT32 _miss_latency;      // of memory, for the last level
+    const bool _inclusive;           // of the levels above
+    DIRTY_SET<SET> _sets;
+    NEXT *_next;                     // owned, NULL for the last level
+    CACHE_STATS _stats[CACHE_BASE::ACCESS_TYPE_NUM][CACHE_BASE::HIT_MISS_NUM];
+    CACHE_STATS _fill_bytes;         // read from below
+    CACHE_STATS _write_bytes;        // written below
+
+    VOID WriteBelow(ADDRINT addr, UINT32 bytes, UINT64 now, bool count)
+    {
+        if (count)
+            _write_bytes += bytes;
+        if (_next)
+            _next->Write(addr, bytes, now, count);
     }
 
-    // Διαγραφή ενός συγκεκριμένου tag αν υπάρχει στο set (ίδιο με την LRU)
-    VOID DeleteIfPresent(CACHE_TAG tag)
+    // Drops the blocks evicted below. Returns whether any of them was dirty.
+    bool Invalidate(ADDRINT addr, UINT32 size)
     {
-        for (auto it = _tags.begin(); it != _tags.end(); ++it) {
-            if (*it == tag) { // Βρέθηκε το tag
-                _tags.erase(it); // Το αφαιρούμε
-                break;           // Υποθέτουμε μοναδικότητα των tags
-            }
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        bool dirty = false;
+        for (UINT32 i = 0; i < size; i += _geometry.blockSize) {
+            _geometry.SplitAddress(addr | i, tag, setIndex);
+            dirty |= _sets.Invalidate(setIndex, tag);
         }
+        return dirty;
     }
-}; // End class LIP
-
-*/
-// ************************
-// SRRIP (Static Re-reference Interval Prediction) Replacement Policy
-// ************************
-class SRRIP
-{
-  protected:
-    // Δομή για την αποθήκευση του tag και της τιμής RRPV
-    struct CacheEntry {
-        CACHE_TAG tag;  // Το tag της γραμμής
-        UINT64 rrpv;    // Re-Reference Prediction Value (χρησιμοποιούμε UINT64 για ασφάλεια αν n είναι μεγάλο)
 
-        // Constructor
-        CacheEntry(CACHE_TAG t, UINT64 r) : tag(t), rrpv(r) {}
-    };
+  public:
+    CACHE_LEVEL(const std::string &name,
+                UINT32 cacheSize, UINT32 blockSize, UINT32 associativity,
+                UINT32 hitLatency, UINT32 missLatency, bool inclusive, NEXT *next = NULL)
+      : _name(name),
+        _geometry(cacheSize, blockSize, associativity),
+        _hit_latency(hitLatency),
+        _miss_latency(missLatency),
+        _inclusive(inclusive),
+        _sets(_geometry.NumSets(), associativity),
+        _next(next)
+    {
+        ASSERTX(!_next || _next->BlockSize() >= blockSize);
+        ResetStats();
+    }
+    ~CACHE_LEVEL() { delete _next; }
 
-    std::vector<CacheEntry> _entries; // Αποθηκεύει τα entries (tag + RRPV)
-    UINT32 _associativity;            // Η συσχετιστικότητα (n)
-    UINT64 _rmax;                     // Η μέγιστη τιμή RRPV (Rmax = 2^n - 1)
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc, UINT64 now, COUNT_MODE count,
+                  EVICTIONS &evictions) override
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        _geometry.SplitAddress(addr, tag, setIndex);
+
+        _sets.SetPC(pc);
+        const bool hit = _sets.Find(setIndex, tag);
+        if (count == COUNT_ALL)
+            _stats[accessType][hit]++;
+        if (hit)
+            return _hit_latency;
+
+        bool replacedDirty;
+        const CACHE_TAG replaced = _sets.Fill(setIndex, tag, false, replacedDirty);
+        if (count != COUNT_NONE)
+            _fill_bytes += _geometry.blockSize;
+        UINT32 cycles = _hit_latency;
+        if (_next) {
+            // Blocks dropped below for inclusion leave this level too, and
+            // take their dirty data along if the level that evicted them
+            // did not write them back
+            const UINT32 first = evictions.num;
+            cycles += _next->Access(addr, accessType, pc, now + _hit_latency, count, evictions);
+            for (UINT32 i = first; i < evictions.num; i++)
+                if (Invalidate(evictions.addr[i], evictions.size[i]) && !evictions.dirty[i])
+                    WriteBelow(evictions.addr[i], evictions.size[i], now, count != COUNT_NONE);
+        } else {
+            cycles += _miss_latency;
+        }
 
-    // Βοηθητική συνάρτηση για τον υπολογισμό του Rmax = 2^n - 1
-    // Χρησιμοποιεί bit shift (1ULL << n) που είναι πιο ασφαλές/αποδοτικό από pow() για ακέραιες δυνάμεις του 2.
-    static UINT64 calculate_rmax(UINT32 associativity) {
-        if (associativity == 0) return 0;
-        // Προσοχή σε πολύ μεγάλες τιμές associativity (αν n >= 64, το shift θα υπερχειλίσει το UINT64)
-        if (associativity >= 64) {
-            // Σε αυτή την απίθανη περίπτωση, επιστρέφουμε τη μέγιστη τιμή UINT64
-            return std::numeric_limits<UINT64>::max();
+        if (!(replaced == INVALID_TAG)) {
+            const ADDRINT replacedAddr = _geometry.BlockAddress(replaced, setIndex);
+            if (replacedDirty)
+                WriteBelow(replacedAddr, _geometry.blockSize, now, count != COUNT_NONE);
+            if (_inclusive)
+                evictions.Add(replacedAddr, _geometry.blockSize, replacedDirty);
         }
-        // Υπολογισμός 2^n - 1 χρησιμοποιώντας bit shift
-        return (1ULL << associativity) - 1;
+        return cycles;
     }
 
-  public:
-    // Constructor
-    SRRIP(UINT32 associativity = 8) : _associativity(associativity)
+    VOID Write(ADDRINT addr, UINT32 bytes, UINT64 now, bool count) override
     {
-        _rmax = calculate_rmax(_associativity);
-        // Προαιρετική δέσμευση χώρου
-        if (_associativity > 0) {
-             _entries.reserve(associativity);
-        }
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        _geometry.SplitAddress(addr, tag, setIndex);
+        if (!_sets.MarkDirty(setIndex, tag))
+            WriteBelow(addr, bytes, now, count);
     }
 
-    // Ορισμός συσχετιστικότητας, υπολογισμός Rmax και καθαρισμός
-    VOID SetAssociativity(UINT32 associativity)
+    VOID MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const override
     {
-        _associativity = associativity;
-        _rmax = calculate_rmax(_associativity); // Επαναϋπολογισμός Rmax
-        _entries.clear();
-        if (_associativity > 0) {
-             _entries.reserve(associativity);
+        if (_next) {
+            _next->MemoryTraffic(readBytes, writeBytes);
+            return;
         }
+        readBytes = _fill_bytes;
+        writeBytes = _write_bytes;
     }
 
-    // Επιστροφή συσχετιστικότητας
-    UINT32 GetAssociativity() const { return _associativity; }
+    UINT32 BlockSize() const override { return _geometry.blockSize; }
 
-    // Επιστροφή ονόματος πολιτικής
-    std::string Name() const { return "SRRIP"; }
+    string PrintCache(string prefix) const override
+    {
+        string out = _geometry.Print(_name + "-Data Cache", prefix);
+        out += prefix + _name + "-Sets: " + dec2str(_geometry.NumSets(), 4) + " - " + _sets.Name() +
+               " - assoc: " + dec2str(_sets.GetAssociativity(), 3) + "\n";
+        out += prefix + _name + "-Latency: " + dec2str(_hit_latency, 4) + "\n";
+        out += prefix + _name + "_inclusive: " + (_inclusive ? "Yes" : "No") + "\n";
+        if (_next)
+            out += _next->PrintCache(prefix);
+        return out;
+    }
 
-    // Εύρεση ενός tag στο set.
-    // Επιστρέφει true αν βρεθεί (hit), false αλλιώς (miss).
-    // **Σε περίπτωση hit, θέτει το RRPV του tag σε 0.**
-    bool Find(CACHE_TAG tag)
+    string StatsLong(string prefix) const override
     {
-        // Διατρέχουμε με αναφορά (&) για να αλλάξουμε το rrpv
-        for (auto& entry : _entries) {
-            if (entry.tag == tag) {
-                entry.rrpv = 0; // Θέτουμε RRPV=0 στο hit
-                return true;    // Το tag βρέθηκε
-            }
-        }
-        return false; // Το tag δεν βρέθηκε
+        string out = prefix + _name + " Cache Stats:\n";
+        out += CACHE_BASE::FormatLevelStats(_stats, _name, prefix);
+        out += prefix + "\n";
+        out += prefix + ljstr(_name + "-Fill-Bytes: ", 24) + dec2str(_fill_bytes, 12) + "\n";
+        out += prefix + ljstr(_name + "-Write-Bytes: ", 24) + dec2str(_write_bytes, 12) + "\n";
+        out += prefix + "\n";
+        out += _sets.Report(_name, prefix);
+        if (_next)
+            out += _next->StatsLong(prefix);
+        return out;
     }
 
-    // Αντικατάσταση ενός block στο set ακολουθώντας την πολιτική SRRIP.
-    // Επιστρέφει το tag που αφαιρέθηκε, ή INVALID_TAG αν δεν έγινε αφαίρεση.
-    CACHE_TAG Replace(CACHE_TAG tag)
+    VOID ResetStats() override
     {
-        CACHE_TAG evicted_tag = INVALID_TAG;
-        // Αρχική τιμή RRPV για νέα blocks (Rmax-1, ή 0 αν Rmax=0)
-        UINT64 initial_rrpv = (_rmax > 0) ? (_rmax - 1) : 0;
-
-        // Έλεγχος αν το set είναι γεμάτο
-        if (_entries.size() < _associativity) {
-            // Το set δεν είναι γεμάτο, απλά προσθέτουμε το νέο entry με RRPV = Rmax-1.
-            _entries.emplace_back(tag, initial_rrpv);
-        }
-        // Έλεγχος αν το set είναι γεμάτο (και η associativity > 0)
-        else if (_associativity > 0) {
-            // Το set είναι γεμάτο. Πρέπει να βρούμε θύμα με RRPV == Rmax.
-
-            UINT32 victim_index = 0;    // Ο δείκτης του θύματος
-            bool victim_found = false;  // Flag για να ξέρουμε αν βρήκαμε θύμα
-
-            // Βρόχος αναζήτησης θύματος: συνεχίζει μέχρι να βρεθεί ένα με RRPV == Rmax
-            while (!victim_found) {
-                 // Πρώτη προσπάθεια: βρες ένα entry με RRPV == Rmax
-                 for (UINT32 i = 0; i < _entries.size(); ++i) {
-                     if (_entries[i].rrpv == _rmax) {
-                         victim_index = i;   // Βρήκαμε θύμα
-                         victim_found = true;
-                         break; // Έξοδος από τον εσωτερικό βρόχο for
-                     }
-                 }
-
-                 // Αν βρήκαμε θύμα σε αυτή την επανάληψη, βγαίνουμε και από τον εξωτερικό βρόχο while
-                 if (victim_found) {
-                     break;
-                 }
-
-                 // Αν *δεν* βρέθηκε θύμα με RRPV == Rmax σε αυτή την επανάληψη,
-                 // αυξάνουμε *όλα* τα RRPV κατά 1 και ξαναψάχνουμε στον επόμενο κύκλο του while.
-                 for (auto& entry : _entries) {
-                     // Αυξάνουμε το RRPV. Η λογική του βρόχου while διασφαλίζει ότι
-                     // δεν θα μείνουμε εδώ για πάντα και ότι τελικά κάποιο θα φτάσει Rmax.
-                     // Δεν χρειάζεται έλεγχος υπερχείλισης εδώ γιατί ο βρόχος θα τερματίσει.
-                     entry.rrpv++;
-                 }
-            } // Τέλος βρόχου while (!victim_found)
-
-            // Έχουμε βρει το θύμα στον δείκτη victim_index
-            // Αποθηκεύουμε το tag του θύματος
-            evicted_tag = _entries[victim_index].tag;
-
-            // Αντικαθιστούμε το θύμα με το νέο tag και αρχικοποιούμε το RRPV του νέου tag
-            _entries[victim_index].tag = tag;
-            _entries[victim_index].rrpv = initial_rrpv; // RRPV = Rmax - 1 για το νέο tag
-        }
-        // Αν associativity == 0, δεν κάνουμε τίποτα.
-
-        // Επιστρέφουμε το tag που (πιθανώς) αφαιρέθηκε
-        return evicted_tag;
+        memset(_stats, 0, sizeof(_stats));
+        _fill_bytes = _write_bytes = 0;
+        _sets.ResetStats();
+        if (_next)
+            _next->ResetStats();
     }
 
-    // Διαγραφή ενός συγκεκριμένου tag αν υπάρχει στο set (π.χ., για την L2 inclusivity)
-    VOID DeleteIfPresent(CACHE_TAG tag)
+    VOID SetNextUse(ADDRINT addr, UINT64 distance) override
     {
-        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
-            if (it->tag == tag) { // Βρέθηκε το tag
-                _entries.erase(it); // Αφαιρούμε το στοιχείο CacheEntry
-                break;              // Υποθέτουμε μοναδικότητα των tags
-            }
+        if (SET::USES_NEXT_USE) {
+            CACHE_TAG tag;
+            UINT32 setIndex;
+            _geometry.SplitAddress(addr, tag, setIndex);
+            _sets.SetNextUse(setIndex, tag, distance);
         }
+        if (_next)
+            _next->SetNextUse(addr, distance);
     }
-}; // End class SRRIP
-
-
-} // namespace CACHE_SET
+};
 
-template <class SET>
-class TWO_LEVEL_CACHE
+template <class L1SET, class L2SET = L1SET>
+class TWO_LEVEL_CACHE final : public CACHE_BASE
 {
-  public:
-    typedef enum 
-    {
-        ACCESS_TYPE_LOAD,
-        ACCESS_TYPE_STORE,
-        ACCESS_TYPE_NUM
-    } ACCESS_TYPE;
-
   private:
     enum {
         HIT_L1 = 0,
@@ -572,61 +1399,91 @@ class TWO_LEVEL_CACHE
         ACCESS_RESULT_NUM
     };
 
-    static const UINT32 HIT_MISS_NUM = 2;
-    CACHE_STATS _l1_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
-    CACHE_STATS _l2_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    COUNTERS _stats;
 
     UINT32 _latencies[ACCESS_RESULT_NUM];
 
-    SET *_l1_sets;
-    SET *_l2_sets;
-
     const std::string _name;
-    const UINT32 _l1_cacheSize;
-    const UINT32 _l2_cacheSize;
-    const UINT32 _l1_blockSize;
-    const UINT32 _l2_blockSize;
-    const UINT32 _l1_associativity;
-    const UINT32 _l2_associativity;
-
-    // computed params
-    const UINT32 _l1_lineShift; // i.e., no of block offset bits
-    const UINT32 _l2_lineShift;
-    const UINT32 _l1_setIndexMask; // mask applied to get the set index
-    const UINT32 _l2_setIndexMask;
+    const CACHE_GEOMETRY _l1_geometry;
+    const CACHE_GEOMETRY _l2_geometry;
+    const WRITE_POLICY _write;
+
+    // Data of a store, which the references do not record, in bytes
+    static const UINT32 STORE_BYTES = 8;
+
+    // Data moved between the levels, in bytes
+    struct TRAFFIC
+    {
+        CACHE_STATS l1Writebacks;    // dirty L1 victims, to the L2
+        CACHE_STATS l1WriteThroughs; // stores written through to the L2
+        CACHE_STATS l2Fills;         // read from below, prefetches included
+        CACHE_STATS l2Writes;        // written below: dirty victims, written through or
+                                     // not allocated data
+    };
+    TRAFFIC _traffic;
 
     // how many lines ahead to prefetch in L2 (0 disables prefetching)
     const UINT32 _l2_prefetch_lines;
+    L2_PREFETCHER _l2_prefetcher;
+    // Per L2 line, the time its prefetch completes, until its first demand
+    // access; 0 for the other lines
+    std::vector<UINT64> _l2_prefetch_ready;
+    PREFETCH_STATS _l2_prefetch_stats;
+    UINT64 _clock; // memory hierarchy cycles so far, the time of prefetches and of the
+                   // accesses below the L2
+
+    // Levels below the L2, owned; NULL when L2 misses go to memory
+    LOWER_LEVEL_BASE *_lower;
+
+    MISS_PROFILE *_profile; // NULL without -prof
+
+    // L2 set sampling: one in _l2_set_sampling sets is simulated
+    const UINT32 _l2_set_sampling;
+    std::vector<INT32> _l2_sampled_set; // per L2 set, its index in _l2_sets or -1
+    struct SET_COUNTERS
+    {
+        CACHE_STATS accesses;
+        CACHE_STATS misses;
+    };
+    std::vector<SET_COUNTERS> _l2_set_stats; // per sampled set
+    CACHE_STATS _l2_unsampled[ACCESS_TYPE_NUM];
+    // Recent accesses and misses of the sampled sets, halved periodically
+    UINT32 _l2_recent_accesses;
+    UINT32 _l2_recent_misses;
+    UINT32 _l2_miss_credit;
+
+    DIRTY_SET<L1SET> _l1_sets;
+    DIRTY_SET<L2SET> _l2_sets;
 
     CACHE_STATS L1SumAccess(bool hit) const
     {
         CACHE_STATS sum = 0;
         for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
-            sum += _l1_access[accessType][hit];
+            sum += _stats.l1[accessType][hit];
         return sum;
     }
     CACHE_STATS L2SumAccess(bool hit) const
     {
         CACHE_STATS sum = 0;
         for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
-            sum += _l2_access[accessType][hit];
+            sum += _stats.l2[accessType][hit];
         return sum;
     }
 
-    UINT32 L1NumSets() const { return _l1_setIndexMask + 1; }
-    UINT32 L2NumSets() const { return _l2_setIndexMask + 1; }
+    UINT32 L1NumSets() const { return _l1_geometry.NumSets(); }
+    UINT32 L2NumSets() const { return _l2_geometry.NumSets(); }
 
     // accessors
-    UINT32 L1CacheSize() const { return _l1_cacheSize; }
-    UINT32 L2CacheSize() const { return _l2_cacheSize; }
-    UINT32 L1BlockSize() const { return _l1_blockSize; }
-    UINT32 L2BlockSize() const { return _l2_blockSize; }
-    UINT32 L1Associativity() const { return _l1_associativity; }
-    UINT32 L2Associativity() const { return _l2_associativity; }
-    UINT32 L1LineShift() const { return _l1_lineShift; }
-    UINT32 L2LineShift() const { return _l2_lineShift; }
-    UINT32 L1SetIndexMask() const { return _l1_setIndexMask; }
-    UINT32 L2SetIndexMask() const { return _l2_setIndexMask; }
+    UINT32 L1CacheSize() const { return _l1_geometry.cacheSize; }
+    UINT32 L2CacheSize() const { return _l2_geometry.cacheSize; }
+    UINT32 L1BlockSize() const { return _l1_geometry.blockSize; }
+    UINT32 L2BlockSize() const { return _l2_geometry.blockSize; }
+    UINT32 L1Associativity() const { return _l1_geometry.associativity; }
+    UINT32 L2Associativity() const { return _l2_geometry.associativity; }
+    UINT32 L1LineShift() const { return _l1_geometry.lineShift; }
+    UINT32 L2LineShift() const { return _l2_geometry.lineShift; }
+    UINT32 L1SetIndexMask() const { return _l1_geometry.setIndexMask; }
+    UINT32 L2SetIndexMask() const { return _l2_geometry.setIndexMask; }
 
     VOID SplitAddress(const ADDRINT addr, UINT32 lineShift, UINT32 setIndexMask,
                       CACHE_TAG & tag, UINT32 & setIndex) const
@@ -636,21 +1493,76 @@ class TWO_LEVEL_CACHE
         tag = tag >> FloorLog2(setIndexMask + 1);
     }
 
+    template <bool COUNT>
+    UINT32 Lookup(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc);
+    template <bool COUNT>
+    VOID FillL2(UINT32 l2Set, UINT32 l2SetIndex, CACHE_TAG l2Tag);
+    template <bool COUNT>
+    VOID WriteL2(ADDRINT addr, UINT32 bytes);
+    template <bool COUNT>
+    VOID WriteBelow(ADDRINT addr, UINT32 bytes);
+    template <bool COUNT>
+    UINT32 LowerLevels(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc, UINT64 now, bool demand = true);
+    template <bool COUNT>
+    UINT32 L2Prefetch(ADDRINT addr, ADDRINT pc, UINT32 l2Set, CACHE_TAG l2Tag, bool l2Hit);
+
+    VOID SampleL2Sets();
+    template <bool COUNT>
+    UINT32 UnsampledL2Cycles(ACCESS_TYPE accessType);
+    double L2SamplingError() const;
+    TRAFFIC Traffic() const;
 
   public:
     // constructors/destructors
     TWO_LEVEL_CACHE(std::string name,
                 UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
                 UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
-                UINT32 l2PrefetchLines,
+                UINT32 l2PrefetchLines, PREFETCHER_KIND l2Prefetcher = PREFETCH_NEXT_LINE,
+                UINT32 l2SetSampling = 1,
+                const WRITE_POLICY &writePolicy = WRITE_POLICY(),
                 UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 15,
                 UINT32 l2MissLatency = 250);
+    ~TWO_LEVEL_CACHE() { delete _lower; }
+
+    UINT32 MemoryLatency() const { return _latencies[MISS_L2]; }
+
+    // Sets the cycle of the next access, for the timing models that know
+    // it (-ooo). Otherwise the clock only advances by the cycles of every
+    // access.
+    VOID SetClock(UINT64 now) { _clock = now; }
+
+    // The next reference is to `addr`, for the OPT levels (see
+    // CACHE_SET::SET_ARRAY::SetNextUse()). Not with set sampling.
+    VOID SetNextUse(ADDRINT addr, UINT64 distance)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        if (L1SET::USES_NEXT_USE) {
+            _l1_geometry.SplitAddress(addr, tag, setIndex);
+            _l1_sets.SetNextUse(setIndex, tag, distance);
+        }
+        if (L2SET::USES_NEXT_USE) {
+            _l2_geometry.SplitAddress(addr, tag, setIndex);
+            _l2_sets.SetNextUse(setIndex, tag, distance);
+        }
+        if (_lower)
+            _lower->SetNextUse(addr, distance);
+    }
+
+    // Chains the levels below the L2, which then take the L2 misses instead
+    // of memory. Not with set sampling, which only simulates part of the L2.
+    VOID SetLowerLevels(LOWER_LEVEL_BASE *lower)
+    {
+        ASSERTX(_l2_set_sampling == 1 && lower->BlockSize() >= L2BlockSize());
+        delete _lower;
+        _lower = lower;
+    }
 
     // Stats
-    CACHE_STATS L1Hits(ACCESS_TYPE accessType) const { return _l1_access[accessType][true];}
-    CACHE_STATS L2Hits(ACCESS_TYPE accessType) const { return _l2_access[accessType][true];}
-    CACHE_STATS L1Misses(ACCESS_TYPE accessType) const { return _l1_access[accessType][false];}
-    CACHE_STATS L2Misses(ACCESS_TYPE accessType) const { return _l2_access[accessType][false];}
+    CACHE_STATS L1Hits(ACCESS_TYPE accessType) const { return _stats.l1[accessType][true];}
+    CACHE_STATS L2Hits(ACCESS_TYPE accessType) const { return _stats.l2[accessType][true];}
+    CACHE_STATS L1Misses(ACCESS_TYPE accessType) const { return _stats.l1[accessType][false];}
+    CACHE_STATS L2Misses(ACCESS_TYPE accessType) const { return _stats.l2[accessType][false];}
     CACHE_STATS L1Accesses(ACCESS_TYPE accessType) const { return L1Hits(accessType) + L1Misses(accessType);}
     CACHE_STATS L2Accesses(ACCESS_TYPE accessType) const { return L2Hits(accessType) + L2Misses(accessType);}
     CACHE_STATS L1Hits() const { return L1SumAccess(true);}
@@ -660,239 +1572,769 @@ class TWO_LEVEL_CACHE
     CACHE_STATS L1Accesses() const { return L1Hits() + L1Misses();}
     CACHE_STATS L2Accesses() const { return L2Hits() + L2Misses();}
 
-    string StatsLong(string prefix = "") const;
-    string PrintCache(string prefix = "") const;
+    string StatsLong(string prefix = "") const override;
+    string PrintCache(string prefix = "") const override;
+    VOID ResetStats() override;
+    COUNTERS Stats() const override;
+    bool MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const override;
+
+    // Not with set sampling, whose unsimulated L2 sets do not know the L2 misses
+    bool SetProfile(MISS_PROFILE *profile) override
+    {
+        ASSERTX(_l2_set_sampling == 1);
+        _profile = profile;
+        return true;
+    }
+
+    // `pc` is the address of the instruction, 0 if unknown
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc = 0)
+    {
+        const UINT32 cycles = Lookup<true>(addr, accessType, pc);
+        _clock += cycles;
+        return cycles;
+    }
 
-    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType);
+    // Updates the cache contents only, without statistics (functional warming)
+    VOID Warm(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc = 0)
+    {
+        _clock += Lookup<false>(addr, accessType, pc);
+    }
 };
 
-template <class SET>
-TWO_LEVEL_CACHE<SET>::TWO_LEVEL_CACHE(
+template <class L1SET, class L2SET>
+TWO_LEVEL_CACHE<L1SET, L2SET>::TWO_LEVEL_CACHE(
                 std::string name,
                 UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
                 UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
-                UINT32 l2PrefetchLines,
+                UINT32 l2PrefetchLines, PREFETCHER_KIND l2Prefetcher, UINT32 l2SetSampling,
+                const WRITE_POLICY &writePolicy,
                 UINT32 l1HitLatency, UINT32 l2HitLatency, UINT32 l2MissLatency)
   : _name(name),
-    _l1_cacheSize(l1CacheSize),
-    _l2_cacheSize(l2CacheSize),
-    _l1_blockSize(l1BlockSize),
-    _l2_blockSize(l2BlockSize),
-    _l1_associativity(l1Associativity),
-    _l2_associativity(l2Associativity),
-    _l1_lineShift(FloorLog2(l1BlockSize)),
-    _l2_lineShift(FloorLog2(l2BlockSize)),
-    _l1_setIndexMask((l1CacheSize / (l1Associativity * l1BlockSize)) - 1),
-    _l2_setIndexMask((l2CacheSize / (l2Associativity * l2BlockSize)) - 1),
-    _l2_prefetch_lines(l2PrefetchLines)
-{
-
-    // They all need to be power of 2
-    ASSERTX(IsPowerOf2(_l1_blockSize));
-    ASSERTX(IsPowerOf2(_l2_blockSize));
-    ASSERTX(IsPowerOf2(_l1_setIndexMask + 1));
-    ASSERTX(IsPowerOf2(_l2_setIndexMask + 1));
-
+    _l1_geometry(l1CacheSize, l1BlockSize, l1Associativity),
+    _l2_geometry(l2CacheSize, l2BlockSize, l2Associativity),
+    _write(writePolicy),
+    _l2_prefetch_lines(std::min(l2PrefetchLines, UINT32(L2_PREFETCHER::MAX_DEGREE))),
+    _l2_prefetcher(l2Prefetcher, _l2_prefetch_lines),
+    _clock(0),
+    _lower(NULL),
+    _profile(NULL),
+    _l2_set_sampling(std::min(std::max(l2SetSampling, 1u), _l2_geometry.NumSets())),
+    _l1_sets(_l1_geometry.NumSets(), l1Associativity),
+    _l2_sets(_l2_geometry.NumSets() / _l2_set_sampling, l2Associativity)
+{
     // Some more sanity checks
-    ASSERTX(_l1_cacheSize <= _l2_cacheSize);
-    ASSERTX(_l1_blockSize <= _l2_blockSize);
-
-    // Allocate space for L1 and L2 sets
-    _l1_sets = new SET[L1NumSets()];
-    _l2_sets = new SET[L2NumSets()];
+    ASSERTX(L1CacheSize() <= L2CacheSize());
+    ASSERTX(L1BlockSize() <= L2BlockSize());
 
     _latencies[HIT_L1] = l1HitLatency;
     _latencies[HIT_L2] = l2HitLatency;
     _latencies[MISS_L2] = l2MissLatency;
 
-    for (UINT32 i = 0; i < L1NumSets(); i++)
-        _l1_sets[i].SetAssociativity(_l1_associativity);
-    for (UINT32 i = 0; i < L2NumSets(); i++)
-        _l2_sets[i].SetAssociativity(_l2_associativity);
+    _l2_recent_accesses = _l2_recent_misses = _l2_miss_credit = 0;
+    if (_l2_set_sampling > 1)
+        SampleL2Sets();
+    if (_l2_prefetch_lines)
+        _l2_prefetch_ready.assign(_l2_sets.NumSets() * l2Associativity, 0);
+    ResetStats();
+}
+
+/**
+ * Picks the L2 sets to simulate: the ones with the lowest hash of their
+ * index, so that the sample is spread over the whole cache rather than
+ * aligned with strides in the address stream.
+ **/
+template <class L1SET, class L2SET>
+VOID TWO_LEVEL_CACHE<L1SET, L2SET>::SampleL2Sets()
+{
+    std::vector<std::pair<UINT32, UINT32> > byHash(L2NumSets());
+    for (UINT32 set = 0; set < L2NumSets(); set++) {
+        UINT32 h = set * 0x9e3779b1u;
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        byHash[set] = std::make_pair(h, set);
+    }
+    std::sort(byHash.begin(), byHash.end());
+
+    const UINT32 numSampled = L2NumSets() / _l2_set_sampling;
+    _l2_sampled_set.assign(L2NumSets(), -1);
+    for (UINT32 i = 0; i < numSampled; i++)
+        _l2_sampled_set[byHash[i].second] = 0;
+
+    // Sampled sets are kept in index order
+    UINT32 next = 0;
+    for (UINT32 set = 0; set < L2NumSets(); set++)
+        if (_l2_sampled_set[set] == 0)
+            _l2_sampled_set[set] = next++;
+    _l2_set_stats.resize(numSampled);
+}
+
+/**
+ * Cycles of an L1 miss to an unsampled L2 set. Its outcome is unknown, so
+ * a fraction of these accesses equal to the recent miss rate of the
+ * sampled sets is charged the miss latency.
+ **/
+template <class L1SET, class L2SET>
+template <bool COUNT>
+UINT32 TWO_LEVEL_CACHE<L1SET, L2SET>::UnsampledL2Cycles(ACCESS_TYPE accessType)
+{
+    if (COUNT)
+        _l2_unsampled[accessType]++;
+
+    _l2_miss_credit += _l2_recent_misses;
+    if (_l2_recent_accesses == 0 || _l2_miss_credit < _l2_recent_accesses)
+        return _latencies[HIT_L2];
+    _l2_miss_credit -= _l2_recent_accesses;
+    return _latencies[HIT_L2] + _latencies[MISS_L2];
+}
+
+/**
+ * Half width of the 95% confidence interval of the L2 miss rate measured
+ * on the sampled sets, relative to it. Sets are the sampling units of a
+ * ratio estimator (misses over accesses), with the finite population
+ * correction.
+ **/
+template <class L1SET, class L2SET>
+double TWO_LEVEL_CACHE<L1SET, L2SET>::L2SamplingError() const
+{
+    const UINT64 n = _l2_set_stats.size();
+    const double accesses = L2Accesses(), misses = L2Misses();
+    if (n < 2 || accesses == 0 || misses == 0)
+        return 0;
+
+    const double ratio = misses / accesses;
+    const double meanAccesses = accesses / n;
+    double residuals = 0;
+    for (UINT64 i = 0; i < n; i++) {
+        const double r = _l2_set_stats[i].misses - ratio * _l2_set_stats[i].accesses;
+        residuals += r * r;
+    }
+    const double variance = (1.0 - (double)n / L2NumSets()) * residuals /
+                            ((n - 1) * n * meanAccesses * meanAccesses);
+    return 1.96 * std::sqrt(variance) / ratio;
+}
+
+/**
+ * The counters, with the L2 hits and misses of the sampled sets scaled to
+ * all the L2 accesses when sampling sets
+ **/
+template <class L1SET, class L2SET>
+typename TWO_LEVEL_CACHE<L1SET, L2SET>::COUNTERS TWO_LEVEL_CACHE<L1SET, L2SET>::Stats() const
+{
+    COUNTERS stats = _stats;
+    if (_l2_set_sampling == 1)
+        return stats;
+
+    // Access types without sampled accesses take the overall miss rate
+    const double overall = L2Accesses() ? (double)L2Misses() / L2Accesses() : 0;
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++) {
+        const CACHE_STATS sampled = L2Accesses(ACCESS_TYPE(accessType));
+        const CACHE_STATS total = sampled + _l2_unsampled[accessType];
+        const double missRate = sampled ? (double)L2Misses(ACCESS_TYPE(accessType)) / sampled : overall;
+        stats.l2[accessType][false] = CACHE_STATS(missRate * total + 0.5);
+        stats.l2[accessType][true] = total - stats.l2[accessType][false];
+    }
+    return stats;
+}
+
+/**
+ * The traffic counters, with the L2 ones of the sampled sets scaled to all
+ * the sets when sampling sets
+ **/
+template <class L1SET, class L2SET>
+typename TWO_LEVEL_CACHE<L1SET, L2SET>::TRAFFIC TWO_LEVEL_CACHE<L1SET, L2SET>::Traffic() const
+{
+    TRAFFIC traffic = _traffic;
+    if (_l2_set_sampling > 1) {
+        const double scale = (double)L2NumSets() / _l2_sets.NumSets();
+        traffic.l2Fills = CACHE_STATS(scale * traffic.l2Fills + 0.5);
+        traffic.l2Writes = CACHE_STATS(scale * traffic.l2Writes + 0.5);
+    }
+    return traffic;
+}
+
+template <class L1SET, class L2SET>
+bool TWO_LEVEL_CACHE<L1SET, L2SET>::MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const
+{
+    if (_lower) {
+        _lower->MemoryTraffic(readBytes, writeBytes);
+    } else {
+        const TRAFFIC traffic = Traffic();
+        readBytes = traffic.l2Fills;
+        writeBytes = traffic.l2Writes;
+    }
+    return true;
+}
 
+template <class L1SET, class L2SET>
+VOID TWO_LEVEL_CACHE<L1SET, L2SET>::ResetStats()
+{
     for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
     {
-        _l1_access[accessType][false] = 0;
-        _l1_access[accessType][true] = 0;
-        _l2_access[accessType][false] = 0;
-        _l2_access[accessType][true] = 0;
+        _stats.l1[accessType][false] = 0;
+        _stats.l1[accessType][true] = 0;
+        _stats.l2[accessType][false] = 0;
+        _stats.l2[accessType][true] = 0;
+        _l2_unsampled[accessType] = 0;
     }
+    for (UINT32 i = 0; i < _l2_set_stats.size(); i++)
+        _l2_set_stats[i].accesses = _l2_set_stats[i].misses = 0;
+    memset(&_l2_prefetch_stats, 0, sizeof(_l2_prefetch_stats));
+    memset(&_traffic, 0, sizeof(_traffic));
+    _l1_sets.ResetStats();
+    _l2_sets.ResetStats();
+    if (_lower)
+        _lower->ResetStats();
+    if (_profile)
+        _profile->Reset();
 }
 
-template <class SET>
-string TWO_LEVEL_CACHE<SET>::StatsLong(string prefix) const
+string CACHE_BASE::FormatLevelStats(const CACHE_STATS access[ACCESS_TYPE_NUM][HIT_MISS_NUM],
+                                    const string &level, const string &prefix)
 {
     const UINT32 headerWidth = 19;
     const UINT32 numberWidth = 12;
 
+    CACHE_STATS totalHits = 0, totalMisses = 0;
     string out;
-    
-    // L1 stats first
-    out += prefix + "L1 Cache Stats:" + "\n";
 
     for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++)
     {
         const ACCESS_TYPE accessType = ACCESS_TYPE(i);
+        const CACHE_STATS hits = access[accessType][true];
+        const CACHE_STATS misses = access[accessType][false];
+        const CACHE_STATS accesses = hits + misses;
+        totalHits += hits;
+        totalMisses += misses;
 
-        std::string type(accessType == ACCESS_TYPE_LOAD ? "L1-Load" : "L1-Store");
+        std::string type(level + (accessType == ACCESS_TYPE_LOAD ? "-Load" : "-Store"));
 
         out += prefix + ljstr(type + "-Hits:      ", headerWidth)
-               + dec2str(L1Hits(accessType), numberWidth)  +
-               "  " +fltstr(100.0 * L1Hits(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+               + dec2str(hits, numberWidth)  +
+               "  " +fltstr(100.0 * hits / accesses, 2, 6) + "%\n";
 
         out += prefix + ljstr(type + "-Misses:    ", headerWidth)
-               + dec2str(L1Misses(accessType), numberWidth) +
-               "  " +fltstr(100.0 * L1Misses(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+               + dec2str(misses, numberWidth) +
+               "  " +fltstr(100.0 * misses / accesses, 2, 6) + "%\n";
      
         out += prefix + ljstr(type + "-Accesses:  ", headerWidth)
-               + dec2str(L1Accesses(accessType), numberWidth) +
-               "  " +fltstr(100.0 * L1Accesses(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+               + dec2str(accesses, numberWidth) +
+               "  " +fltstr(100.0 * accesses / accesses, 2, 6) + "%\n";
      
         out += prefix + "\n";
     }
 
-    out += prefix + ljstr("L1-Total-Hits:      ", headerWidth)
-           + dec2str(L1Hits(), numberWidth) +
-           "  " +fltstr(100.0 * L1Hits() / L1Accesses(), 2, 6) + "%\n";
+    const CACHE_STATS totalAccesses = totalHits + totalMisses;
 
-    out += prefix + ljstr("L1-Total-Misses:    ", headerWidth)
-           + dec2str(L1Misses(), numberWidth) +
-           "  " +fltstr(100.0 * L1Misses() / L1Accesses(), 2, 6) + "%\n";
+    out += prefix + ljstr(level + "-Total-Hits:      ", headerWidth)
+           + dec2str(totalHits, numberWidth) +
+           "  " +fltstr(100.0 * totalHits / totalAccesses, 2, 6) + "%\n";
 
-    out += prefix + ljstr("L1-Total-Accesses:  ", headerWidth)
-           + dec2str(L1Accesses(), numberWidth) +
-           "  " +fltstr(100.0 * L1Accesses() / L1Accesses(), 2, 6) + "%\n";
-    out += "\n";
+    out += prefix + ljstr(level + "-Total-Misses:    ", headerWidth)
+           + dec2str(totalMisses, numberWidth) +
+           "  " +fltstr(100.0 * totalMisses / totalAccesses, 2, 6) + "%\n";
 
+    out += prefix + ljstr(level + "-Total-Accesses:  ", headerWidth)
+           + dec2str(totalAccesses, numberWidth) +
+           "  " +fltstr(100.0 * totalAccesses / totalAccesses, 2, 6) + "%\n";
 
-    // L2 Stats now.
-    out += prefix + "L2 Cache Stats:" + "\n";
+    return out;
+}
 
-    for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++)
-    {
-        const ACCESS_TYPE accessType = ACCESS_TYPE(i);
+string CACHE_BASE::FormatStats(const COUNTERS &stats, string prefix)
+{
+    string out;
+    
+    // L1 stats first
+    out += prefix + "L1 Cache Stats:" + "\n";
+    out += FormatLevelStats(stats.l1, "L1", prefix);
+    out += "\n";
 
-        std::string type(accessType == ACCESS_TYPE_LOAD ? "L2-Load" : "L2-Store");
+    // L2 Stats now.
+    out += prefix + "L2 Cache Stats:" + "\n";
+    out += FormatLevelStats(stats.l2, "L2", prefix);
+    out += prefix + "\n";
 
-        out += prefix + ljstr(type + "-Hits:      ", headerWidth)
-               + dec2str(L2Hits(accessType), numberWidth)  +
-               "  " +fltstr(100.0 * L2Hits(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
+    return out;
+}
 
-        out += prefix + ljstr(type + "-Misses:    ", headerWidth)
-               + dec2str(L2Misses(accessType), numberWidth) +
-               "  " +fltstr(100.0 * L2Misses(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
-     
-        out += prefix + ljstr(type + "-Accesses:  ", headerWidth)
-               + dec2str(L2Accesses(accessType), numberWidth) +
-               "  " +fltstr(100.0 * L2Accesses(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
-     
+template <class L1SET, class L2SET>
+string TWO_LEVEL_CACHE<L1SET, L2SET>::StatsLong(string prefix) const
+{
+    string out = FormatStats(Stats(), prefix);
+
+    if (_l2_set_sampling > 1) {
+        out += prefix + "L2 Set Sampling:\n";
+        out += prefix + ljstr("L2-Sampled-Sets: ", 19) + dec2str(_l2_set_stats.size(), 12) +
+               " of " + dec2str(L2NumSets(), 1) + "\n";
+        out += prefix + ljstr("L2-Miss-Error: ", 19) + "+/- " +
+               fltstr(100.0 * L2SamplingError(), 2, 6) + "% (95% confidence)\n";
         out += prefix + "\n";
     }
 
-    out += prefix + ljstr("L2-Total-Hits:      ", headerWidth)
-           + dec2str(L2Hits(), numberWidth) +
-           "  " +fltstr(100.0 * L2Hits() / L2Accesses(), 2, 6) + "%\n";
+    if (_l2_prefetch_lines) {
+        const UINT32 headerWidth = 28;
+        const PREFETCH_STATS &prefetches = _l2_prefetch_stats;
+        const CACHE_STATS used = prefetches.useful + prefetches.late;
+        out += prefix + "L2 Prefetching:\n";
+        out += prefix + ljstr("L2-Prefetch-Issued: ", headerWidth) + dec2str(prefetches.issued, 12) + "\n";
+        out += prefix + ljstr("L2-Prefetch-Useful: ", headerWidth) + dec2str(prefetches.useful, 12) + "\n";
+        out += prefix + ljstr("L2-Prefetch-Late: ", headerWidth) + dec2str(prefetches.late, 12) + "\n";
+        out += prefix + ljstr("L2-Prefetch-Unused-Evicted: ", headerWidth) + dec2str(prefetches.unused, 12) + "\n";
+        // Accuracy: used over issued prefetches. Coverage: used prefetches
+        // over the misses they would have been without prefetching.
+        out += prefix + ljstr("L2-Prefetch-Accuracy: ", headerWidth) +
+               fltstr(prefetches.issued ? 100.0 * used / prefetches.issued : 0, 2, 12) + "%\n";
+        out += prefix + ljstr("L2-Prefetch-Coverage: ", headerWidth) +
+               fltstr(used ? 100.0 * used / (used + L2Misses()) : 0, 2, 12) + "%\n";
+        out += prefix + "\n";
+    }
 
-    out += prefix + ljstr("L2-Total-Misses:    ", headerWidth)
-           + dec2str(L2Misses(), numberWidth) +
-           "  " +fltstr(100.0 * L2Misses() / L2Accesses(), 2, 6) + "%\n";
+    out += _l1_sets.Report("L1", prefix);
+    out += _l2_sets.Report("L2", prefix);
 
-    out += prefix + ljstr("L2-Total-Accesses:  ", headerWidth)
-           + dec2str(L2Accesses(), numberWidth) +
-           "  " +fltstr(100.0 * L2Accesses() / L2Accesses(), 2, 6) + "%\n";
+    const TRAFFIC traffic = Traffic();
+    const UINT32 headerWidth = 24;
+    out += prefix + "Write-Back Traffic:\n";
+    out += prefix + ljstr("L1-Writeback-Bytes: ", headerWidth) + dec2str(traffic.l1Writebacks, 12) + "\n";
+    out += prefix + ljstr("L1-Write-Through-Bytes: ", headerWidth) + dec2str(traffic.l1WriteThroughs, 12) + "\n";
+    out += prefix + ljstr("L2-Fill-Bytes: ", headerWidth) + dec2str(traffic.l2Fills, 12) + "\n";
+    out += prefix + ljstr("L2-Write-Bytes: ", headerWidth) + dec2str(traffic.l2Writes, 12) + "\n";
     out += prefix + "\n";
 
+    if (_lower)
+        out += _lower->StatsLong(prefix);
+
     return out;
 }
 
-template <class SET>
-string TWO_LEVEL_CACHE<SET>::PrintCache(string prefix) const
+template <class L1SET, class L2SET>
+string TWO_LEVEL_CACHE<L1SET, L2SET>::PrintCache(string prefix) const
 {
     string out;
 
     out += prefix + "--------\n";
     out += prefix + _name + "\n";
     out += prefix + "--------\n";
-    out += prefix + "  L1-Data Cache:\n";
-    out += prefix + "    Size(KB):       " + dec2str(this->L1CacheSize()/KILO, 5) + "\n";
-    out += prefix + "    Block Size(B):  " + dec2str(this->L1BlockSize(), 5) + "\n";
-    out += prefix + "    Associativity:  " + dec2str(this->L1Associativity(), 5) + "\n";
-    out += prefix + "\n";
-    out += prefix + "  L2-Data Cache:\n";
-    out += prefix + "    Size(KB):       " + dec2str(this->L2CacheSize()/KILO, 5) + "\n";
-    out += prefix + "    Block Size(B):  " + dec2str(this->L2BlockSize(), 5) + "\n";
-    out += prefix + "    Associativity:  " + dec2str(this->L2Associativity(), 5) + "\n";
-    out += prefix + "\n";
+    out += _l1_geometry.Print("L1-Data Cache", prefix);
+    out += _l2_geometry.Print("L2-Data Cache", prefix);
 
     out += prefix + "Latencies: " + dec2str(_latencies[HIT_L1], 4) + " "
                                   + dec2str(_latencies[HIT_L2], 4) + " "
                                   + dec2str(_latencies[MISS_L2], 4) + "\n";
-    //out += prefix + "L1-Sets: " + this->_l1_sets[0].Name() + " assoc: " +
-    out += prefix + "L1-Sets: " + dec2str(this->L1NumSets(), 4) + " - " + this->_l1_sets[0].Name() + " - assoc: " +
-                          dec2str(this->_l1_sets[0].GetAssociativity(), 3) + "\n";
-    //out += prefix + "L2-Sets: " + this->_l2_sets[0].Name() + " assoc: " +
-    out += prefix + "L2-Sets: " + dec2str(this->L2NumSets(), 4) + " - " + this->_l2_sets[0].Name() + " - assoc: " +
-                          dec2str(this->_l2_sets[0].GetAssociativity(), 3) + "\n";
-    out += prefix + "Store_allocation: " + (STORE_ALLOCATION == STORE_ALLOCATE ? "Yes" : "No") + "\n";
-    out += prefix + "L2_inclusive: " + (L2_INCLUSIVE == 1 ? "Yes" : "No") + "\n";
-//    out += prefix + "L2_prefetching: " + (_l2_prefetch_lines <= 0 ? "No" : "Yes (" + dec2str(_l2_prefetch_lines, 3) + ")") + "\n";
+    //out += prefix + "L1-Sets: " + this->_l1_sets.Name() + " assoc: " +
+    out += prefix + "L1-Sets: " + dec2str(this->L1NumSets(), 4) + " - " + this->_l1_sets.Name() + " - assoc: " +
+                          dec2str(this->_l1_sets.GetAssociativity(), 3) + "\n";
+    //out += prefix + "L2-Sets: " + this->_l2_sets.Name() + " assoc: " +
+    out += prefix + "L2-Sets: " + dec2str(this->L2NumSets(), 4) + " - " + this->_l2_sets.Name() + " - assoc: " +
+                          dec2str(this->_l2_sets.GetAssociativity(), 3) + "\n";
+    if (_l2_set_sampling > 1)
+        out += prefix + "L2-Set-Sampling: 1/" + dec2str(_l2_set_sampling, 1) + "\n";
+    out += prefix + "L1_write_policy: " + (_write.l1WriteThrough ? "write-through" : "write-back") + "\n";
+    out += prefix + "L2_write_policy: " + (_write.l2WriteThrough ? "write-through" : "write-back") + "\n";
+    out += prefix + "Store_allocation: " + (_write.l1WriteAllocate ? "Yes" : "No") + "\n";
+    out += prefix + "L2_store_allocation: " + (_write.l2WriteAllocate ? "Yes" : "No") + "\n";
+    out += prefix + "L2_inclusive: " + (_write.l2Inclusive ? "Yes" : "No") + "\n";
+    out += prefix + "L2_prefetching: " + (_l2_prefetch_lines == 0 ? string("No") :
+                   "Yes (" + string(_l2_prefetcher.Name()) + ", " + dec2str(_l2_prefetch_lines, 1) + " lines)") + "\n";
+    if (_lower)
+        out += "\n" + _lower->PrintCache(prefix);
     out += "\n";
 
     return out;
 }
 
-// Returns the cycles to serve the request.
-template <class SET>
-UINT32 TWO_LEVEL_CACHE<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType)
+// Returns the cycles to serve the request. Statistics are only updated if
+// COUNT is set.
+template <class L1SET, class L2SET>
+template <bool COUNT>
+UINT32 TWO_LEVEL_CACHE<L1SET, L2SET>::Lookup(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc)
 {
     CACHE_TAG l1Tag, l2Tag;
     UINT32 l1SetIndex, l2SetIndex;
     bool l1Hit = 0, l2Hit = 0;
     UINT32 cycles = 0;
+    const bool store = accessType == ACCESS_TYPE_STORE;
 
     // Let's check L1 first
     SplitAddress(addr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
-    SET & l1Set = _l1_sets[l1SetIndex];
-    l1Hit = l1Set.Find(l1Tag);
-    _l1_access[accessType][l1Hit]++;
+    _l1_sets.SetPC(pc);
+    l1Hit = _l1_sets.Find(l1SetIndex, l1Tag);
+    if (COUNT)
+        _stats.l1[accessType][l1Hit]++;
     cycles = _latencies[HIT_L1];
 
+    // Stores dirty the L1 line, or are written through to the L2: right
+    // away on a hit, along with the L2 access below on a miss
+    if (store && _write.l1WriteThrough) {
+        if (COUNT)
+            _traffic.l1WriteThroughs += STORE_BYTES;
+        if (l1Hit)
+            WriteL2<COUNT>(addr, STORE_BYTES);
+    } else if (store && l1Hit) {
+        _l1_sets.MarkDirty(l1SetIndex, l1Tag);
+    }
+
     if (!l1Hit) {
-        // On miss, loads always allocate, stores optionally
-        if (accessType == ACCESS_TYPE_LOAD ||
-            STORE_ALLOCATION == STORE_ALLOCATE)
-            l1Set.Replace(l1Tag);
+        // On miss, loads always allocate, stores optionally. Dirty victims
+        // are written back to the L2.
+        const bool l1Allocate = !store || _write.l1WriteAllocate;
+        if (l1Allocate) {
+            bool replacedDirty;
+            const CACHE_TAG l1Replaced = _l1_sets.Fill(l1SetIndex, l1Tag, store && !_write.l1WriteThrough,
+                                                       replacedDirty);
+            if (replacedDirty) {
+                if (COUNT)
+                    _traffic.l1Writebacks += L1BlockSize();
+                WriteL2<COUNT>(_l1_geometry.BlockAddress(l1Replaced, l1SetIndex), L1BlockSize());
+            }
+        }
+        // The data of the stores the L1 does not keep dirty goes to the L2
+        const bool l2Write = store && (!l1Allocate || _write.l1WriteThrough);
 
-        // Let's check L2 now
+        // Let's check L2 now. With set sampling, accesses to the sets not
+        // simulated stop here.
         SplitAddress(addr, L2LineShift(), L2SetIndexMask(), l2Tag, l2SetIndex);
-        SET & l2Set = _l2_sets[l2SetIndex];
-        l2Hit = l2Set.Find(l2Tag);
-        _l2_access[accessType][l2Hit]++;
+        UINT32 l2Set = l2SetIndex;
+        if (_l2_set_sampling > 1) {
+            const INT32 sampled = _l2_sampled_set[l2SetIndex];
+            if (sampled < 0)
+                return cycles + UnsampledL2Cycles<COUNT>(accessType);
+            l2Set = sampled;
+        }
+        _l2_sets.SetPC(pc);
+        l2Hit = _l2_sets.Find(l2Set, l2Tag);
+        if (COUNT)
+            _stats.l2[accessType][l2Hit]++;
+        if (_l2_set_sampling > 1) {
+            if (COUNT) {
+                _l2_set_stats[l2Set].accesses++;
+                _l2_set_stats[l2Set].misses += !l2Hit;
+            }
+            _l2_recent_misses += !l2Hit;
+            if (++_l2_recent_accesses == 4096) {
+                _l2_recent_accesses /= 2;
+                _l2_recent_misses /= 2;
+                _l2_miss_credit /= 2;
+            }
+        }
         cycles += _latencies[HIT_L2];
 
-        // L2 always allocates loads and stores
-        if (!l2Hit) {
-            CACHE_TAG l2_replaced = l2Set.Replace(l2Tag);
-            cycles += _latencies[MISS_L2];
-
-            // If L2 is inclusive and a TAG has been replaced we need to remove
-            // all evicted blocks from L1.
-            if ((L2_INCLUSIVE == 1) && !(l2_replaced == INVALID_TAG)) {
-                ADDRINT replacedAddr = ADDRINT(l2_replaced) << FloorLog2(L2NumSets());
-                replacedAddr = replacedAddr | l2SetIndex;
-                replacedAddr = replacedAddr << L2LineShift();
-                for (UINT32 i=0; i < L2BlockSize(); i+=L1BlockSize()) {
-                    ADDRINT newAddr = replacedAddr | i;
-                    SplitAddress(newAddr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
-                    SET & l1Set = _l1_sets[l1SetIndex];
-                    l1Set.DeleteIfPresent(l1Tag);
-                }
+        // L2 allocates loads and the stores it needs for the L1, others
+        // optionally; a store it does not allocate is posted below
+        if (!l2Hit && l2Write && !l1Allocate && !_write.l2WriteAllocate) {
+            WriteBelow<COUNT>(addr, STORE_BYTES);
+        } else {
+            if (!l2Hit) {
+                FillL2<COUNT>(l2Set, l2SetIndex, l2Tag);
+                cycles += _lower ? LowerLevels<COUNT>(addr, accessType, pc, _clock + cycles) : _latencies[MISS_L2];
             }
-	}
+            if (l2Write)
+                WriteL2<COUNT>(addr, STORE_BYTES);
+        }
+
+        if (_l2_prefetch_lines)
+            cycles += L2Prefetch<COUNT>(addr, pc, l2Set, l2Tag, l2Hit);
+
+        if (COUNT && _profile)
+            _profile->Miss(pc, addr, !l2Hit, cycles - _latencies[HIT_L1]);
+    }
+
+    return cycles;
+}
+
+// Brings `l2Tag` into the L2 set `l2Set`, which is `l2SetIndex` before set
+// sampling. A dirty victim is written below, with the dirty data of its
+// L1 lines when inclusion removes them.
+template <class L1SET, class L2SET>
+template <bool COUNT>
+VOID TWO_LEVEL_CACHE<L1SET, L2SET>::FillL2(UINT32 l2Set, UINT32 l2SetIndex, CACHE_TAG l2Tag)
+{
+    bool replacedDirty;
+    CACHE_TAG l2_replaced = _l2_sets.Fill(l2Set, l2Tag, false, replacedDirty);
+    if (COUNT)
+        _traffic.l2Fills += L2BlockSize();
+
+    // The victim may be a prefetched line that was never used
+    if (_l2_prefetch_lines) {
+        UINT64 &ready = _l2_prefetch_ready[l2Set * L2Associativity() + _l2_sets.FindWay(l2Set, l2Tag)];
+        if (COUNT && ready && !(l2_replaced == INVALID_TAG))
+            _l2_prefetch_stats.unused++;
+        ready = 0;
+    }
+
+    if (l2_replaced == INVALID_TAG)
+        return;
+    ADDRINT replacedAddr = ADDRINT(l2_replaced) << FloorLog2(L2NumSets());
+    replacedAddr = replacedAddr | l2SetIndex;
+    replacedAddr = replacedAddr << L2LineShift();
+
+    // If L2 is inclusive and a TAG has been replaced we need to remove
+    // all evicted blocks from L1.
+    if (_write.l2Inclusive) {
+        CACHE_TAG l1Tag;
+        UINT32 l1SetIndex;
+        for (UINT32 i=0; i < L2BlockSize(); i+=L1BlockSize()) {
+            ADDRINT newAddr = replacedAddr | i;
+            SplitAddress(newAddr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
+            replacedDirty |= _l1_sets.Invalidate(l1SetIndex, l1Tag);
+        }
+    }
+
+    if (replacedDirty)
+        WriteBelow<COUNT>(replacedAddr, L2BlockSize());
+}
 
+/**
+ * Writes `bytes` of data at `addr` to the L2: L1 write-backs and written
+ * through stores. Writes that miss the L2 go on below without allocating,
+ * and writes to the sets that set sampling does not simulate are dropped.
+ * They are posted and take no cycles.
+ **/
+template <class L1SET, class L2SET>
+template <bool COUNT>
+VOID TWO_LEVEL_CACHE<L1SET, L2SET>::WriteL2(ADDRINT addr, UINT32 bytes)
+{
+    CACHE_TAG tag;
+    UINT32 setIndex;
+    SplitAddress(addr, L2LineShift(), L2SetIndexMask(), tag, setIndex);
+    if (_l2_set_sampling > 1) {
+        if (_l2_sampled_set[setIndex] < 0)
+            return;
+        setIndex = _l2_sampled_set[setIndex];
     }
 
+    // A write-back L2 keeps the data if it has the line
+    if (!_write.l2WriteThrough && _l2_sets.MarkDirty(setIndex, tag))
+        return;
+    WriteBelow<COUNT>(addr, bytes);
+}
+
+// Writes `bytes` of data at `addr` below the L2
+template <class L1SET, class L2SET>
+template <bool COUNT>
+VOID TWO_LEVEL_CACHE<L1SET, L2SET>::WriteBelow(ADDRINT addr, UINT32 bytes)
+{
+    if (COUNT)
+        _traffic.l2Writes += bytes;
+    if (_lower)
+        _lower->Write(addr, bytes, _clock, COUNT);
+}
+
+/**
+ * Serves an L2 miss from the lower levels, which it reaches at cycle
+ * `now`. The blocks they evicted for inclusion leave the L2 and the L1,
+ * and their dirty data is written back unless the level that evicted them
+ * did. Prefetch fills are not `demand` accesses: the lower levels only
+ * count the data they move.
+ **/
+template <class L1SET, class L2SET>
+template <bool COUNT>
+UINT32 TWO_LEVEL_CACHE<L1SET, L2SET>::LowerLevels(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc,
+                                                  UINT64 now, bool demand)
+{
+    LOWER_LEVEL_BASE::EVICTIONS evictions;
+    const UINT32 cycles = _lower->Access(addr, accessType, pc, now,
+                                         !COUNT ? LOWER_LEVEL_BASE::COUNT_NONE :
+                                         demand ? LOWER_LEVEL_BASE::COUNT_ALL :
+                                                  LOWER_LEVEL_BASE::COUNT_TRAFFIC,
+                                         evictions);
+
+    CACHE_TAG tag;
+    UINT32 setIndex;
+    for (UINT32 e = 0; e < evictions.num; e++) {
+        bool dirty = false;
+        for (UINT32 i = 0; i < evictions.size[e]; i += L2BlockSize()) {
+            _l2_geometry.SplitAddress(evictions.addr[e] | i, tag, setIndex);
+            dirty |= _l2_sets.Invalidate(setIndex, tag);
+        }
+        for (UINT32 i = 0; i < evictions.size[e]; i += L1BlockSize()) {
+            _l1_geometry.SplitAddress(evictions.addr[e] | i, tag, setIndex);
+            dirty |= _l1_sets.Invalidate(setIndex, tag);
+        }
+        if (dirty && !evictions.dirty[e])
+            WriteBelow<COUNT>(evictions.addr[e], evictions.size[e]);
+    }
     return cycles;
 }
 
+/**
+ * Trains the prefetcher with a demand access to the L2 and issues its
+ * prefetches. The first access to a prefetched line is useful if the fill
+ * has completed, and late otherwise: it waits for the rest of the fill.
+ * Unless SetClock() gives it, time only counts the memory hierarchy cycles,
+ * not the cycle of every instruction, so prefetches are late more often
+ * than they would be.
+ * Returns the cycles waited.
+ **/
+template <class L1SET, class L2SET>
+template <bool COUNT>
+UINT32 TWO_LEVEL_CACHE<L1SET, L2SET>::L2Prefetch(ADDRINT addr, ADDRINT pc, UINT32 l2Set,
+                                                 CACHE_TAG l2Tag, bool l2Hit)
+{
+    UINT32 waited = 0;
+    bool trigger = !l2Hit;
+    if (l2Hit) {
+        UINT64 &ready = _l2_prefetch_ready[l2Set * L2Associativity() + _l2_sets.FindWay(l2Set, l2Tag)];
+        if (ready) {
+            trigger = true;
+            if (ready > _clock)
+                waited = ready - _clock;
+            if (COUNT) {
+                _l2_prefetch_stats.late += ready > _clock;
+                _l2_prefetch_stats.useful += ready <= _clock;
+            }
+            ready = 0;
+        }
+    }
+
+    ADDRINT lines[L2_PREFETCHER::MAX_DEGREE];
+    const UINT32 num = _l2_prefetcher.Train(addr >> L2LineShift(), pc, trigger, lines);
+    for (UINT32 i = 0; i < num; i++) {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(lines[i] << L2LineShift(), L2LineShift(), L2SetIndexMask(), tag, setIndex);
+        UINT32 set = setIndex;
+        if (_l2_set_sampling > 1) {
+            if (_l2_sampled_set[setIndex] < 0)
+                continue;
+            set = _l2_sampled_set[setIndex];
+        }
+        if (_l2_sets.FindWay(set, tag) >= 0)
+            continue;
+
+        FillL2<COUNT>(set, setIndex, tag);
+        // The fill comes from the lower levels, whose statistics only
+        // count demand accesses
+        const UINT32 fillCycles = _lower ? LowerLevels<COUNT>(lines[i] << L2LineShift(), ACCESS_TYPE_LOAD,
+                                                              pc, _clock, false)
+                                         : _latencies[MISS_L2];
+        _l2_prefetch_ready[set * L2Associativity() + _l2_sets.FindWay(set, tag)] =
+            std::max<UINT64>(_clock + fillCycles, 1);
+        if (COUNT)
+            _l2_prefetch_stats.issued++;
+    }
+
+    return waited;
+}
+
+/**
+ * Runtime policy selection.
+ * Calls `visitor.Visit<SET>()` with the set class named by `policy` (see
+ * CACHE_SET_POLICIES). Returns false if the name is unknown.
+ **/
+template <class VISITOR>
+bool DispatchPolicy(const string &policy, VISITOR &visitor)
+{
+#define DISPATCH(POLICY)                                            \
+    if (policy == #POLICY) {                                        \
+        visitor.template Visit<CACHE_SET::POLICY>();                \
+        return true;                                                \
+    }
+    CACHE_SET_POLICIES(DISPATCH)
+#undef DISPATCH
+    return false;
+}
+
+/**
+ * Creates a CACHE_LEVEL with the policy named `policy`, to chain below the
+ * L2 at runtime. Returns NULL if the name is unknown.
+ **/
+struct CACHE_LEVEL_BUILDER
+{
+    string name;
+    UINT32 cacheSize, blockSize, associativity;
+    UINT32 hitLatency, missLatency;
+    bool inclusive;
+    LOWER_LEVEL_BASE *next;
+    LOWER_LEVEL_BASE *level;
+
+    template <class SET>
+    VOID Visit()
+    {
+        level = new CACHE_LEVEL<SET>(name, cacheSize, blockSize, associativity,
+                                     hitLatency, missLatency, inclusive, next);
+    }
+};
+
+static LOWER_LEVEL_BASE *MakeCacheLevel(const string &policy, const string &name,
+                                        UINT32 cacheSize, UINT32 blockSize, UINT32 associativity,
+                                        UINT32 hitLatency, UINT32 missLatency, bool inclusive,
+                                        LOWER_LEVEL_BASE *next = NULL)
+{
+    CACHE_LEVEL_BUILDER builder = { name, cacheSize, blockSize, associativity,
+                                    hitLatency, missLatency, inclusive, next, NULL };
+    DispatchPolicy(policy, builder);
+    return builder.level;
+}
+
+/**
+ * Calls `visitor.Visit<L1SET, L2SET>()` with the set classes named by
+ * `l1Policy` and `l2Policy` (see CACHE_SET_POLICIES). Returns false if
+ * either name is unknown.
+ **/
+template <class VISITOR, class L1SET>
+bool DispatchL2Policy(const string &l2Policy, VISITOR &visitor)
+{
+#define DISPATCH_L2(POLICY)                                          \
+    if (l2Policy == #POLICY) {                                      \
+        visitor.template Visit<L1SET, CACHE_SET::POLICY>();         \
+        return true;                                                \
+    }
+    CACHE_SET_POLICIES(DISPATCH_L2)
+#undef DISPATCH_L2
+    return false;
+}
+
+template <class VISITOR>
+bool DispatchPolicies(const string &l1Policy, const string &l2Policy, VISITOR &visitor)
+{
+#define DISPATCH_L1(POLICY)                                                     \
+    if (l1Policy == #POLICY)                                                   \
+        return DispatchL2Policy<VISITOR, CACHE_SET::POLICY>(l2Policy, visitor);
+    CACHE_SET_POLICIES(DISPATCH_L1)
+#undef DISPATCH_L1
+    return false;
+}
+
+/**
+ * Space separated list of the policy names accepted by DispatchPolicies()
+ **/
+static string PolicyNames()
+{
+    string names;
+#define POLICY_NAME(POLICY) names += string(names.empty() ? "" : " ") + #POLICY;
+    CACHE_SET_POLICIES(POLICY_NAME)
+#undef POLICY_NAME
+    return names;
+}
+
+static bool IsPolicyName(const string &policy)
+{
+#define IS_POLICY(POLICY) if (policy == #POLICY) return true;
+    CACHE_SET_POLICIES(IS_POLICY)
+#undef IS_POLICY
+    return false;
+}
+
+// Whether the policy named `policy` predicts from the instructions of the
+// accesses (see SET_ARRAY::USES_PC)
+static bool PolicyUsesPC(const string &policy)
+{
+#define POLICY_USES_PC(POLICY) if (policy == #POLICY) return CACHE_SET::POLICY::USES_PC;
+    CACHE_SET_POLICIES(POLICY_USES_PC)
+#undef POLICY_USES_PC
+    return false;
+}
+
+// Whether the policy named `policy` needs the future of the references
+// (see SET_ARRAY::USES_NEXT_USE)
+static bool PolicyUsesNextUse(const string &policy)
+{
+#define POLICY_USES_NEXT_USE(POLICY) if (policy == #POLICY) return CACHE_SET::POLICY::USES_NEXT_USE;
+    CACHE_SET_POLICIES(POLICY_USES_NEXT_USE)
+#undef POLICY_USES_NEXT_USE
+    return false;
+}
+
 #endif // CACHE_H
@@ -0,0 +1,99 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <vector>
+#include <fstream>
+#include <cstdio>    // snprintf
+
+/**
+ * The geometry and policies of one simulated L2 configuration, shared by
+ * the pintool (simulator.cpp) and the trace replay tool (replay.cpp)
+ **/
+struct CACHE_CONFIG
+{
+    UINT32 l2Size;      // in KB
+    UINT32 l2Associativity;
+    UINT32 l2BlockSize;
+    string l1Policy;
+    string l2Policy;
+    string outFileName;
+};
+
+/**
+ * Parses a -conf value: <L2 size>_<L2 assoc>_<L2 block size>[_<policy>[_<L2 policy>]].
+ * A single policy is used for both levels, the default ones when absent.
+ * The report goes to <outPrefix>_L2_<L2 policy>_<size>_<assoc>_<block size>.out
+ **/
+static BOOL ParseConfig(const string &spec, const string &l1Policy, const string &l2Policy,
+                        const string &outPrefix, CACHE_CONFIG &config)
+{
+    std::vector<string> fields;
+    std::istringstream in(spec);
+    string field;
+    while (std::getline(in, field, '_'))
+        fields.push_back(field);
+    if (fields.size() < 3 || fields.size() > 5)
+        return false;
+
+    config.l2Size = std::strtoul(fields[0].c_str(), NULL, 10);
+    config.l2Associativity = std::strtoul(fields[1].c_str(), NULL, 10);
+    config.l2BlockSize = std::strtoul(fields[2].c_str(), NULL, 10);
+    config.l1Policy = l1Policy;
+    config.l2Policy = l2Policy;
+    if (fields.size() >= 4)
+        config.l1Policy = config.l2Policy = fields[3];
+    if (fields.size() == 5)
+        config.l2Policy = fields[4];
+
+    char name[64];
+    snprintf(name, sizeof(name), "_L2_%s_%04u_%02u_%03u.out", config.l2Policy.c_str(),
+             config.l2Size, config.l2Associativity, config.l2BlockSize);
+    config.outFileName = outPrefix + name;
+
+    return config.l2Size && config.l2Associativity && config.l2BlockSize;
+}
+
+/**
+ * Writes the report of one configuration: totals, then the cache
+ * description and statistics, then `appendix`. Every instruction takes one
+ * cycle plus the `memoryCycles` spent in the cache hierarchy.
+ **/
+static VOID WriteReport(const string &fileName, const CACHE_BASE &cache,
+                        UINT64 instructions, UINT64 memoryCycles,
+                        const string &appendix = "")
+{
+    const UINT64 total_cycles = instructions + memoryCycles;
+    std::ofstream outFile(fileName.c_str());
+
+    // Report total instructions and total cycles
+    outFile << "--------\n";
+    outFile << "Total Statistics\n";
+    outFile << "--------\n";
+    outFile << "Total Instructions: " << instructions << "\n";
+    outFile << "Total Cycles: " << total_cycles << "\n";
+    outFile << "IPC: " << (double)instructions / (double)total_cycles << "\n";
+    outFile << "\n";
+
+    outFile << cache.PrintCache("");
+    outFile << cache.StatsLong("");
+
+    // Memory bandwidth demand, if the hierarchy models its traffic
+    CACHE_STATS readBytes, writeBytes;
+    if (cache.MemoryTraffic(readBytes, writeBytes)) {
+        const UINT64 bytes = readBytes + writeBytes;
+        outFile << "--------\n";
+        outFile << "Memory Traffic\n";
+        outFile << "--------\n";
+        outFile << "Memory-Read-Bytes: " << readBytes << "\n";
+        outFile << "Memory-Write-Bytes: " << writeBytes << "\n";
+        outFile << "Bytes-Per-Instruction: " << (instructions ? (double)bytes / instructions : 0) << "\n";
+        outFile << "Bytes-Per-Cycle: " << (total_cycles ? (double)bytes / total_cycles : 0) << "\n";
+        outFile << "\n";
+    }
+
+    outFile << appendix;
+
+    outFile.close();
+}
+
+#endif // CONFIG_H
@@ -0,0 +1,390 @@
+#ifndef DRAM_H
+#define DRAM_H
+
+#include <cstring>   // memset
+#include <vector>
+#include <sstream>
+
+/**
+ * Organization and timings of the DRAM behind the last level cache (-dram).
+ * Latencies are in core cycles.
+ **/
+struct DRAM_PARAMS
+{
+    UINT32 channels;
+    UINT32 ranks;            // per channel
+    UINT32 banks;            // per rank
+    UINT32 rowSize;          // in bytes, per bank
+    string mapping;          // see DRAM::ParseMapping()
+    UINT32 tCAS;             // column access, from the command to the data
+    UINT32 tRCD;             // row activation
+    UINT32 tRP;              // precharge of the open row
+    UINT32 tBurst;           // data transfer of one line on the channel
+    UINT32 controllerLatency; // on-chip network and controller, both ways
+    UINT32 writeQueue;       // entries of the write queue of every channel
+
+    // DDR4-2400 at a 3GHz core clock, two channels
+    DRAM_PARAMS()
+      : channels(2), ranks(1), banks(16), rowSize(8 * KILO), mapping("RoRaBaCoCh"),
+        tCAS(42), tRCD(42), tRP(42), tBurst(10), controllerLatency(100), writeQueue(32)
+    {}
+};
+
+/**
+ * DRAM main memory, as the last of the levels below the L2: one controller
+ * per channel in front of ranks of banks with a row buffer each.
+ *
+ * Addresses are split into row, rank, bank, channel and column fields in
+ * the order of the mapping, with the row in the upper bits. Banks keep
+ * their last row open (open page policy): an access to it is a row hit
+ * (tCAS), to a closed bank a row miss (tRCD + tCAS), and to another row a
+ * conflict (tRP + tRCD + tCAS). Banks take one access at a time, and the
+ * data of every access then occupies the channel for tBurst cycles, so the
+ * accesses close in time wait for their bank and their channel.
+ *
+ * Reads are served as they come, ahead of the writes, which are posted to
+ * the write queue of their channel and serve the reads of their line. The
+ * controller picks the writes to issue first-ready first-come first-served
+ * (FR-FCFS): the oldest write to an open row, or else the oldest write. It
+ * issues them when the channel has been idle long enough for them, and in
+ * a burst down to half the queue when it fills up.
+ *
+ * Time comes from the levels above, in the cycles of the memory hierarchy,
+ * or of the whole core with -ooo. Without -ooo the accesses never overlap,
+ * so there is no queueing and the bus utilization is the one of the memory
+ * hierarchy time only.
+ **/
+class DRAM final : public LOWER_LEVEL_BASE
+{
+  public:
+    enum FIELD
+    {
+        FIELD_ROW = 0,
+        FIELD_RANK,
+        FIELD_BANK,
+        FIELD_CHANNEL,
+        FIELD_COLUMN,
+        FIELD_NUM
+    };
+
+    // Outcomes of an access in the row buffer of its bank
+    enum ROW_RESULT
+    {
+        ROW_HIT = 0,
+        ROW_MISS,        // no open row
+        ROW_CONFLICT,    // another row was open
+        ROW_RESULT_NUM
+    };
+
+    struct COUNTERS
+    {
+        CACHE_STATS rows[2][ROW_RESULT_NUM];   // of the reads, then of the writes
+        CACHE_STATS forwardedReads;   // served by the write queue
+        CACHE_STATS readBytes;
+        CACHE_STATS writeBytes;
+        UINT64 readCycles;            // latencies of the demand reads
+        CACHE_STATS demandReads;
+        UINT64 busCycles;             // data transfers, over all channels
+    };
+
+  private:
+    static const UINT64 NO_ROW = ~UINT64(0);
+
+    struct BANK
+    {
+        UINT64 openRow;
+        UINT64 ready;     // cycle of its next command
+    };
+
+    struct WRITE
+    {
+        ADDRINT line;
+        UINT32 bank;
+        UINT64 row;
+    };
+
+    struct CHANNEL
+    {
+        UINT64 busFree;   // cycle the data bus becomes free
+        std::vector<WRITE> writes;   // oldest first
+    };
+
+    const DRAM_PARAMS _params;
+    const UINT32 _line_size;
+    const UINT32 _line_shift;
+    UINT32 _shift[FIELD_NUM];
+    UINT64 _mask[FIELD_NUM];     // of the fields but the row
+
+    std::vector<BANK> _banks;    // by channel, rank and bank
+    std::vector<CHANNEL> _channels;
+
+    COUNTERS _stats;
+    UINT64 _first;               // first cycle since the statistics reset
+    UINT64 _last;                // last data transfer since then
+
+    UINT64 Field(ADDRINT addr, FIELD field) const
+    {
+        return field == FIELD_ROW ? addr >> _shift[field] : (addr >> _shift[field]) & _mask[field];
+    }
+
+    UINT32 BankIndex(ADDRINT addr) const
+    {
+        return UINT32((Field(addr, FIELD_CHANNEL) * _params.ranks + Field(addr, FIELD_RANK)) *
+                      _params.banks + Field(addr, FIELD_BANK));
+    }
+
+    // Cycle the column command of an access to `row` of `bank` issues at,
+    // from cycle `now` or when the bank is ready
+    UINT64 ColumnCommand(const BANK &bank, UINT64 row, UINT64 now, ROW_RESULT &result) const
+    {
+        UINT64 column = std::max(now, bank.ready);
+        result = ROW_HIT;
+        if (bank.openRow == NO_ROW) {
+            result = ROW_MISS;
+            column += _params.tRCD;
+        } else if (bank.openRow != row) {
+            result = ROW_CONFLICT;
+            column += _params.tRP + _params.tRCD;
+        }
+        return column;
+    }
+
+    // Issues an access to `row` of bank `bankIndex` of `channel` at cycle
+    // `now` or when the bank is ready. Returns the cycle its data transfer
+    // ends.
+    UINT64 Issue(UINT32 bankIndex, UINT64 row, CHANNEL &channel, UINT64 now, bool write, bool count)
+    {
+        BANK &bank = _banks[bankIndex];
+        ROW_RESULT result;
+        const UINT64 column = ColumnCommand(bank, row, now, result);
+        bank.openRow = row;
+        bank.ready = column + _params.tBurst;
+
+        const UINT64 transfer = std::max(column + _params.tCAS, channel.busFree);
+        channel.busFree = transfer + _params.tBurst;
+        if (count) {
+            _stats.rows[write][result]++;
+            _stats.busCycles += _params.tBurst;
+            _last = std::max(_last, channel.busFree);
+        }
+        return channel.busFree;
+    }
+
+    // Issues the next write of the FR-FCFS order at cycle `now`, unless its
+    // data transfer would start after `before`. Returns the cycle it starts.
+    UINT64 IssueWrite(CHANNEL &channel, UINT64 now, UINT64 before, bool count)
+    {
+        UINT32 pick = 0;
+        for (UINT32 i = 0; i < channel.writes.size(); i++)
+            if (_banks[channel.writes[i].bank].openRow == channel.writes[i].row) {
+                pick = i;
+                break;
+            }
+        const WRITE write = channel.writes[pick];
+
+        ROW_RESULT result;
+        const UINT64 column = ColumnCommand(_banks[write.bank], write.row, now, result);
+        const UINT64 transfer = std::max(column + _params.tCAS, channel.busFree);
+        if (transfer > before)
+            return transfer;
+
+        Issue(write.bank, write.row, channel, now, true, count);
+        channel.writes.erase(channel.writes.begin() + pick);
+        return transfer;
+    }
+
+    // Issues the queued writes that fit before the access arriving at `now`
+    VOID IdleWrites(CHANNEL &channel, UINT64 now, bool count)
+    {
+        while (!channel.writes.empty() && channel.busFree < now)
+            if (IssueWrite(channel, channel.busFree, now, count) > now)
+                break;
+    }
+
+  public:
+    DRAM(const DRAM_PARAMS &params, UINT32 lineSize)
+      : _params(params),
+        _line_size(lineSize),
+        _line_shift(FloorLog2(lineSize))
+    {
+        ASSERTX(ValidParams(params, lineSize));
+        UINT32 bits[FIELD_NUM];
+        bits[FIELD_ROW] = 0;
+        bits[FIELD_RANK] = FloorLog2(params.ranks);
+        bits[FIELD_BANK] = FloorLog2(params.banks);
+        bits[FIELD_CHANNEL] = FloorLog2(params.channels);
+        bits[FIELD_COLUMN] = FloorLog2(params.rowSize / lineSize);
+
+        // From the least significant field up
+        FIELD order[FIELD_NUM];
+        ParseMapping(params.mapping, order);
+        UINT32 shift = _line_shift;
+        for (INT32 i = FIELD_NUM - 1; i >= 0; i--) {
+            _shift[order[i]] = shift;
+            _mask[order[i]] = (UINT64(1) << bits[order[i]]) - 1;
+            shift += bits[order[i]];
+        }
+
+        BANK closed = { NO_ROW, 0 };
+        _banks.assign(params.channels * params.ranks * params.banks, closed);
+        _channels.resize(params.channels);
+        for (UINT32 i = 0; i < _channels.size(); i++)
+            _channels[i].busFree = 0;
+        ResetStats();
+    }
+
+    /**
+     * Parses an address mapping: the five fields Ro(w), Ra(nk), Ba(nk),
+     * Ch(annel) and Co(lumn), from the most significant one down, such as
+     * RoRaBaCoCh (lines interleaved over the channels) or RoRaBaChCo (rows
+     * interleaved over them). The row has to come first.
+     **/
+    static bool ParseMapping(const string &mapping, FIELD order[FIELD_NUM])
+    {
+        static const char *const names[FIELD_NUM] = { "Ro", "Ra", "Ba", "Ch", "Co" };
+        if (mapping.size() != 2 * FIELD_NUM)
+            return false;
+        bool seen[FIELD_NUM] = { false };
+        for (UINT32 i = 0; i < FIELD_NUM; i++) {
+            UINT32 field = 0;
+            while (field < FIELD_NUM && mapping.compare(2 * i, 2, names[field]) != 0)
+                field++;
+            if (field == FIELD_NUM || seen[field])
+                return false;
+            seen[field] = true;
+            order[i] = FIELD(field);
+        }
+        return order[0] == FIELD_ROW;
+    }
+
+    static bool ValidParams(const DRAM_PARAMS &params, UINT32 lineSize)
+    {
+        FIELD order[FIELD_NUM];
+        return IsPowerOf2(params.channels) && IsPowerOf2(params.ranks) && IsPowerOf2(params.banks) &&
+               IsPowerOf2(params.rowSize) && params.rowSize >= lineSize && params.writeQueue > 0 &&
+               ParseMapping(params.mapping, order);
+    }
+
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc, UINT64 now, COUNT_MODE count,
+                  EVICTIONS &evictions) override
+    {
+        const ADDRINT line = addr >> _line_shift;
+        CHANNEL &channel = _channels[Field(addr, FIELD_CHANNEL)];
+        const UINT64 arrival = now + _params.controllerLatency / 2;
+        if (count != COUNT_NONE) {
+            _stats.readBytes += _line_size;
+            _first = std::min(_first, arrival);
+        }
+        IdleWrites(channel, arrival, count != COUNT_NONE);
+
+        UINT64 cycles = _params.controllerLatency;
+        bool forwarded = false;
+        for (UINT32 i = 0; i < channel.writes.size() && !forwarded; i++)
+            forwarded = channel.writes[i].line == line;
+        if (forwarded) {
+            if (count != COUNT_NONE)
+                _stats.forwardedReads++;
+        } else {
+            cycles += Issue(BankIndex(addr), Field(addr, FIELD_ROW), channel, arrival, false,
+                            count != COUNT_NONE) - arrival;
+        }
+
+        if (count == COUNT_ALL) {
+            _stats.demandReads++;
+            _stats.readCycles += cycles;
+        }
+        return UINT32(cycles);
+    }
+
+    VOID Write(ADDRINT addr, UINT32 bytes, UINT64 now, bool count) override
+    {
+        const ADDRINT line = addr >> _line_shift;
+        CHANNEL &channel = _channels[Field(addr, FIELD_CHANNEL)];
+        const UINT64 arrival = now + _params.controllerLatency / 2;
+        if (count) {
+            _stats.writeBytes += bytes;
+            _first = std::min(_first, arrival);
+        }
+        IdleWrites(channel, arrival, count);
+
+        // Writes to a queued line merge with it
+        for (UINT32 i = 0; i < channel.writes.size(); i++)
+            if (channel.writes[i].line == line)
+                return;
+        WRITE write = { line, BankIndex(addr), Field(addr, FIELD_ROW) };
+        channel.writes.push_back(write);
+
+        if (channel.writes.size() >= _params.writeQueue)
+            while (channel.writes.size() > _params.writeQueue / 2)
+                IssueWrite(channel, arrival, ~UINT64(0), count);
+    }
+
+    VOID MemoryTraffic(CACHE_STATS &readBytes, CACHE_STATS &writeBytes) const override
+    {
+        readBytes = _stats.readBytes;
+        writeBytes = _stats.writeBytes;
+    }
+
+    UINT32 BlockSize() const override { return _line_size; }
+
+    string PrintCache(string prefix) const override
+    {
+        std::ostringstream out;
+        out << prefix << "DRAM: " << _params.channels << " channels, " << _params.ranks << " ranks, "
+            << _params.banks << " banks, " << _params.rowSize / KILO << "KB rows, mapping "
+            << _params.mapping << "\n";
+        out << prefix << "DRAM-Timings: tCAS " << _params.tCAS << ", tRCD " << _params.tRCD
+            << ", tRP " << _params.tRP << ", tBurst " << _params.tBurst << ", controller "
+            << _params.controllerLatency << ", write queue " << _params.writeQueue << "\n";
+        return out.str();
+    }
+
+    string StatsLong(string prefix) const override
+    {
+        static const char *const types[2] = { "Read", "Write" };
+        const UINT32 headerWidth = 28;
+        CACHE_STATS hits = 0, accesses = 0;
+        string out = prefix + "DRAM Stats:\n";
+        for (UINT32 type = 0; type < 2; type++) {
+            const CACHE_STATS *rows = _stats.rows[type];
+            const CACHE_STATS total = rows[ROW_HIT] + rows[ROW_MISS] + rows[ROW_CONFLICT];
+            hits += rows[ROW_HIT];
+            accesses += total;
+            out += prefix + ljstr("DRAM-" + string(types[type]) + "s: ", headerWidth) +
+                   dec2str(total, 12) + "\n";
+            out += prefix + ljstr("DRAM-" + string(types[type]) + "-Row-Hits: ", headerWidth) +
+                   dec2str(rows[ROW_HIT], 12) + "  " +
+                   fltstr(total ? 100.0 * rows[ROW_HIT] / total : 0, 2, 6) + "%\n";
+            out += prefix + ljstr("DRAM-" + string(types[type]) + "-Row-Misses: ", headerWidth) +
+                   dec2str(rows[ROW_MISS], 12) + "  " +
+                   fltstr(total ? 100.0 * rows[ROW_MISS] / total : 0, 2, 6) + "%\n";
+            out += prefix + ljstr("DRAM-" + string(types[type]) + "-Row-Conflicts: ", headerWidth) +
+                   dec2str(rows[ROW_CONFLICT], 12) + "  " +
+                   fltstr(total ? 100.0 * rows[ROW_CONFLICT] / total : 0, 2, 6) + "%\n";
+        }
+        out += prefix + ljstr("DRAM-Forwarded-Reads: ", headerWidth) + dec2str(_stats.forwardedReads, 12) + "\n";
+        out += prefix + ljstr("DRAM-Row-Hit-Rate: ", headerWidth) +
+               fltstr(accesses ? 100.0 * hits / accesses : 0, 2, 12) + "%\n";
+        out += prefix + ljstr("DRAM-Avg-Read-Latency: ", headerWidth) +
+               fltstr(_stats.demandReads ? (double)_stats.readCycles / _stats.demandReads : 0, 2, 12) + "\n";
+
+        // Utilization of the data buses, from the first access to the last
+        // transfer since the reset
+        const UINT64 span = _last > _first ? _last - _first : 0;
+        const double peak = (double)_line_size / _params.tBurst * _params.channels;
+        out += prefix + ljstr("DRAM-Peak-Bytes-Per-Cycle: ", headerWidth) + fltstr(peak, 2, 12) + "\n";
+        out += prefix + ljstr("DRAM-Bus-Utilization: ", headerWidth) +
+               fltstr(span ? 100.0 * _stats.busCycles / (span * _params.channels) : 0, 2, 12) + "%\n";
+        out += prefix + "\n";
+        return out;
+    }
+
+    VOID ResetStats() override
+    {
+        memset(&_stats, 0, sizeof(_stats));
+        _first = ~UINT64(0);
+        _last = 0;
+    }
+};
+
+#endif // DRAM_H
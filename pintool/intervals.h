@@ -0,0 +1,83 @@
+#ifndef INTERVALS_H
+#define INTERVALS_H
+
+#include <fstream>
+#include <cstring>   // memset
+
+/**
+ * Interval time series (-interval): the counters of one configuration over
+ * every interval of about N measured instructions, appended as CSV rows to
+ * <output>.intervals.csv as the simulation goes, to plot the phases of the
+ * program. Intervals end at the first basic block or reference past their
+ * N instructions.
+ *
+ * End() takes the counters of the cache hierarchy, and the cycles and the
+ * instructions since the statistics were last reset, which Reset() is
+ * called for.
+ **/
+class INTERVAL_STATS
+{
+  private:
+    std::ofstream _out;
+    UINT64 _intervals;
+
+    // State at the start of the current interval
+    CACHE_BASE::COUNTERS _start;
+    UINT64 _start_cycles;
+    UINT64 _start_instructions;
+
+    static UINT64 Misses(const CACHE_STATS level[CACHE_BASE::ACCESS_TYPE_NUM][CACHE_BASE::HIT_MISS_NUM])
+    {
+        UINT64 misses = 0;
+        for (UINT32 i = 0; i < CACHE_BASE::ACCESS_TYPE_NUM; i++)
+            misses += level[i][false];
+        return misses;
+    }
+
+  public:
+    explicit INTERVAL_STATS(const string &fileName)
+      : _out(fileName.c_str()), _intervals(0)
+    {
+        _out << "interval,end_instruction,instructions,cycles,ipc,l1_mpki,l2_mpki,"
+                "l1_load_hits,l1_load_misses,l1_store_hits,l1_store_misses,"
+                "l2_load_hits,l2_load_misses,l2_store_hits,l2_store_misses" << std::endl;
+        Reset();
+    }
+
+    bool Good() const { return _out.good(); }
+
+    VOID Reset()
+    {
+        memset(&_start, 0, sizeof(_start));
+        _start_cycles = 0;
+        _start_instructions = 0;
+    }
+
+    VOID End(const CACHE_BASE::COUNTERS &stats, UINT64 cycles, UINT64 instructions)
+    {
+        const UINT64 num = instructions - _start_instructions;
+        if (num == 0)
+            return;
+
+        const double kilo = num / 1000.0;
+        const UINT64 numCycles = cycles - _start_cycles;
+        _out << _intervals++ << "," << instructions << "," << num << "," << numCycles << ","
+             << (numCycles ? (double)num / numCycles : 0) << ","
+             << (Misses(stats.l1) - Misses(_start.l1)) / kilo << ","
+             << (Misses(stats.l2) - Misses(_start.l2)) / kilo;
+        for (UINT32 type = 0; type < CACHE_BASE::ACCESS_TYPE_NUM; type++)
+            _out << "," << stats.l1[type][true] - _start.l1[type][true]
+                 << "," << stats.l1[type][false] - _start.l1[type][false];
+        for (UINT32 type = 0; type < CACHE_BASE::ACCESS_TYPE_NUM; type++)
+            _out << "," << stats.l2[type][true] - _start.l2[type][true]
+                 << "," << stats.l2[type][false] - _start.l2[type][false];
+        // Flushed, to be plotted while the simulation runs
+        _out << std::endl;
+
+        _start = stats;
+        _start_cycles = cycles;
+        _start_instructions = instructions;
+    }
+};
+
+#endif // INTERVALS_H
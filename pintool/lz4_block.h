@@ -0,0 +1,175 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <vector>
+#include <cstring>   // memcpy
+
+/**
+ * Self-contained compressor/decompressor for the LZ4 block format, so the
+ * trace tools do not depend on an external library (pintools link against
+ * Pin's own C runtime). The compressor is the plain greedy single-hash
+ * variant; its output can be decoded by any LZ4 implementation.
+ **/
+namespace LZ4_BLOCK
+{
+
+const UINT32 MIN_MATCH = 4;
+const UINT32 LAST_LITERALS = 5;   // the block always ends with literals
+const UINT32 MF_LIMIT = 12;       // no match starts this close to the end
+const UINT32 MAX_OFFSET = 65535;
+const UINT32 HASH_LOG = 16;
+
+/**
+ * Largest compressed size of `n` input bytes
+ **/
+static inline size_t Bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+static inline UINT32 Read32(const UINT8 *p)
+{
+    UINT32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline UINT32 Hash(UINT32 v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline UINT8 *WriteLength(UINT8 *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = UINT8(len);
+    return op;
+}
+
+// One sequence: literals [anchor, anchor+litLen), then a match (unless last)
+static inline UINT8 *WriteSequence(UINT8 *op, const UINT8 *anchor, size_t litLen,
+                                   UINT32 offset, size_t matchLen, bool last)
+{
+    UINT8 *token = op++;
+    *token = UINT8((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15)
+        op = WriteLength(op, litLen - 15);
+    memcpy(op, anchor, litLen);
+    op += litLen;
+    if (last)
+        return op;
+
+    *op++ = UINT8(offset);
+    *op++ = UINT8(offset >> 8);
+    matchLen -= MIN_MATCH;
+    *token |= UINT8(matchLen >= 15 ? 15 : matchLen);
+    if (matchLen >= 15)
+        op = WriteLength(op, matchLen - 15);
+    return op;
+}
+
+/**
+ * Compresses `n` bytes of `src` into `dst`, which must hold Bound(n) bytes.
+ * Returns the compressed size.
+ **/
+static size_t Compress(const UINT8 *src, size_t n, UINT8 *dst)
+{
+    UINT8 *op = dst;
+    size_t anchor = 0;
+
+    if (n > MF_LIMIT) {
+        static const UINT32 NONE = 0xffffffff;
+        std::vector<UINT32> table(1U << HASH_LOG, NONE);
+        const size_t matchLimit = n - LAST_LITERALS;
+        size_t ip = 0;
+
+        while (ip + MF_LIMIT < n) {
+            const UINT32 seq = Read32(src + ip);
+            const UINT32 h = Hash(seq);
+            const UINT32 ref = table[h];
+            table[h] = UINT32(ip);
+
+            if (ref == NONE || ip - ref > MAX_OFFSET || Read32(src + ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            size_t matchLen = MIN_MATCH;
+            while (ip + matchLen < matchLimit && src[ref + matchLen] == src[ip + matchLen])
+                matchLen++;
+
+            op = WriteSequence(op, src + anchor, ip - anchor, UINT32(ip - ref), matchLen, false);
+            ip += matchLen;
+            anchor = ip;
+        }
+    }
+
+    op = WriteSequence(op, src + anchor, n - anchor, 0, 0, true);
+    return op - dst;
+}
+
+/**
+ * Decompresses `srcLen` bytes of `src` into exactly `dstLen` bytes of `dst`.
+ * Returns false on malformed input.
+ **/
+static bool Decompress(const UINT8 *src, size_t srcLen, UINT8 *dst, size_t dstLen)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < srcLen) {
+        const UINT8 token = src[ip++];
+
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            UINT8 b;
+            do {
+                if (ip >= srcLen)
+                    return false;
+                b = src[ip++];
+                litLen += b;
+            } while (b == 255);
+        }
+        if (litLen > srcLen - ip || litLen > dstLen - op)
+            return false;
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        if (ip == srcLen)
+            break; // last sequence has no match
+
+        if (srcLen - ip < 2)
+            return false;
+        const size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15) {
+            UINT8 b;
+            do {
+                if (ip >= srcLen)
+                    return false;
+                b = src[ip++];
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += MIN_MATCH;
+        if (matchLen > dstLen - op)
+            return false;
+
+        // Byte by byte, the match may overlap the output
+        const UINT8 *match = dst + op - offset;
+        for (size_t i = 0; i < matchLen; i++)
+            dst[op + i] = match[i];
+        op += matchLen;
+    }
+
+    return op == dstLen;
+}
+
+} // namespace LZ4_BLOCK
+
+#endif // LZ4_BLOCK_H
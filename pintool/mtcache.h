@@ -0,0 +1,723 @@
+#ifndef MTCACHE_H
+#define MTCACHE_H
+
+#include <atomic>
+#include <vector>
+#include <cstring>   // memset
+
+/**
+ * Spin lock for the short critical sections of the multithreaded
+ * simulation. Waiters yield after a while, as the application may have
+ * more threads than there are host cores. Each lock fills a host cache
+ * line, so the locks of an array do not share lines.
+ **/
+class SPIN_LOCK
+{
+  private:
+    static const UINT32 SPINS = 128;
+
+    std::atomic<bool> _locked;
+    char _pad[64 - sizeof(std::atomic<bool>)];
+
+  public:
+    SPIN_LOCK() : _locked(false) {}
+
+    VOID Lock()
+    {
+        while (_locked.exchange(true, std::memory_order_acquire)) {
+            for (UINT32 spins = 0; _locked.load(std::memory_order_relaxed); spins++)
+                if (spins >= SPINS)
+                    PIN_Yield();
+        }
+    }
+
+    VOID Unlock() { _locked.store(false, std::memory_order_release); }
+};
+
+/**
+ * MESI state of a line in a private L1
+ **/
+enum MESI_STATE
+{
+    MESI_I = 0,
+    MESI_S,
+    MESI_E,
+    MESI_M
+};
+
+/**
+ * Set array of a private L1 that keeps the MESI state of every line next
+ * to the replacement policy SET. Lines that are not in the array are
+ * Invalid.
+ **/
+template <class SET>
+class MESI_SET : public SET
+{
+  private:
+    std::vector<UINT8> _state;
+
+    UINT8 &StateOf(UINT32 set, INT32 way) { return _state[set * this->_associativity + way]; }
+
+  public:
+    MESI_SET(UINT32 numSets, UINT32 associativity)
+      : SET(numSets, associativity), _state(numSets * associativity, MESI_I) {}
+
+    // Looks `tag` up, updating the replacement state on a hit
+    UINT32 Access(UINT32 set, CACHE_TAG tag)
+    {
+        if (!SET::Find(set, tag))
+            return MESI_I;
+        return StateOf(set, this->FindWay(set, tag));
+    }
+
+    UINT32 State(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        return way < 0 ? UINT32(MESI_I) : StateOf(set, way);
+    }
+
+    VOID SetState(UINT32 set, CACHE_TAG tag, UINT32 state)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        if (way >= 0)
+            StateOf(set, way) = state;
+    }
+
+    // Brings `tag` in, returning the state of the line it evicted
+    UINT32 Fill(UINT32 set, CACHE_TAG tag, UINT32 state)
+    {
+        const CACHE_TAG evicted = SET::Replace(set, tag);
+        UINT8 &line = StateOf(set, this->FindWay(set, tag));
+        const UINT32 evictedState = evicted == INVALID_TAG ? UINT32(MESI_I) : line;
+        line = state;
+        return evictedState;
+    }
+
+    // Removes `tag`, returning the state it had
+    UINT32 Invalidate(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        if (way < 0)
+            return MESI_I;
+        const UINT32 state = StateOf(set, way);
+        SET::DeleteIfPresent(set, tag);
+        return state;
+    }
+};
+
+/**
+ * Set array of the shared L2, with the directory entry of every line: the
+ * private L1s that may hold it, and the one holding it Exclusive or
+ * Modified. L1s evict Shared and Exclusive lines silently, so sharers may
+ * be stale; requests to them find nothing to do.
+ **/
+template <class SET>
+class DIRECTORY_SET : public SET
+{
+  public:
+    struct ENTRY
+    {
+        UINT64 sharers;  // bit i % 64 stands for thread i
+        INT32 owner;     // thread with the line E or M, or -1
+    };
+
+  private:
+    std::vector<ENTRY> _entries;
+
+    ENTRY &EntryOf(UINT32 set, INT32 way) { return _entries[set * this->_associativity + way]; }
+
+  public:
+    DIRECTORY_SET(UINT32 numSets, UINT32 associativity)
+      : SET(numSets, associativity), _entries(numSets * associativity) {}
+
+    // Looks `tag` up, updating the replacement state. NULL on a miss.
+    ENTRY *Lookup(UINT32 set, CACHE_TAG tag)
+    {
+        if (!SET::Find(set, tag))
+            return NULL;
+        return &EntryOf(set, this->FindWay(set, tag));
+    }
+
+    // The entry of `tag`, without a replacement update, or NULL
+    ENTRY *Entry(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = this->FindWay(set, tag);
+        return way < 0 ? NULL : &EntryOf(set, way);
+    }
+
+    // Brings `tag` in with an empty entry. `evicted` and `evictedEntry`
+    // get the line it replaced, if any.
+    ENTRY *Fill(UINT32 set, CACHE_TAG tag, CACHE_TAG &evicted, ENTRY &evictedEntry)
+    {
+        evicted = SET::Replace(set, tag);
+        ENTRY &entry = EntryOf(set, this->FindWay(set, tag));
+        evictedEntry = entry;
+        entry.sharers = 0;
+        entry.owner = -1;
+        return &entry;
+    }
+};
+
+/**
+ * Coherence events, counted by the thread whose L1 they affect
+ **/
+struct COHERENCE_COUNTERS
+{
+    UINT64 upgrades;           // stores to Shared lines
+    UINT64 invalidations;      // lines removed by another thread's store
+    UINT64 downgrades;         // E/M lines made Shared by another thread's load
+    UINT64 backInvalidations;  // lines removed by an L2 eviction
+    UINT64 coherenceMisses;    // misses on lines lost to an invalidation
+    UINT64 writebacks;         // Modified lines evicted or downgraded
+};
+
+/**
+ * Counters and pending coherence requests of one application thread. The
+ * thread updates its own state without synchronization; other threads only
+ * append to `requests`, under `lock`.
+ **/
+struct SHARED_L2_THREAD
+{
+    UINT64 instructions;
+    UINT64 cycles;                 // memory hierarchy cycles
+    CACHE_BASE::COUNTERS stats;
+    COHERENCE_COUNTERS coherence;
+    UINT32 tid;                    // Pin thread id, for the report
+    UINT32 index;                  // in the thread registry
+
+    std::atomic<bool> pending;     // `requests` is not empty
+    SPIN_LOCK lock;
+    std::vector<ADDRINT> requests; // L2 line address | REQUEST_*
+
+    // Direct-mapped record of the L1 lines taken away by invalidations,
+    // to tell coherence misses
+    static const UINT32 LOST_LINES = 1024;
+    std::vector<ADDRINT> lostLines;
+
+    SHARED_L2_THREAD(UINT32 id)
+      : instructions(0), cycles(0), tid(id), index(0), pending(false), lostLines(LOST_LINES, 0)
+    {
+        memset(&stats, 0, sizeof(stats));
+        memset(&coherence, 0, sizeof(coherence));
+    }
+    virtual ~SHARED_L2_THREAD() {}
+};
+
+/**
+ * Policy independent part of SHARED_L2_CACHE: the registry of application
+ * threads and the reports, which sum or list their counters.
+ **/
+class SHARED_L2_CACHE_BASE : public CACHE_BASE
+{
+  public:
+    static const UINT32 MAX_THREADS = 4096;
+
+  protected:
+    std::atomic<SHARED_L2_THREAD *> _threads[MAX_THREADS];
+    std::atomic<UINT32> _num_threads;
+
+    // Publishes a new thread to the others, which send it requests
+    SHARED_L2_THREAD *Register(SHARED_L2_THREAD *thread)
+    {
+        const UINT32 index = _num_threads.fetch_add(1);
+        ASSERTX(index < MAX_THREADS);
+        thread->index = index;
+        _threads[index].store(thread, std::memory_order_release);
+        return thread;
+    }
+
+    UINT32 NumThreads() const
+    {
+        const UINT32 num = _num_threads.load(std::memory_order_acquire);
+        return num < MAX_THREADS ? num : MAX_THREADS;
+    }
+
+    // The statistics of the L2 replacement policy, if it keeps any
+    virtual string PolicyStats(string prefix) const { return ""; }
+    virtual VOID ResetPolicyStats() {}
+
+  public:
+    SHARED_L2_CACHE_BASE() : _num_threads(0)
+    {
+        for (UINT32 i = 0; i < MAX_THREADS; i++)
+            _threads[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    ~SHARED_L2_CACHE_BASE()
+    {
+        for (UINT32 i = 0; i < NumThreads(); i++)
+            delete _threads[i].load();
+    }
+
+    // Creates the private state of thread `tid`, to pass to Access()
+    virtual SHARED_L2_THREAD *AddThread(UINT32 tid) = 0;
+
+    // Totals over all threads, read once they are done
+    COUNTERS Stats() const override
+    {
+        COUNTERS total;
+        memset(&total, 0, sizeof(total));
+        for (UINT32 i = 0; i < NumThreads(); i++) {
+            const SHARED_L2_THREAD *thread = _threads[i].load();
+            if (!thread)
+                continue;
+            for (UINT32 type = 0; type < ACCESS_TYPE_NUM; type++)
+                for (UINT32 hit = 0; hit < HIT_MISS_NUM; hit++) {
+                    total.l1[type][hit] += thread->stats.l1[type][hit];
+                    total.l2[type][hit] += thread->stats.l2[type][hit];
+                }
+        }
+        return total;
+    }
+
+    COHERENCE_COUNTERS Coherence() const
+    {
+        COHERENCE_COUNTERS total;
+        memset(&total, 0, sizeof(total));
+        for (UINT32 i = 0; i < NumThreads(); i++) {
+            const SHARED_L2_THREAD *thread = _threads[i].load();
+            if (!thread)
+                continue;
+            total.upgrades += thread->coherence.upgrades;
+            total.invalidations += thread->coherence.invalidations;
+            total.downgrades += thread->coherence.downgrades;
+            total.backInvalidations += thread->coherence.backInvalidations;
+            total.coherenceMisses += thread->coherence.coherenceMisses;
+            total.writebacks += thread->coherence.writebacks;
+        }
+        return total;
+    }
+
+    UINT64 Instructions() const
+    {
+        UINT64 total = 0;
+        for (UINT32 i = 0; i < NumThreads(); i++)
+            if (const SHARED_L2_THREAD *thread = _threads[i].load())
+                total += thread->instructions;
+        return total;
+    }
+
+    UINT64 MemoryCycles() const
+    {
+        UINT64 total = 0;
+        for (UINT32 i = 0; i < NumThreads(); i++)
+            if (const SHARED_L2_THREAD *thread = _threads[i].load())
+                total += thread->cycles;
+        return total;
+    }
+
+    string StatsLong(string prefix = "") const override
+    {
+        const UINT32 headerWidth = 30;
+        const COHERENCE_COUNTERS coherence = Coherence();
+        string out = FormatStats(Stats(), prefix);
+
+        out += prefix + "Coherence Stats:\n";
+        out += prefix + ljstr("Coherence-Upgrades: ", headerWidth) + dec2str(coherence.upgrades, 12) + "\n";
+        out += prefix + ljstr("Coherence-Invalidations: ", headerWidth) + dec2str(coherence.invalidations, 12) + "\n";
+        out += prefix + ljstr("Coherence-Downgrades: ", headerWidth) + dec2str(coherence.downgrades, 12) + "\n";
+        out += prefix + ljstr("Coherence-Back-Invalidations: ", headerWidth) + dec2str(coherence.backInvalidations, 12) + "\n";
+        out += prefix + ljstr("Coherence-Misses: ", headerWidth) + dec2str(coherence.coherenceMisses, 12) + "\n";
+        out += prefix + ljstr("Coherence-Writebacks: ", headerWidth) + dec2str(coherence.writebacks, 12) + "\n";
+        out += prefix + "\n";
+        out += PolicyStats(prefix);
+        return out;
+    }
+
+    VOID ResetStats() override
+    {
+        for (UINT32 i = 0; i < NumThreads(); i++) {
+            SHARED_L2_THREAD *thread = _threads[i].load();
+            if (!thread)
+                continue;
+            thread->instructions = thread->cycles = 0;
+            memset(&thread->stats, 0, sizeof(thread->stats));
+            memset(&thread->coherence, 0, sizeof(thread->coherence));
+        }
+        ResetPolicyStats();
+    }
+
+    /**
+     * One line per thread. Threads run in parallel, so the throughput is
+     * the instructions of all threads over the cycles of the slowest one.
+     **/
+    string ThreadReport() const
+    {
+        string out;
+        UINT64 instructions = 0, longest = 0;
+
+        out += "--------\n";
+        out += "Per-Thread Statistics\n";
+        out += "--------\n";
+        out += "Thread  Instructions        Cycles         IPC     L1-MPKI     L2-MPKI  Coh-Misses\n";
+        for (UINT32 i = 0; i < NumThreads(); i++) {
+            const SHARED_L2_THREAD *thread = _threads[i].load();
+            if (!thread)
+                continue;
+            const UINT64 cycles = thread->instructions + thread->cycles;
+            UINT64 l1Misses = 0, l2Misses = 0;
+            for (UINT32 type = 0; type < ACCESS_TYPE_NUM; type++) {
+                l1Misses += thread->stats.l1[type][false];
+                l2Misses += thread->stats.l2[type][false];
+            }
+            const double kilo = thread->instructions ? thread->instructions / 1000.0 : 1;
+
+            out += dec2str(thread->tid, 6) + dec2str(thread->instructions, 14) +
+                   dec2str(cycles, 14) +
+                   fltstr(cycles ? (double)thread->instructions / cycles : 0, 6, 12) +
+                   fltstr(l1Misses / kilo, 3, 12) + fltstr(l2Misses / kilo, 3, 12) +
+                   dec2str(thread->coherence.coherenceMisses, 12) + "\n";
+            instructions += thread->instructions;
+            longest = std::max(longest, cycles);
+        }
+        out += "\n";
+        out += "IPC-Throughput: " + fltstr(longest ? (double)instructions / longest : 0, 6) + "\n";
+        return out;
+    }
+};
+
+/**
+ * Cache hierarchy of a multithreaded application: every thread has a
+ * private L1 and they share an inclusive L2, kept coherent with MESI
+ * through a directory in the L2 (see DIRECTORY_SET). The L2 sets and their
+ * directory entries are protected by an array of locks striped over the
+ * set index, so threads only wait for each other when they miss in sets of
+ * the same stripe at the same time.
+ *
+ * A thread cannot change another thread's L1 while it runs: the directory
+ * queues invalidations, downgrades and back-invalidations (L2 evictions)
+ * to the sharers of a line, which apply them on their next access.
+ **/
+template <class L1SET, class L2SET = L1SET>
+class SHARED_L2_CACHE final : public SHARED_L2_CACHE_BASE
+{
+  private:
+    enum {
+        HIT_L1 = 0,
+        HIT_L2,
+        MISS_L2,
+        ACCESS_RESULT_NUM
+    };
+
+    // Requests to the L1 of another thread, in the low bits of a line address
+    enum {
+        REQUEST_BACK_INVALIDATE = 0,
+        REQUEST_INVALIDATE,
+        REQUEST_DOWNGRADE,
+        REQUEST_MASK = 3
+    };
+
+    typedef DIRECTORY_SET<L2SET> L2_DIRECTORY;
+    typedef typename L2_DIRECTORY::ENTRY ENTRY;
+
+    struct THREAD : public SHARED_L2_THREAD
+    {
+        MESI_SET<L1SET> l1;
+
+        THREAD(UINT32 tid, UINT32 numSets, UINT32 associativity)
+          : SHARED_L2_THREAD(tid), l1(numSets, associativity) {}
+    };
+
+    UINT32 _latencies[ACCESS_RESULT_NUM];
+
+    const std::string _name;
+    const UINT32 _l1_cacheSize;
+    const UINT32 _l2_cacheSize;
+    const UINT32 _l1_blockSize;
+    const UINT32 _l2_blockSize;
+    const UINT32 _l1_associativity;
+    const UINT32 _l2_associativity;
+
+    const UINT32 _l1_lineShift;
+    const UINT32 _l2_lineShift;
+    const UINT32 _l1_setIndexMask;
+    const UINT32 _l2_setIndexMask;
+    const bool _l1_store_allocate;
+
+    L2_DIRECTORY _l2_sets;
+    std::vector<SPIN_LOCK> _stripes;
+    const UINT32 _stripe_mask;
+    // Replacement state shared by all the sets (the Random generator, the
+    // set dueling counters) is only updated under this lock
+    SPIN_LOCK _replace_lock;
+
+    UINT32 L2NumSets() const { return _l2_setIndexMask + 1; }
+
+    static UINT64 SharerBit(UINT32 index) { return UINT64(1) << (index % 64); }
+
+    VOID SplitAddress(const ADDRINT addr, UINT32 lineShift, UINT32 setIndexMask,
+                      CACHE_TAG & tag, UINT32 & setIndex) const
+    {
+        tag = addr >> lineShift;
+        setIndex = tag & setIndexMask;
+        tag = tag >> FloorLog2(setIndexMask + 1);
+    }
+
+    // Applies a request to the L1 lines of the L2 line at `lineAddr`
+    VOID ApplyRequest(THREAD &thread, ADDRINT lineAddr, UINT32 request)
+    {
+        CACHE_TAG l1Tag;
+        UINT32 l1SetIndex;
+        for (UINT32 i = 0; i < _l2_blockSize; i += _l1_blockSize) {
+            SplitAddress(lineAddr | i, _l1_lineShift, _l1_setIndexMask, l1Tag, l1SetIndex);
+
+            if (request == REQUEST_DOWNGRADE) {
+                const UINT32 state = thread.l1.State(l1SetIndex, l1Tag);
+                if (state == MESI_E || state == MESI_M) {
+                    thread.l1.SetState(l1SetIndex, l1Tag, MESI_S);
+                    thread.coherence.downgrades++;
+                    thread.coherence.writebacks += state == MESI_M;
+                }
+                continue;
+            }
+
+            const UINT32 state = thread.l1.Invalidate(l1SetIndex, l1Tag);
+            if (state == MESI_I)
+                continue;
+            thread.coherence.writebacks += state == MESI_M;
+            if (request == REQUEST_BACK_INVALIDATE) {
+                thread.coherence.backInvalidations++;
+            } else {
+                const ADDRINT line = (lineAddr | i) >> _l1_lineShift;
+                thread.coherence.invalidations++;
+                thread.lostLines[line % SHARED_L2_THREAD::LOST_LINES] = line + 1;
+            }
+        }
+    }
+
+    VOID ApplyRequests(THREAD &thread)
+    {
+        std::vector<ADDRINT> requests;
+        thread.lock.Lock();
+        requests.swap(thread.requests);
+        thread.pending.store(false, std::memory_order_relaxed);
+        thread.lock.Unlock();
+
+        for (UINT32 i = 0; i < requests.size(); i++)
+            ApplyRequest(thread, requests[i] & ~ADDRINT(REQUEST_MASK), requests[i] & REQUEST_MASK);
+    }
+
+    // Queues a request for every other thread whose bit is in `sharers`
+    VOID SendRequest(const THREAD &self, UINT64 sharers, ADDRINT lineAddr, UINT32 request)
+    {
+        for (; sharers; sharers &= sharers - 1) {
+            for (UINT32 i = __builtin_ctzll(sharers); i < NumThreads(); i += 64) {
+                SHARED_L2_THREAD *other = _threads[i].load(std::memory_order_acquire);
+                if (!other || other == &self)
+                    continue;
+                other->lock.Lock();
+                other->requests.push_back(lineAddr | request);
+                other->pending.store(true, std::memory_order_release);
+                other->lock.Unlock();
+            }
+        }
+    }
+
+    ENTRY *FillL2(UINT32 setIndex, CACHE_TAG tag, CACHE_TAG &evicted, ENTRY &evictedEntry)
+    {
+        if (!L2SET::SHARED_REPLACEMENT_STATE)
+            return _l2_sets.Fill(setIndex, tag, evicted, evictedEntry);
+
+        _replace_lock.Lock();
+        ENTRY *entry = _l2_sets.Fill(setIndex, tag, evicted, evictedEntry);
+        _replace_lock.Unlock();
+        return entry;
+    }
+
+    // A store hit on a Shared line: the other copies are invalidated
+    UINT32 Upgrade(THREAD &thread, ADDRINT addr)
+    {
+        CACHE_TAG l2Tag;
+        UINT32 l2SetIndex;
+        SplitAddress(addr, _l2_lineShift, _l2_setIndexMask, l2Tag, l2SetIndex);
+        const ADDRINT lineAddr = addr & ~ADDRINT(_l2_blockSize - 1);
+
+        SPIN_LOCK &stripe = _stripes[l2SetIndex & _stripe_mask];
+        stripe.Lock();
+        ENTRY *entry = _l2_sets.Entry(l2SetIndex, l2Tag);
+        if (entry) {
+            SendRequest(thread, entry->sharers, lineAddr, REQUEST_INVALIDATE);
+            entry->sharers = SharerBit(thread.index);
+            entry->owner = thread.index;
+        }
+        stripe.Unlock();
+
+        thread.coherence.upgrades++;
+        return _latencies[HIT_L2];
+    }
+
+  public:
+    SHARED_L2_CACHE(std::string name,
+                    UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
+                    UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
+                    UINT32 numStripes, bool l1StoreAllocate,
+                    UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 15,
+                    UINT32 l2MissLatency = 250)
+      : _name(name),
+        _l1_cacheSize(l1CacheSize),
+        _l2_cacheSize(l2CacheSize),
+        _l1_blockSize(l1BlockSize),
+        _l2_blockSize(l2BlockSize),
+        _l1_associativity(l1Associativity),
+        _l2_associativity(l2Associativity),
+        _l1_lineShift(FloorLog2(l1BlockSize)),
+        _l2_lineShift(FloorLog2(l2BlockSize)),
+        _l1_setIndexMask((l1CacheSize / (l1Associativity * l1BlockSize)) - 1),
+        _l2_setIndexMask((l2CacheSize / (l2Associativity * l2BlockSize)) - 1),
+        _l1_store_allocate(l1StoreAllocate),
+        _l2_sets(_l2_setIndexMask + 1, l2Associativity),
+        _stripes(std::min(1u << FloorLog2(std::max(numStripes, 1u)), _l2_setIndexMask + 1)),
+        _stripe_mask(_stripes.size() - 1)
+    {
+        ASSERTX(IsPowerOf2(_l1_blockSize));
+        ASSERTX(IsPowerOf2(_l2_blockSize));
+        ASSERTX(IsPowerOf2(_l1_setIndexMask + 1));
+        ASSERTX(IsPowerOf2(_l2_setIndexMask + 1));
+        ASSERTX(_l1_cacheSize <= _l2_cacheSize);
+        ASSERTX(_l1_blockSize <= _l2_blockSize);
+        ASSERTX(_l2_blockSize > REQUEST_MASK);
+
+        _latencies[HIT_L1] = l1HitLatency;
+        _latencies[HIT_L2] = l2HitLatency;
+        _latencies[MISS_L2] = l2MissLatency;
+    }
+
+    SHARED_L2_THREAD *AddThread(UINT32 tid) override
+    {
+        return Register(new THREAD(tid, _l1_setIndexMask + 1, _l1_associativity));
+    }
+
+    string PolicyStats(string prefix) const override { return _l2_sets.Report("L2", prefix); }
+
+    VOID ResetPolicyStats() override
+    {
+        _replace_lock.Lock();
+        _l2_sets.ResetStats();
+        _replace_lock.Unlock();
+    }
+
+    string PrintCache(string prefix = "") const override
+    {
+        string out;
+
+        out += prefix + "--------\n";
+        out += prefix + _name + "\n";
+        out += prefix + "--------\n";
+        out += prefix + "  L1-Data Cache (private, " + dec2str(NumThreads(), 1) + " threads):\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l1_cacheSize / KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l1_blockSize, 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l1_associativity, 5) + "\n";
+        out += prefix + "\n";
+        out += prefix + "  L2-Data Cache (shared):\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l2_cacheSize / KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l2_blockSize, 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l2_associativity, 5) + "\n";
+        out += prefix + "\n";
+
+        out += prefix + "Latencies: " + dec2str(_latencies[HIT_L1], 4) + " "
+                                      + dec2str(_latencies[HIT_L2], 4) + " "
+                                      + dec2str(_latencies[MISS_L2], 4) + "\n";
+        out += prefix + "L1-Sets: " + dec2str(_l1_setIndexMask + 1, 4) + " - " + L1SET(1, 1).Name() +
+                              " - assoc: " + dec2str(_l1_associativity, 3) + "\n";
+        out += prefix + "L2-Sets: " + dec2str(L2NumSets(), 4) + " - " + _l2_sets.Name() +
+                              " - assoc: " + dec2str(_l2_sets.GetAssociativity(), 3) + "\n";
+        out += prefix + "L2-Lock-Stripes: " + dec2str(_stripes.size(), 1) + "\n";
+        out += prefix + "Coherence: MESI, directory in the L2 (64-bit sharer vectors)\n";
+        out += prefix + "Store_allocation: " + (_l1_store_allocate ? "Yes" : "No") + "\n";
+        out += prefix + "L2_inclusive: Yes\n";
+        out += "\n";
+
+        return out;
+    }
+
+    // Returns the cycles to serve the request of `self`, which must be the
+    // calling thread's state
+    UINT32 Access(SHARED_L2_THREAD *self, ADDRINT addr, ACCESS_TYPE accessType)
+    {
+        THREAD &thread = *static_cast<THREAD *>(self);
+        CACHE_TAG l1Tag, l2Tag;
+        UINT32 l1SetIndex, l2SetIndex;
+
+        if (thread.pending.load(std::memory_order_acquire))
+            ApplyRequests(thread);
+
+        SplitAddress(addr, _l1_lineShift, _l1_setIndexMask, l1Tag, l1SetIndex);
+        const UINT32 state = thread.l1.Access(l1SetIndex, l1Tag);
+        const bool l1Hit = state != MESI_I;
+        thread.stats.l1[accessType][l1Hit]++;
+        UINT32 cycles = _latencies[HIT_L1];
+
+        if (l1Hit) {
+            if (accessType == ACCESS_TYPE_STORE && state != MESI_M) {
+                if (state == MESI_S)
+                    cycles += Upgrade(thread, addr);
+                thread.l1.SetState(l1SetIndex, l1Tag, MESI_M);
+            }
+            return cycles;
+        }
+
+        ADDRINT &lost = thread.lostLines[(addr >> _l1_lineShift) % SHARED_L2_THREAD::LOST_LINES];
+        if (lost == (addr >> _l1_lineShift) + 1) {
+            thread.coherence.coherenceMisses++;
+            lost = 0;
+        }
+
+        // The L1 line is filled before the directory decides its state, so
+        // that the victim is the same as in TWO_LEVEL_CACHE
+        const bool allocate = accessType == ACCESS_TYPE_LOAD || _l1_store_allocate;
+        if (allocate && thread.l1.Fill(l1SetIndex, l1Tag, MESI_S) == MESI_M)
+            thread.coherence.writebacks++;
+
+        SplitAddress(addr, _l2_lineShift, _l2_setIndexMask, l2Tag, l2SetIndex);
+        const ADDRINT lineAddr = addr & ~ADDRINT(_l2_blockSize - 1);
+        const UINT64 bit = SharerBit(thread.index);
+        CACHE_TAG evicted = INVALID_TAG;
+        ENTRY evictedEntry;
+        UINT32 newState;
+
+        SPIN_LOCK &stripe = _stripes[l2SetIndex & _stripe_mask];
+        stripe.Lock();
+        ENTRY *entry = _l2_sets.Lookup(l2SetIndex, l2Tag);
+        const bool l2Hit = entry != NULL;
+        if (!l2Hit)
+            entry = FillL2(l2SetIndex, l2Tag, evicted, evictedEntry);
+
+        if (accessType == ACCESS_TYPE_STORE) {
+            SendRequest(thread, entry->sharers, lineAddr, REQUEST_INVALIDATE);
+            entry->sharers = bit;
+            entry->owner = thread.index;
+            newState = MESI_M;
+        } else {
+            if (entry->owner >= 0 && UINT32(entry->owner) != thread.index)
+                SendRequest(thread, SharerBit(entry->owner), lineAddr, REQUEST_DOWNGRADE);
+            const bool alone = (entry->sharers & ~bit) == 0;
+            entry->sharers |= bit;
+            entry->owner = alone ? INT32(thread.index) : -1;
+            newState = alone ? MESI_E : MESI_S;
+        }
+
+        stripe.Unlock();
+
+        if (allocate)
+            thread.l1.SetState(l1SetIndex, l1Tag, newState);
+
+        thread.stats.l2[accessType][l2Hit]++;
+        cycles += _latencies[HIT_L2];
+        if (l2Hit)
+            return cycles;
+        cycles += _latencies[MISS_L2];
+
+        // Inclusion: the lines of the evicted L2 line leave every L1
+        if (!(evicted == INVALID_TAG)) {
+            ADDRINT evictedAddr = ADDRINT(evicted) << FloorLog2(L2NumSets());
+            evictedAddr = (evictedAddr | l2SetIndex) << _l2_lineShift;
+            SendRequest(thread, evictedEntry.sharers, evictedAddr, REQUEST_BACK_INVALIDATE);
+            if (evictedEntry.sharers & bit)
+                ApplyRequest(thread, evictedAddr, REQUEST_BACK_INVALIDATE);
+        }
+
+        return cycles;
+    }
+};
+
+#endif // MTCACHE_H
@@ -0,0 +1,194 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include <vector>
+#include <string>
+
+#include <unistd.h>
+
+#include "trace_reader.h"
+
+/**
+ * The next-use distances of the OPT policy (CACHE_SET::OPT), for the
+ * replay tool: for every reference of the trace region, the number of
+ * references up to the next one to the same block, NEVER if there is none.
+ *
+ * A first pass walks the region backwards, one chunk at a time, and writes
+ * the distances of every chunk as varints to an unlinked temporary file.
+ * The simulation then loads them back with the references of each chunk.
+ * Memory holds the last position of every block of the footprint and one
+ * file extent per chunk, never the whole trace.
+ **/
+class NEXT_USES
+{
+  private:
+    static const UINT64 NEVER = CACHE_SET::SET_ARRAY::NEVER;
+
+    /**
+     * Position of the last reference to every block seen, in an open
+     * addressing table with linear probing, kept at most half full
+     **/
+    class POSITIONS
+    {
+      private:
+        static const ADDRINT EMPTY = ~ADDRINT(0);
+
+        struct ENTRY
+        {
+            ADDRINT block;
+            UINT64 position;
+        };
+
+        std::vector<ENTRY> _entries;
+        UINT32 _bits;
+        UINT64 _used;
+
+        UINT64 Slot(ADDRINT block) const
+        {
+            return (UINT64(block) * 0x9e3779b97f4a7c15ULL) >> (64 - _bits);
+        }
+
+        VOID Grow()
+        {
+            std::vector<ENTRY> old;
+            old.swap(_entries);
+            _bits++;
+            const ENTRY empty = { EMPTY, 0 };
+            _entries.assign(UINT64(1) << _bits, empty);
+            for (UINT64 i = 0; i < old.size(); i++)
+                if (old[i].block != EMPTY)
+                    _entries[Find(old[i].block)] = old[i];
+        }
+
+        UINT64 Find(ADDRINT block) const
+        {
+            const UINT64 mask = _entries.size() - 1;
+            UINT64 i = Slot(block);
+            while (_entries[i].block != block && _entries[i].block != EMPTY)
+                i = (i + 1) & mask;
+            return i;
+        }
+
+      public:
+        POSITIONS() : _bits(16), _used(0)
+        {
+            const ENTRY empty = { EMPTY, 0 };
+            _entries.assign(UINT64(1) << _bits, empty);
+        }
+
+        // The position of the last reference to `block`, NEVER for a new one
+        UINT64 &Position(ADDRINT block)
+        {
+            if (2 * (_used + 1) > _entries.size())
+                Grow();
+            ENTRY &entry = _entries[Find(block)];
+            if (entry.block == EMPTY) {
+                entry.block = block;
+                entry.position = NEVER;
+                _used++;
+            }
+            return entry.position;
+        }
+    };
+
+    struct EXTENT
+    {
+        UINT64 offset;
+        UINT64 bytes;
+    };
+
+    int _fd;
+    std::vector<EXTENT> _chunks;    // per chunk of the region
+    std::vector<UINT8> _buffer;
+    std::string _error;
+
+    bool Fail(const std::string &error)
+    {
+        _error = error;
+        return false;
+    }
+
+  public:
+    NEXT_USES() : _fd(-1) {}
+    ~NEXT_USES()
+    {
+        if (_fd >= 0)
+            close(_fd);
+    }
+
+    /**
+     * First pass over the region of `reader`, with blocks of `blockSize`
+     * bytes. The temporary file goes to `directory`.
+     **/
+    bool Compute(TRACE_READER &reader, UINT32 blockSize, const std::string &directory)
+    {
+        std::string path = directory + "/cslab_opt.XXXXXX";
+        _fd = mkstemp(&path[0]);
+        if (_fd < 0)
+            return Fail("cannot create a temporary file in " + directory);
+        unlink(path.c_str());
+
+        const UINT32 shift = FloorLog2(blockSize);
+        POSITIONS positions;
+        std::vector<TRACE_REF> refs;
+        std::vector<UINT8> scratch;
+        std::vector<UINT64> distances;
+        UINT64 position = 0;    // from the end of the region
+        UINT64 offset = 0;
+
+        _chunks.resize(reader.RegionChunks());
+        for (UINT64 c = _chunks.size(); c-- > 0; ) {
+            if (!reader.ReadChunk(c, refs, scratch))
+                return Fail(reader.Error());
+
+            distances.resize(refs.size());
+            for (UINT64 i = refs.size(); i-- > 0; position++) {
+                UINT64 &last = positions.Position(refs[i].addr >> shift);
+                distances[i] = last == NEVER ? NEVER : position - last;
+                last = position;
+            }
+
+            // Distances are at least 1, 0 stands for NEVER
+            _buffer.resize(distances.size() * 10);
+            UINT8 *end = _buffer.empty() ? NULL : &_buffer[0];
+            for (UINT64 i = 0; i < distances.size(); i++)
+                end = PutVarint(end, distances[i] == NEVER ? 0 : distances[i]);
+
+            _chunks[c].offset = offset;
+            _chunks[c].bytes = end - (_buffer.empty() ? NULL : &_buffer[0]);
+            if (_chunks[c].bytes &&
+                pwrite(_fd, &_buffer[0], _chunks[c].bytes, offset) != ssize_t(_chunks[c].bytes))
+                return Fail("cannot write the temporary file in " + directory);
+            offset += _chunks[c].bytes;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the `num` distances of chunk `chunk` of the region, in the
+     * order of its references
+     **/
+    bool Load(UINT64 chunk, UINT64 num, std::vector<UINT64> &distances)
+    {
+        const EXTENT &extent = _chunks[chunk];
+        _buffer.resize(extent.bytes);
+        if (extent.bytes &&
+            pread(_fd, &_buffer[0], extent.bytes, extent.offset) != ssize_t(extent.bytes))
+            return Fail("cannot read the temporary file");
+
+        distances.resize(num);
+        const UINT8 *p = _buffer.empty() ? NULL : &_buffer[0];
+        const UINT8 *end = p + extent.bytes;
+        for (UINT64 i = 0; i < num; i++) {
+            if (!(p = GetVarint(p, end, distances[i])))
+                return Fail("corrupted temporary file");
+            if (distances[i] == 0)
+                distances[i] = NEVER;
+        }
+        return p == end || Fail("corrupted temporary file");
+    }
+
+    const std::string &Error() const { return _error; }
+};
+
+#endif // OPT_H
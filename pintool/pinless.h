@@ -0,0 +1,58 @@
+#ifndef PINLESS_H
+#define PINLESS_H
+
+/**
+ * The Pin types and helpers used by cache.h and globals.h, for the tools
+ * that are built without Pin (see replay.cpp)
+ **/
+
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+
+typedef int8_t   INT8;
+typedef int16_t  INT16;
+typedef int32_t  INT32;
+typedef int64_t  INT64;
+typedef uint8_t  UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uintptr_t ADDRINT;
+typedef bool BOOL;
+#define VOID void
+
+#define ASSERTX(x)                                                          \
+    do {                                                                    \
+        if (!(x)) {                                                         \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n",                \
+                    __FILE__, __LINE__, #x);                                \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+/**
+ * `s` padded with blanks to `width` characters
+ **/
+static inline std::string ljstr(const std::string &s, UINT32 width)
+{
+    std::string str(s);
+    if (str.size() < width)
+        str.append(width - str.size(), ' ');
+    return str;
+}
+
+/**
+ * `v` with `precision` decimals, right aligned in `width` characters
+ **/
+static inline std::string fltstr(double v, UINT32 precision = 0, UINT32 width = 0)
+{
+    std::ostringstream o;
+    o << std::fixed << std::setprecision(precision) << std::setw(width) << v;
+    return o.str();
+}
+
+#endif // PINLESS_H
@@ -0,0 +1,219 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <vector>
+
+/**
+ * L2 prefetchers. They observe the demand accesses of the L2 (the L1
+ * misses) as line numbers and pick the lines to bring in; TWO_LEVEL_CACHE
+ * does the fills and measures how useful they were.
+ **/
+enum PREFETCHER_KIND
+{
+    PREFETCH_NEXT_LINE = 0,
+    PREFETCH_STRIDE,
+    PREFETCH_STREAM,
+    PREFETCHER_KIND_NUM
+};
+
+static const char *const PREFETCHER_NAMES[PREFETCHER_KIND_NUM] = { "next", "stride", "stream" };
+
+static bool ParsePrefetcher(const string &name, PREFETCHER_KIND &kind)
+{
+    for (UINT32 i = 0; i < PREFETCHER_KIND_NUM; i++)
+        if (name == PREFETCHER_NAMES[i]) {
+            kind = PREFETCHER_KIND(i);
+            return true;
+        }
+    return false;
+}
+
+/**
+ * Counters of the prefetched lines, by their fate
+ **/
+struct PREFETCH_STATS
+{
+    UINT64 issued;   // lines brought into the L2
+    UINT64 useful;   // first demand access after the fill completed
+    UINT64 late;     // first demand access while the fill was in flight
+    UINT64 unused;   // evicted before any demand access
+};
+
+/**
+ * One of the PREFETCHER_KIND engines, with a degree of `degree` lines:
+ *   next   - on a miss or a first hit on a prefetched line, the next
+ *            `degree` lines (tagged next-N-line)
+ *   stride - a table indexed by the PC of the access tracks the last line
+ *            and stride of every instruction; once the same stride is seen
+ *            twice in a row, the `degree` lines along it are prefetched.
+ *            Accesses without a PC (replayed traces) are tracked per
+ *            64-line region instead.
+ *   stream - a training table of recent miss streams: a miss within a
+ *            window of a stream's last line moves it, and after two moves
+ *            in the same direction the stream keeps `degree` lines ahead
+ *            of the demand accesses
+ **/
+class L2_PREFETCHER
+{
+  public:
+    static const UINT32 MAX_DEGREE = 64;
+
+  private:
+    static const UINT32 STRIDE_ENTRIES = 256;
+    static const UINT32 STREAM_ENTRIES = 16;
+    static const INT64 STREAM_WINDOW = 16;   // in lines
+
+    struct STRIDE_ENTRY
+    {
+        ADDRINT key;          // PC or region
+        ADDRINT lastLine;
+        INT64 stride;         // in lines
+        UINT32 confidence;    // saturates at 3, prefetches from 2
+    };
+
+    struct STREAM_ENTRY
+    {
+        ADDRINT lastLine;
+        ADDRINT frontier;     // last line prefetched
+        INT64 direction;      // +1, -1, or 0 while untrained
+        UINT32 confidence;
+        UINT64 lastUse;       // for LRU replacement, 0 when free
+    };
+
+    const PREFETCHER_KIND _kind;
+    const UINT32 _degree;
+    std::vector<STRIDE_ENTRY> _stride;
+    std::vector<STREAM_ENTRY> _streams;
+    UINT64 _time;
+
+    UINT32 NextLine(ADDRINT line, bool trigger, ADDRINT *lines) const
+    {
+        if (!trigger)
+            return 0;
+        for (UINT32 i = 0; i < _degree; i++)
+            lines[i] = line + i + 1;
+        return _degree;
+    }
+
+    UINT32 Stride(ADDRINT line, ADDRINT pc, ADDRINT *lines)
+    {
+        const ADDRINT key = pc ? pc : (line >> 6) | (ADDRINT(1) << 63);
+        STRIDE_ENTRY &entry = _stride[(key ^ (key >> 8) ^ (key >> 16)) % STRIDE_ENTRIES];
+        if (entry.key != key) {
+            entry.key = key;
+            entry.lastLine = line;
+            entry.stride = 0;
+            entry.confidence = 0;
+            return 0;
+        }
+
+        const INT64 delta = INT64(line - entry.lastLine);
+        if (delta == 0)
+            return 0;
+        if (delta == entry.stride) {
+            entry.confidence += entry.confidence < 3;
+        } else {
+            entry.stride = delta;
+            entry.confidence = 0;
+        }
+        entry.lastLine = line;
+        if (entry.confidence < 2)
+            return 0;
+
+        for (UINT32 i = 0; i < _degree; i++)
+            lines[i] = line + (i + 1) * entry.stride;
+        return _degree;
+    }
+
+    UINT32 Stream(ADDRINT line, bool trigger, ADDRINT *lines)
+    {
+        if (!trigger)
+            return 0;
+        _time++;
+
+        STREAM_ENTRY *stream = NULL, *victim = &_streams[0];
+        for (UINT32 i = 0; i < STREAM_ENTRIES; i++) {
+            STREAM_ENTRY &entry = _streams[i];
+            const INT64 distance = INT64(line - entry.lastLine);
+            if (entry.lastUse && distance >= -STREAM_WINDOW && distance <= STREAM_WINDOW) {
+                stream = &entry;
+                break;
+            }
+            if (entry.lastUse < victim->lastUse)
+                victim = &entry;
+        }
+        if (!stream) {
+            victim->lastLine = victim->frontier = line;
+            victim->direction = 0;
+            victim->confidence = 0;
+            victim->lastUse = _time;
+            return 0;
+        }
+
+        stream->lastUse = _time;
+        const INT64 delta = INT64(line - stream->lastLine);
+        if (delta == 0)
+            return 0;
+        const INT64 direction = delta > 0 ? 1 : -1;
+        if (direction == stream->direction) {
+            stream->confidence += stream->confidence < 3;
+        } else {
+            stream->direction = direction;
+            stream->confidence = 0;
+            stream->frontier = line;
+        }
+        stream->lastLine = line;
+        if (stream->confidence < 1)
+            return 0;
+
+        // Continue from the frontier, unless the demand accesses overtook it
+        ADDRINT next = stream->frontier;
+        if (INT64(line - next) * direction > 0)
+            next = line;
+        UINT32 num = 0;
+        for (next += direction; num < _degree && INT64(next - line) * direction <= INT64(_degree);
+             next += direction)
+            lines[num++] = next;
+        if (num)
+            stream->frontier = lines[num - 1];
+        return num;
+    }
+
+  public:
+    L2_PREFETCHER(PREFETCHER_KIND kind, UINT32 degree)
+      : _kind(kind), _degree(std::min(degree, UINT32(MAX_DEGREE))), _time(0)
+    {
+        if (_kind == PREFETCH_STRIDE) {
+            STRIDE_ENTRY empty = { ADDRINT(-1), 0, 0, 0 };
+            _stride.assign(STRIDE_ENTRIES, empty);
+        } else if (_kind == PREFETCH_STREAM) {
+            STREAM_ENTRY empty = { 0, 0, 0, 0, 0 };
+            _streams.assign(STREAM_ENTRIES, empty);
+        }
+    }
+
+    const char *Name() const { return PREFETCHER_NAMES[_kind]; }
+    UINT32 Degree() const { return _degree; }
+
+    /**
+     * Observes a demand access to L2 line `line` by the instruction at `pc`
+     * (0 if unknown). `trigger` is set on misses and on the first hit on a
+     * prefetched line. Writes up to Degree() lines to prefetch to `lines`
+     * and returns how many.
+     **/
+    UINT32 Train(ADDRINT line, ADDRINT pc, bool trigger, ADDRINT *lines)
+    {
+        switch (_kind) {
+          case PREFETCH_NEXT_LINE:
+            return NextLine(line, trigger, lines);
+          case PREFETCH_STRIDE:
+            return Stride(line, pc, lines);
+          case PREFETCH_STREAM:
+            return Stream(line, trigger, lines);
+          default:
+            return 0;
+        }
+    }
+};
+
+#endif // PREFETCH_H
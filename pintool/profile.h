@@ -0,0 +1,239 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <vector>
+#include <algorithm> // std::partial_sort
+#include <fstream>
+#include <sstream>
+
+/**
+ * Miss attribution profile (-prof): the L1 misses, the L2 misses and the
+ * cycles they cost, per instruction and per data region of -prof_region
+ * bytes, to tell which loads and stores and which data structures the
+ * misses come from.
+ *
+ * Only the miss path of the cache hierarchy updates it, one entry of each
+ * of two open addressing tables per L1 miss. Hits cost nothing. The cost
+ * of a miss is its latency beyond an L1 hit, with -ooo too, where
+ * overlapping misses hide part of it.
+ **/
+class MISS_PROFILE
+{
+  public:
+    struct ENTRY
+    {
+        ADDRINT key;        // the PC, or the first address of the region
+        UINT64 l1Misses;
+        UINT64 l2Misses;
+        UINT64 cycles;
+    };
+
+    // The name of what is at `addr`, "" if unknown
+    typedef string (*SYMBOLIZER)(ADDRINT addr);
+
+  private:
+    /**
+     * Counters per key, with linear probing, kept at most half full
+     **/
+    class TABLE
+    {
+      private:
+        static const ADDRINT EMPTY = ~ADDRINT(0);
+
+        std::vector<ENTRY> _entries;
+        UINT32 _bits;
+        UINT64 _used;
+
+        UINT64 Slot(ADDRINT key) const
+        {
+            return (UINT64(key) * 0x9e3779b97f4a7c15ULL) >> (64 - _bits);
+        }
+
+        UINT64 Find(ADDRINT key) const
+        {
+            const UINT64 mask = _entries.size() - 1;
+            UINT64 i = Slot(key);
+            while (_entries[i].key != key && _entries[i].key != EMPTY)
+                i = (i + 1) & mask;
+            return i;
+        }
+
+        VOID Grow()
+        {
+            std::vector<ENTRY> old;
+            old.swap(_entries);
+            _bits++;
+            const ENTRY empty = { EMPTY, 0, 0, 0 };
+            _entries.assign(UINT64(1) << _bits, empty);
+            for (UINT64 i = 0; i < old.size(); i++)
+                if (old[i].key != EMPTY)
+                    _entries[Find(old[i].key)] = old[i];
+        }
+
+        // Most costly first
+        static bool Costlier(const ENTRY &a, const ENTRY &b)
+        {
+            if (a.cycles != b.cycles)
+                return a.cycles > b.cycles;
+            if (a.l1Misses != b.l1Misses)
+                return a.l1Misses > b.l1Misses;
+            return a.key < b.key;
+        }
+
+      public:
+        TABLE() { Reset(); }
+
+        VOID Reset()
+        {
+            _bits = 12;
+            _used = 0;
+            const ENTRY empty = { EMPTY, 0, 0, 0 };
+            _entries.assign(UINT64(1) << _bits, empty);
+        }
+
+        VOID Add(ADDRINT key, bool l2Miss, UINT32 cycles)
+        {
+            ENTRY *entry = &_entries[Find(key)];
+            if (entry->key == EMPTY) {
+                if (2 * (_used + 1) > _entries.size()) {
+                    Grow();
+                    entry = &_entries[Find(key)];
+                }
+                entry->key = key;
+                _used++;
+            }
+            entry->l1Misses++;
+            entry->l2Misses += l2Miss;
+            entry->cycles += cycles;
+        }
+
+        UINT64 Size() const { return _used; }
+
+        // The `n` most costly entries
+        std::vector<ENTRY> Top(UINT32 n) const
+        {
+            std::vector<ENTRY> top;
+            top.reserve(_used);
+            for (UINT64 i = 0; i < _entries.size(); i++)
+                if (_entries[i].key != EMPTY)
+                    top.push_back(_entries[i]);
+            if (n > top.size())
+                n = top.size();
+            std::partial_sort(top.begin(), top.begin() + n, top.end(), Costlier);
+            top.resize(n);
+            return top;
+        }
+    };
+
+    const UINT32 _region_shift;
+    TABLE _pcs;
+    TABLE _regions;
+    ENTRY _total;
+
+    static string Hex(ADDRINT addr)
+    {
+        std::ostringstream o;
+        o << "0x" << std::hex << addr;
+        return o.str();
+    }
+
+    static string Share(UINT64 part, UINT64 total)
+    {
+        return fltstr(total ? 100.0 * part / total : 0, 2, 6) + "%";
+    }
+
+    // A CSV field, quoted if needed
+    static string CsvField(const string &field)
+    {
+        if (field.find_first_of(",\"\n") == string::npos)
+            return field;
+        string quoted = "\"";
+        for (UINT32 i = 0; i < field.size(); i++) {
+            if (field[i] == '"')
+                quoted += '"';
+            quoted += field[i];
+        }
+        return quoted + "\"";
+    }
+
+    string Section(const string &title, const string &kind, const TABLE &table, UINT32 top,
+                   UINT64 instructions, SYMBOLIZER symbolizer, std::ostream &csv) const
+    {
+        const double kilo = instructions / 1000.0;
+        const std::vector<ENTRY> entries = table.Top(top);
+        string out;
+
+        out += "--------\n";
+        out += title + " (top " + dec2str(entries.size(), 1) + " of " + dec2str(table.Size(), 1) + ")\n";
+        out += "--------\n";
+        out += ljstr(kind, 20) + "   L1-Misses  L1-MPKI   Share     L2-Misses  L2-MPKI   Share"
+               "   Miss-Cycles   Share  Symbol\n";
+        for (UINT32 i = 0; i < entries.size(); i++) {
+            const ENTRY &e = entries[i];
+            const string symbol = symbolizer ? symbolizer(e.key) : "";
+            out += ljstr(Hex(e.key), 20)
+                 + dec2str(e.l1Misses, 12) + fltstr(kilo ? e.l1Misses / kilo : 0, 3, 9) + " " + Share(e.l1Misses, _total.l1Misses)
+                 + dec2str(e.l2Misses, 14) + fltstr(kilo ? e.l2Misses / kilo : 0, 3, 9) + " " + Share(e.l2Misses, _total.l2Misses)
+                 + dec2str(e.cycles, 14) + " " + Share(e.cycles, _total.cycles)
+                 + "  " + symbol + "\n";
+            csv << kind << "," << Hex(e.key) << "," << e.l1Misses << "," << e.l2Misses << ","
+                << e.cycles << "," << CsvField(symbol) << "\n";
+        }
+        return out + "\n";
+    }
+
+  public:
+    // Data regions of `regionSize` bytes, a power of 2
+    MISS_PROFILE(UINT32 regionSize)
+      : _region_shift(FloorLog2(regionSize))
+    {
+        Reset();
+    }
+
+    // An L1 miss of the instruction at `pc`, to `addr`, `cycles` more than
+    // an L1 hit
+    VOID Miss(ADDRINT pc, ADDRINT addr, bool l2Miss, UINT32 cycles)
+    {
+        _pcs.Add(pc, l2Miss, cycles);
+        _regions.Add(addr >> _region_shift << _region_shift, l2Miss, cycles);
+        _total.l1Misses++;
+        _total.l2Misses += l2Miss;
+        _total.cycles += cycles;
+    }
+
+    VOID Reset()
+    {
+        _pcs.Reset();
+        _regions.Reset();
+        _total.key = 0;
+        _total.l1Misses = _total.l2Misses = _total.cycles = 0;
+    }
+
+    /**
+     * Writes the `top` most costly instructions and data regions to
+     * `fileName`, and as CSV to `fileName`.csv. The symbolizers name the
+     * instructions and the regions, when given.
+     **/
+    VOID Write(const string &fileName, UINT32 top, UINT64 instructions,
+               SYMBOLIZER pcSymbolizer, SYMBOLIZER regionSymbolizer) const
+    {
+        std::ofstream out(fileName.c_str());
+        std::ofstream csv((fileName + ".csv").c_str());
+
+        out << "--------\n";
+        out << "Miss Profile\n";
+        out << "--------\n";
+        out << "Total Instructions: " << instructions << "\n";
+        out << "L1-Misses: " << _total.l1Misses << "\n";
+        out << "L2-Misses: " << _total.l2Misses << "\n";
+        out << "Miss-Cycles: " << _total.cycles << "\n";
+        out << "Region-Size: " << (UINT64(1) << _region_shift) << "\n";
+        out << "\n";
+
+        csv << "kind,address,l1_misses,l2_misses,miss_cycles,symbol\n";
+        out << Section("Misses by Instruction", "PC", _pcs, top, instructions, pcSymbolizer, csv);
+        out << Section("Misses by Data Region", "Region", _regions, top, instructions, regionSymbolizer, csv);
+    }
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,642 @@
+/**
+ * Trace-driven replay: simulates the cache configurations of the pintool on
+ * a trace recorded by the tracer pintool, without running the application
+ * under Pin. Built without Pin (make replay), and takes the same switches as
+ * the pintool, followed by the trace file.
+ **/
+#include "pinless.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+#include "globals.h"
+#include "cache.h"
+#include "stackdist.h"
+#include "config.h"
+#include "tlb.h"
+#include "timing.h"
+#include "dram.h"
+#include "trace_reader.h"
+#include "opt.h"
+#include "intervals.h"
+
+/* ===================================================================== */
+/* Commandline Switches                                                  */
+/* ===================================================================== */
+
+struct OPTION
+{
+    const char *name;
+    const char *defaultValue;
+    const char *help;
+    bool append;
+};
+
+static const OPTION options[] = {
+    { "o",          "cslab_cache.out", "specify dcache file name (file name prefix with -conf)", false },
+    { "L1c",        "32",       "L1 cache size in kilobytes", false },
+    { "L1b",        "64",       "L1 cache block size in bytes", false },
+    { "L1a",        "8",        "L1 cache associativity (1 for direct mapped)", false },
+    { "L2c",        "256",      "L2 cache size in kilobytes", false },
+    { "L2b",        "64",       "L2 cache block size in bytes", false },
+    { "L2a",        "8",        "L2 cache associativity (1 for direct mapped)", false },
+    { "L3c",        "0",        "L3 cache size in kilobytes (0 for no L3)", false },
+    { "L3b",        "64",       "L3 cache block size in bytes", false },
+    { "L3a",        "16",       "L3 cache associativity (1 for direct mapped)", false },
+    { "L3lat",      "40",       "L3 hit latency in cycles", false },
+    { "L3incl",     "1",        "the L3 is inclusive of the L1 and the L2", false },
+    { "L1wt",       "0",        "the L1 is write-through (stores also write the L2) instead of write-back", false },
+    { "L1wa",       "1",        "L1 store misses allocate a line", false },
+    { "L2wt",       "0",        "the L2 is write-through (writes also go below) instead of write-back", false },
+    { "L2wa",       "1",        "L2 misses of the stores the L1 does not keep allocate a line", false },
+    { "L2incl",     "1",        "the L2 is inclusive of the L1", false },
+    { "L2ss",       "1",        "simulate one in L2ss L2 sets and scale the L2 misses", false },
+    { "L2prf",      "0",        "number of lines to prefetch to L2 (0 disables prefetching)", false },
+    { "L2prfkind",  "next",     "L2 prefetcher: next, stride (per 64-line region, traces have no PC) or stream", false },
+    { "tlb",        "0",        "translate every reference through a DTLB and an STLB, walking the page table through the caches on misses", false },
+    { "dtlbe",      "64",       "DTLB entries", false },
+    { "dtlba",      "4",        "DTLB associativity", false },
+    { "stlbe",      "1536",     "STLB entries", false },
+    { "stlba",      "12",       "STLB associativity", false },
+    { "stlblat",    "7",        "cycles of an STLB lookup", false },
+    { "page",       "4",        "page size in kilobytes (4 or 2048)", false },
+    { "L1lat",      "1",        "L1 hit latency in cycles", false },
+    { "L2lat",      "15",       "L2 hit latency in cycles", false },
+    { "memlat",     "250",      "latency of the references that miss the last level cache, in cycles", false },
+    { "ooo",        "0",        "derive the cycles from an out-of-order window where independent misses overlap, "
+                                "instead of adding up the latencies of all references", false },
+    { "rob",        "128",      "reorder buffer entries, in instructions (-ooo)", false },
+    { "mshr",       "10",       "L1 miss status holding registers (-ooo)", false },
+    { "dram",       "0",        "model the DRAM banks, row buffers and channels below the last level cache "
+                                "instead of a fixed -memlat (see dram.h)", false },
+    { "dram_ch",    "2",        "DRAM channels", false },
+    { "dram_ranks", "1",        "DRAM ranks per channel", false },
+    { "dram_banks", "16",       "DRAM banks per rank", false },
+    { "dram_row",   "8",        "DRAM row size in kilobytes", false },
+    { "dram_map",   "RoRaBaCoCh", "DRAM address mapping, from the most significant field down: "
+                                "Ro(w), Ra(nk), Ba(nk), Ch(annel) and Co(lumn), row first", false },
+    { "dram_cas",   "42",       "DRAM column access latency (tCAS) in cycles", false },
+    { "dram_rcd",   "42",       "DRAM row activation latency (tRCD) in cycles", false },
+    { "dram_rp",    "42",       "DRAM precharge latency (tRP) in cycles", false },
+    { "dram_burst", "10",       "cycles of the transfer of a line on a DRAM channel", false },
+    { "dram_ctl",   "100",      "cycles of the on-chip network and memory controller, both ways", false },
+    { "dram_wq",    "32",       "entries of the write queue of every DRAM channel", false },
+    { "L1pol",      "SRRIP",    "L1 replacement policy", false },
+    { "L2pol",      "SRRIP",    "L2 replacement policy", false },
+    { "L3pol",      "SRRIP",    "L3 replacement policy", false },
+    { "rrpv",       "2",        "width of the RRIP re-reference prediction values in bits", false },
+    { "conf",       "",         "extra L2 configuration <size>_<assoc>_<block size>[_<policy>[_<L2 policy>]], "
+                                "may be repeated (see the pintool)", true },
+    { "stackdist",  "0",        "simulate every LRU L2 with -L2b byte blocks in one pass", false },
+    { "sdminsets",  "16",       "smallest number of L2 sets in stack distance mode", false },
+    { "sdmaxsets",  "16384",    "largest number of L2 sets in stack distance mode", false },
+    { "sdmaxassoc", "16",       "largest L2 associativity in stack distance mode", false },
+    { "ff",         "0",        "number of instructions to skip before simulating", false },
+    { "warmup",     "0",        "number of instructions simulated after -ff to warm the caches up, without statistics", false },
+    { "measure",    "0",        "number of instructions simulated after the warmup (0 for the rest of the trace)", false },
+    { "decoders",   "2",        "number of threads decoding the trace ahead of the simulation", false },
+    { "ahead",      "8",        "number of trace chunks decoded in advance", false },
+    { "opt_tmp",    "/tmp",     "directory of the temporary file of the next uses of the OPT policy", false },
+    { "prof",       "0",        "attribute the L1 and L2 misses to the instructions and data regions, "
+                                "in <output>.prof and <output>.prof.csv", false },
+    { "prof_top",   "20",       "instructions and data regions listed in the miss profile", false },
+    { "prof_region", "4096",    "size of the data regions of the miss profile in bytes", false },
+    { "interval",   "0",        "append the statistics of every interval of this many measured instructions "
+                                "to <output>.intervals.csv (0 disables)", false },
+};
+
+static std::map<string, std::vector<string> > option_values;
+
+static const OPTION *FindOption(const string &name)
+{
+    for (UINT32 i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+        if (name == options[i].name)
+            return &options[i];
+    return NULL;
+}
+
+static string Option(const string &name)
+{
+    const std::vector<string> &values = option_values[name];
+    return values.empty() ? FindOption(name)->defaultValue : values.back();
+}
+
+static UINT64 OptionValue(const string &name)
+{
+    return std::strtoull(Option(name).c_str(), NULL, 10);
+}
+
+/* ===================================================================== */
+/* Global Variables                                                      */
+/* ===================================================================== */
+
+typedef CACHE_BASE CACHE_T;
+
+struct SIM_CONFIG : public CACHE_CONFIG
+{
+    CACHE_T *cache;
+    TLB *tlb;           // NULL without -tlb
+    OOO_TIMING *timing; // NULL without -ooo
+    MISS_PROFILE *profile; // NULL without -prof
+    INTERVAL_STATS *intervals; // NULL without -interval
+    UINT64 position;    // instructions retired at the last reference, with -ooo
+    UINT64 cycles;      // memory hierarchy cycles, translation included, without -ooo
+
+    // Feeds a chunk of references to `cache`, instantiated for its type,
+    // with their next-use distances if the OPT policy needs them
+    VOID (*simulate)(SIM_CONFIG *config, const TRACE_REF *refs, const UINT64 *nextUses, UINT64 num);
+};
+std::vector<SIM_CONFIG> configs;
+
+STACK_DISTANCE_BASE *stack_distance;
+VOID (*stack_distance_simulate)(const TRACE_REF *refs, UINT64 num);
+
+PREFETCHER_KIND l2_prefetcher;  // parsed -L2prfkind
+WRITE_POLICY write_policy;      // -L1wt, -L1wa, -L2wt, -L2wa and -L2incl
+DRAM_PARAMS dram_params;        // -dram_*
+
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "usage: replay [switches] <trace file>\n\n";
+    cerr << "This tool replays a memory reference trace on a 2-level cache simulator.\n\n";
+    for (UINT32 i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+        cerr << "-" << ljstr(options[i].name, 12) << "[default " << options[i].defaultValue
+             << "]\n\t" << options[i].help << "\n";
+    cerr << "\nReplacement policies: " << PolicyNames() << endl;
+    return 1;
+}
+
+/* ===================================================================== */
+
+template <class CACHE, bool TRANSLATE>
+VOID SimulateChunk(SIM_CONFIG *config, const TRACE_REF *refs, const UINT64 *nextUses, UINT64 num)
+{
+    CACHE *cache = static_cast<CACHE *>(config->cache);
+    UINT64 cycles = 0;
+
+    for (UINT64 i = 0; i < num; i++) {
+        if (nextUses)
+            cache->SetNextUse(refs[i].addr, nextUses[i]);
+        if (TRANSLATE)
+            cycles += config->tlb->Translate<true>(refs[i].addr, *cache);
+        cycles += cache->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(refs[i].type), refs[i].pc);
+    }
+
+    config->cycles += cycles;
+}
+
+// -ooo: the latencies go to the timing model instead of being added up. A
+// reference that retired more instructions than the previous one starts a
+// basic block, of the instructions in between.
+template <class CACHE, bool TRANSLATE>
+VOID SimulateTimedChunk(SIM_CONFIG *config, const TRACE_REF *refs, const UINT64 *nextUses, UINT64 num)
+{
+    CACHE *cache = static_cast<CACHE *>(config->cache);
+    OOO_TIMING *timing = config->timing;
+
+    for (UINT64 i = 0; i < num; i++) {
+        if (refs[i].instructions > config->position) {
+            timing->Block(refs[i].instructions - config->position);
+            config->position = refs[i].instructions;
+        }
+        cache->SetClock(timing->Issue());
+        if (nextUses)
+            cache->SetNextUse(refs[i].addr, nextUses[i]);
+        UINT64 latency = 0;
+        if (TRANSLATE)
+            latency += config->tlb->Translate<true>(refs[i].addr, *cache);
+        latency += cache->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(refs[i].type), refs[i].pc);
+        timing->Access(refs[i].addr, refs[i].type == TRACE_STORE, latency);
+    }
+}
+
+template <class ENGINE>
+VOID StackDistanceChunk(const TRACE_REF *refs, UINT64 num)
+{
+    ENGINE *engine = static_cast<ENGINE *>(stack_distance);
+
+    for (UINT64 i = 0; i < num; i++)
+        engine->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(refs[i].type));
+}
+
+VOID SimulateAll(const TRACE_REF *refs, const UINT64 *nextUses, UINT64 num)
+{
+    if (stack_distance) {
+        stack_distance_simulate(refs, num);
+        return;
+    }
+
+    for (UINT32 i = 0; i < configs.size(); i++)
+        configs[i].simulate(&configs[i], refs, nextUses, num);
+}
+
+// End of the warmup
+VOID ResetAll()
+{
+    if (stack_distance) {
+        stack_distance->ResetStats();
+        return;
+    }
+
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        configs[i].cache->ResetStats();
+        if (configs[i].tlb)
+            configs[i].tlb->ResetStats();
+        if (configs[i].timing)
+            configs[i].timing->ResetStats();
+        if (configs[i].intervals)
+            configs[i].intervals->Reset();
+        configs[i].cycles = 0;
+    }
+}
+
+// Cycles of `config` since its statistics were reset, over `instructions`
+UINT64 ElapsedCycles(const SIM_CONFIG *config, UINT64 instructions)
+{
+    return config->timing ? config->timing->Cycles() : instructions + config->cycles;
+}
+
+// End of an interval, `instructions` after the warmup
+VOID EndIntervals(UINT64 instructions)
+{
+    for (UINT32 i = 0; i < configs.size(); i++)
+        if (configs[i].intervals)
+            configs[i].intervals->End(configs[i].cache->Stats(),
+                                      ElapsedCycles(&configs[i], instructions), instructions);
+}
+
+// Whether `ref` comes after the first `instructions` of the trace
+static bool RetiredAfter(UINT64 instructions, const TRACE_REF &ref)
+{
+    return instructions < ref.instructions;
+}
+
+struct CACHE_BUILDER
+{
+    SIM_CONFIG *config;
+
+    template <class L1SET, class L2SET>
+    VOID Visit()
+    {
+        typedef TWO_LEVEL_CACHE<L1SET, L2SET> CACHE;
+
+        CACHE *cache = new CACHE("Two level Cache hierarchy",
+                                 OptionValue("L1c") * KILO,
+                                 OptionValue("L1b"),
+                                 OptionValue("L1a"),
+                                 config->l2Size * KILO,
+                                 config->l2BlockSize,
+                                 config->l2Associativity,
+                                 OptionValue("L2prf"),
+                                 l2_prefetcher,
+                                 OptionValue("L2ss"),
+                                 write_policy,
+                                 OptionValue("L1lat"),
+                                 OptionValue("L2lat"),
+                                 OptionValue("memlat"));
+        LOWER_LEVEL_BASE *memory = !OptionValue("dram") ? NULL :
+            new DRAM(dram_params, OptionValue("L3c") ? OptionValue("L3b") : config->l2BlockSize);
+        if (OptionValue("L3c"))
+            cache->SetLowerLevels(MakeCacheLevel(Option("L3pol"), "L3",
+                                                 OptionValue("L3c") * KILO,
+                                                 OptionValue("L3b"),
+                                                 OptionValue("L3a"),
+                                                 OptionValue("L3lat"),
+                                                 cache->MemoryLatency(),
+                                                 OptionValue("L3incl"),
+                                                 memory));
+        else if (memory)
+            cache->SetLowerLevels(memory);
+        config->cache = cache;
+        if (config->profile)
+            cache->SetProfile(config->profile);
+        if (config->timing)
+            config->simulate = config->tlb ? SimulateTimedChunk<CACHE, true> : SimulateTimedChunk<CACHE, false>;
+        else
+            config->simulate = config->tlb ? SimulateChunk<CACHE, true> : SimulateChunk<CACHE, false>;
+    }
+};
+
+struct STACK_DISTANCE_BUILDER
+{
+    template <class L1SET>
+    VOID Visit()
+    {
+        typedef STACK_DISTANCE<L1SET> ENGINE;
+
+        stack_distance = new ENGINE(OptionValue("L1c") * KILO,
+                                    OptionValue("L1b"),
+                                    OptionValue("L1a"),
+                                    OptionValue("L2b"),
+                                    OptionValue("sdminsets"),
+                                    OptionValue("sdmaxsets"),
+                                    OptionValue("sdmaxassoc"),
+                                    write_policy.l1WriteAllocate);
+        stack_distance_simulate = StackDistanceChunk<ENGINE>;
+    }
+};
+
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    string traceFile;
+    for (int i = 1; i < argc; i++) {
+        const OPTION *option = argv[i][0] == '-' ? FindOption(argv[i] + 1) : NULL;
+        if (option && i + 1 < argc) {
+            option_values[option->name].push_back(argv[++i]);
+        } else if (argv[i][0] != '-' && traceFile.empty()) {
+            traceFile = argv[i];
+        } else {
+            cerr << "Error: unexpected argument " << argv[i] << endl;
+            return Usage();
+        }
+    }
+    if (traceFile.empty())
+        return Usage();
+
+    CACHE_SET::SRRIP::RRPVBits = OptionValue("rrpv");
+
+    if (!ParsePrefetcher(Option("L2prfkind"), l2_prefetcher)) {
+        cerr << "Error: unknown L2 prefetcher " << Option("L2prfkind") << endl;
+        return Usage();
+    }
+    if (OptionValue("L2prf") > L2_PREFETCHER::MAX_DEGREE) {
+        cerr << "Error: -L2prf is at most " << L2_PREFETCHER::MAX_DEGREE << endl;
+        return Usage();
+    }
+    write_policy.l1WriteThrough = OptionValue("L1wt");
+    write_policy.l1WriteAllocate = OptionValue("L1wa");
+    write_policy.l2WriteThrough = OptionValue("L2wt");
+    write_policy.l2WriteAllocate = OptionValue("L2wa");
+    write_policy.l2Inclusive = OptionValue("L2incl");
+    if (OptionValue("stackdist") &&
+        (write_policy.l1WriteThrough || write_policy.l2WriteThrough || !write_policy.l2WriteAllocate)) {
+        cerr << "Error: stack distance mode only simulates write-back caches, "
+                "and L2s that allocate every miss" << endl;
+        return Usage();
+    }
+    if (OptionValue("L3c")) {
+        if (!IsPolicyName(Option("L3pol"))) {
+            cerr << "Error: unknown L3 replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+        if (OptionValue("L2ss") > 1 || OptionValue("stackdist")) {
+            cerr << "Error: an L3 is not supported with -L2ss and in stack distance mode" << endl;
+            return Usage();
+        }
+    }
+    if (OptionValue("dram")) {
+        dram_params.channels = OptionValue("dram_ch");
+        dram_params.ranks = OptionValue("dram_ranks");
+        dram_params.banks = OptionValue("dram_banks");
+        dram_params.rowSize = OptionValue("dram_row") * KILO;
+        dram_params.mapping = Option("dram_map");
+        dram_params.tCAS = OptionValue("dram_cas");
+        dram_params.tRCD = OptionValue("dram_rcd");
+        dram_params.tRP = OptionValue("dram_rp");
+        dram_params.tBurst = OptionValue("dram_burst");
+        dram_params.controllerLatency = OptionValue("dram_ctl");
+        dram_params.writeQueue = OptionValue("dram_wq");
+        if (OptionValue("L2ss") > 1 || OptionValue("stackdist")) {
+            cerr << "Error: -dram is not supported with -L2ss and in stack distance mode" << endl;
+            return Usage();
+        }
+    }
+    if (OptionValue("tlb")) {
+        if (!TLB::ValidGeometry(OptionValue("dtlbe"), OptionValue("dtlba")) ||
+            !TLB::ValidGeometry(OptionValue("stlbe"), OptionValue("stlba"))) {
+            cerr << "Error: TLB entries must be a power of 2 sets of -dtlba/-stlba ways" << endl;
+            return Usage();
+        }
+        if (OptionValue("page") != 4 && OptionValue("page") != 2048) {
+            cerr << "Error: -page must be 4 or 2048" << endl;
+            return Usage();
+        }
+    }
+
+    if (OptionValue("ooo")) {
+        if (OptionValue("rob") == 0 || OptionValue("mshr") == 0) {
+            cerr << "Error: -rob and -mshr must be at least 1" << endl;
+            return Usage();
+        }
+        if (OptionValue("stackdist")) {
+            cerr << "Error: -ooo is not supported in stack distance mode" << endl;
+            return Usage();
+        }
+    }
+
+    if (OptionValue("prof")) {
+        if (OptionValue("prof_region") == 0 || !IsPowerOf2(OptionValue("prof_region"))) {
+            cerr << "Error: -prof_region must be a power of 2" << endl;
+            return Usage();
+        }
+        if (OptionValue("L2ss") > 1 || OptionValue("stackdist")) {
+            cerr << "Error: -prof is not supported with -L2ss and in stack distance mode" << endl;
+            return Usage();
+        }
+    }
+    if (OptionValue("interval") && OptionValue("stackdist")) {
+        cerr << "Error: -interval is not supported in stack distance mode" << endl;
+        return Usage();
+    }
+
+    std::vector<string> specs;
+    const std::vector<string> &confs = option_values["conf"];
+    for (UINT32 i = 0; i < confs.size(); i++)
+        if (!confs[i].empty())
+            specs.push_back(confs[i]);
+
+    if (OptionValue("stackdist")) {
+        STACK_DISTANCE_BUILDER builder;
+        if (PolicyUsesPC(Option("L1pol")) || PolicyUsesNextUse(Option("L1pol"))) {
+            cerr << "Error: the stack distance mode does not support PC based policies and OPT" << endl;
+            return Usage();
+        }
+        if (!DispatchPolicy(Option("L1pol"), builder)) {
+            cerr << "Error: unknown replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+        specs.clear();
+    }
+
+    UINT32 optBlockSize = 0;    // of the levels with the OPT policy, if any
+    configs.resize(stack_distance ? 0 : specs.empty() ? 1 : specs.size());
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        SIM_CONFIG &config = configs[i];
+        if (specs.empty()) {
+            config.l2Size = OptionValue("L2c");
+            config.l2Associativity = OptionValue("L2a");
+            config.l2BlockSize = OptionValue("L2b");
+            config.l1Policy = Option("L1pol");
+            config.l2Policy = Option("L2pol");
+            config.outFileName = Option("o");
+        } else if (!ParseConfig(specs[i], Option("L1pol"), Option("L2pol"), Option("o"), config)) {
+            cerr << "Error: bad cache configuration " << specs[i] << endl;
+            return Usage();
+        }
+        config.cycles = 0;
+        if (OptionValue("L3c") && OptionValue("L3b") < config.l2BlockSize) {
+            cerr << "Error: the L3 blocks must be at least as large as the L2 ones" << endl;
+            return Usage();
+        }
+        if (OptionValue("dram") &&
+            !DRAM::ValidParams(dram_params, OptionValue("L3c") ? OptionValue("L3b") : config.l2BlockSize)) {
+            cerr << "Error: DRAM channels, ranks, banks and rows must be powers of 2, rows at least "
+                    "a cache block, and -dram_map a permutation of Ro, Ra, Ba, Ch and Co, row first" << endl;
+            return Usage();
+        }
+        config.tlb = !OptionValue("tlb") ? NULL :
+            new TLB(OptionValue("dtlbe"), OptionValue("dtlba"),
+                    OptionValue("stlbe"), OptionValue("stlba"),
+                    OptionValue("page") * KILO, OptionValue("stlblat"));
+        config.timing = !OptionValue("ooo") ? NULL :
+            new OOO_TIMING(OptionValue("rob"), OptionValue("mshr"),
+                           OptionValue("L1b"), OptionValue("L1lat"));
+        config.position = OptionValue("ff");
+        config.profile = !OptionValue("prof") ? NULL : new MISS_PROFILE(OptionValue("prof_region"));
+        config.intervals = !OptionValue("interval") ? NULL :
+            new INTERVAL_STATS(config.outFileName + ".intervals.csv");
+        if (config.intervals && !config.intervals->Good()) {
+            cerr << "Error: cannot write " << config.outFileName << ".intervals.csv" << endl;
+            return 1;
+        }
+
+        // The next uses are those of the blocks of a single size
+        const UINT32 optBlockSizes[] = {
+            PolicyUsesNextUse(config.l1Policy) ? UINT32(OptionValue("L1b")) : 0,
+            PolicyUsesNextUse(config.l2Policy) ? config.l2BlockSize : 0,
+            OptionValue("L3c") && PolicyUsesNextUse(Option("L3pol")) ? UINT32(OptionValue("L3b")) : 0
+        };
+        for (UINT32 level = 0; level < 3; level++) {
+            if (!optBlockSizes[level])
+                continue;
+            if (optBlockSize && optBlockSizes[level] != optBlockSize) {
+                cerr << "Error: all the OPT levels must have the same block size" << endl;
+                return Usage();
+            }
+            optBlockSize = optBlockSizes[level];
+        }
+        if (optBlockSize && (OptionValue("tlb") || OptionValue("L2prf") || OptionValue("L2ss") > 1)) {
+            cerr << "Error: OPT is not supported with -L2ss, and with -tlb and -L2prf whose accesses are not in the trace" << endl;
+            return Usage();
+        }
+
+        CACHE_BUILDER builder;
+        builder.config = &config;
+        if (!DispatchPolicies(config.l1Policy, config.l2Policy, builder)) {
+            cerr << "Error: unknown replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+    }
+
+    TRACE_READER reader;
+    if (!reader.Open(traceFile)) {
+        cerr << "Error: " << reader.Error() << endl;
+        return 1;
+    }
+
+    // Region of the trace to simulate, found through the chunk index
+    const UINT64 start = OptionValue("ff");
+    const UINT64 measureStart = start + OptionValue("warmup");
+    UINT64 stop = OptionValue("measure") ? measureStart + OptionValue("measure") : reader.Instructions();
+    if (stop > reader.Instructions())
+        stop = reader.Instructions();
+    const UINT64 total_instructions = stop > measureStart ? stop - measureStart : 0;
+    reader.SetRegion(start, stop);
+
+    // OPT: a first pass computes the next uses, loaded with every chunk
+    NEXT_USES nextUses;
+    std::vector<UINT64> distances;
+    if (optBlockSize && !nextUses.Compute(reader, optBlockSize, Option("opt_tmp"))) {
+        cerr << "Error: " << traceFile << ": " << nextUses.Error() << endl;
+        return 1;
+    }
+
+    reader.Start(OptionValue("decoders"), OptionValue("ahead"));
+
+    const TRACE_REF *refs;
+    UINT64 num;
+    bool warm = false;
+    UINT64 intervalEnd = OptionValue("interval") ? measureStart + OptionValue("interval") : 0;
+    for (UINT64 chunk = 0; reader.Next(refs, num); chunk++) {
+        const UINT64 *next = NULL;
+        if (optBlockSize) {
+            if (!nextUses.Load(chunk, num, distances)) {
+                cerr << "Error: " << nextUses.Error() << endl;
+                return 1;
+            }
+            next = distances.empty() ? NULL : &distances[0];
+        }
+
+        UINT64 first = 0;
+        if (!warm) {
+            // References of the warmup, simulated without statistics
+            while (first < num && refs[first].instructions <= measureStart)
+                first++;
+            SimulateAll(refs, next, first);
+            if (first == num)
+                continue;
+            ResetAll();
+            warm = true;
+        }
+
+        // The intervals are simulated piecewise, their ends found by a
+        // binary search on the instruction counts
+        while (intervalEnd && refs[num - 1].instructions > intervalEnd) {
+            const UINT64 end = std::upper_bound(refs + first, refs + num, intervalEnd, RetiredAfter) - refs;
+            SimulateAll(refs + first, next ? next + first : NULL, end - first);
+            EndIntervals(intervalEnd - measureStart);
+            intervalEnd += OptionValue("interval");
+            first = end;
+        }
+        SimulateAll(refs + first, next ? next + first : NULL, num - first);
+    }
+    if (!warm)
+        ResetAll();
+    if (!reader.Error().empty()) {
+        cerr << "Error: " << traceFile << ": " << reader.Error() << endl;
+        return 1;
+    }
+
+    if (stack_distance) {
+        stack_distance->Report(Option("o"), total_instructions);
+        return 0;
+    }
+
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        string appendix;
+        UINT64 memoryCycles = configs[i].cycles;
+        if (configs[i].tlb)
+            appendix += configs[i].tlb->Report(total_instructions);
+        if (configs[i].timing) {
+            // The basic blocks after the last reference
+            if (stop > configs[i].position)
+                configs[i].timing->Block(stop - configs[i].position);
+            configs[i].timing->Drain();
+            memoryCycles = configs[i].timing->MemoryCycles(total_instructions);
+            appendix += configs[i].timing->Report();
+        }
+        // The last interval, however short
+        if (configs[i].intervals)
+            configs[i].intervals->End(configs[i].cache->Stats(),
+                                      ElapsedCycles(&configs[i], total_instructions), total_instructions);
+        WriteReport(configs[i].outFileName, *configs[i].cache,
+                    total_instructions, memoryCycles, appendix);
+        // Traces have no symbols
+        if (configs[i].profile)
+            configs[i].profile->Write(configs[i].outFileName + ".prof", OptionValue("prof_top"),
+                                      total_instructions, NULL, NULL);
+    }
+
+    return 0;
+}
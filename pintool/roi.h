@@ -0,0 +1,11 @@
+#ifndef ROI_H
+#define ROI_H
+
+/**
+ * Region of interest markers, for applications simulated with -roi_magic 1.
+ * Both are no-ops when the application runs natively.
+ **/
+#define CSLAB_ROI_BEGIN() __asm__ __volatile__("xchg %%bx, %%bx" ::: "memory")
+#define CSLAB_ROI_END()   __asm__ __volatile__("xchg %%cx, %%cx" ::: "memory")
+
+#endif // ROI_H
@@ -0,0 +1,129 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+#include <cstring>   // memset
+#include <sstream>
+
+/**
+ * Statistics of a sampled simulation (SMARTS, Wunderlich et al.): short
+ * samples are simulated in detail at a fixed period, and the CPI and the
+ * MPKIs of the whole region are estimated as the mean over the samples,
+ * with a confidence interval given by their variance.
+ *
+ * Begin() and End() take the counters of the cache hierarchy and the
+ * memory cycles accumulated so far, at both ends of every sample.
+ **/
+class SAMPLE_STATS
+{
+  private:
+    // Sum and sum of squares of one metric over the samples
+    struct ESTIMATE
+    {
+        double sum;
+        double sumSquares;
+
+        VOID Add(double x)
+        {
+            sum += x;
+            sumSquares += x * x;
+        }
+
+        double Mean(UINT64 n) const { return sum / n; }
+
+        // Half width of the 95% confidence interval of the mean, relative
+        // to it (normal approximation)
+        double RelativeError(UINT64 n) const
+        {
+            if (n < 2)
+                return 0;
+            const double mean = Mean(n);
+            const double variance = (sumSquares - sum * mean) / (n - 1);
+            return variance > 0 && mean > 0 ? 1.96 * std::sqrt(variance / n) / mean : 0;
+        }
+    };
+
+    UINT64 _samples;
+    UINT64 _instructions;   // over all samples
+    ESTIMATE _cpi;
+    ESTIMATE _l1_mpki;
+    ESTIMATE _l2_mpki;
+
+    // State at the start of the current sample
+    CACHE_BASE::COUNTERS _start;
+    UINT64 _start_cycles;
+
+    static UINT64 Misses(const CACHE_STATS level[CACHE_BASE::ACCESS_TYPE_NUM][CACHE_BASE::HIT_MISS_NUM])
+    {
+        UINT64 misses = 0;
+        for (UINT32 i = 0; i < CACHE_BASE::ACCESS_TYPE_NUM; i++)
+            misses += level[i][false];
+        return misses;
+    }
+
+    static string FormatEstimate(const string &name, double value, double error,
+                                 UINT64 samples, UINT32 precision)
+    {
+        string out = ljstr(name + "-Estimate: ", 20) + fltstr(value, precision, 12);
+        if (samples > 1)
+            out += "  +/- " + fltstr(100.0 * error, 2, 6) + "% (95% confidence)";
+        return out + "\n";
+    }
+
+  public:
+    SAMPLE_STATS()
+      : _samples(0), _instructions(0), _start_cycles(0)
+    {
+        _cpi.sum = _cpi.sumSquares = 0;
+        _l1_mpki.sum = _l1_mpki.sumSquares = 0;
+        _l2_mpki.sum = _l2_mpki.sumSquares = 0;
+        memset(&_start, 0, sizeof(_start));
+    }
+
+    VOID Begin(const CACHE_BASE::COUNTERS &stats, UINT64 memoryCycles)
+    {
+        _start = stats;
+        _start_cycles = memoryCycles;
+    }
+
+    // Ends a sample of `instructions` instructions
+    VOID End(const CACHE_BASE::COUNTERS &stats, UINT64 memoryCycles, UINT64 instructions)
+    {
+        if (instructions == 0)
+            return;
+
+        const double kilo = instructions / 1000.0;
+        _cpi.Add((double)(instructions + memoryCycles - _start_cycles) / instructions);
+        _l1_mpki.Add((Misses(stats.l1) - Misses(_start.l1)) / kilo);
+        _l2_mpki.Add((Misses(stats.l2) - Misses(_start.l2)) / kilo);
+        _instructions += instructions;
+        _samples++;
+    }
+
+    /**
+     * The sampling section of the report. The IPC is estimated as the
+     * inverse of the mean CPI, with the same relative error.
+     **/
+    string Report(UINT64 period, UINT64 size, UINT64 regionInstructions) const
+    {
+        std::ostringstream out;
+
+        out << "--------\n";
+        out << "Sampling\n";
+        out << "--------\n";
+        out << "Sample Period: " << period << "\n";
+        out << "Sample Size: " << size << "\n";
+        out << "Samples: " << _samples << "\n";
+        out << "Sampled Instructions: " << _instructions << "\n";
+        out << "Region Instructions: " << regionInstructions << "\n";
+        if (_samples == 0)
+            return out.str();
+
+        out << FormatEstimate("IPC", 1.0 / _cpi.Mean(_samples), _cpi.RelativeError(_samples), _samples, 6);
+        out << FormatEstimate("L1-MPKI", _l1_mpki.Mean(_samples), _l1_mpki.RelativeError(_samples), _samples, 3);
+        out << FormatEstimate("L2-MPKI", _l2_mpki.Mean(_samples), _l2_mpki.RelativeError(_samples), _samples, 3);
+        return out.str();
+    }
+};
+
+#endif // SAMPLING_H
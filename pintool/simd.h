@@ -0,0 +1,131 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * Vectorized helpers for scanning all the ways of a cache set at once.
+ * AVX2 or SSE4.2 code is used when the compiler targets it (see SIMD in
+ * makefile.rules), otherwise plain loops. Way masks are 64 bits wide, so a
+ * set may have at most 64 ways.
+ **/
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#  include <immintrin.h>
+#endif
+
+#define SIMD_MAX_WAYS 64
+
+/**
+ * Index of the lowest set bit of a non-zero mask
+ **/
+static inline UINT32 FirstWay(UINT64 mask)
+{
+    return __builtin_ctzll(mask);
+}
+
+/**
+ * Bit i of the result is set iff tags[i] == tag, for i < n
+ **/
+static inline UINT64 MatchTags(const ADDRINT *tags, ADDRINT tag, UINT32 n)
+{
+    UINT64 mask = 0;
+    UINT32 i = 0;
+
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi64x(tag);
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(tags + i));
+        UINT64 m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key)));
+        mask |= m << i;
+    }
+#elif defined(__SSE4_2__)
+    const __m128i key = _mm_set1_epi64x(tag);
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(tags + i));
+        UINT64 m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, key)));
+        mask |= m << i;
+    }
+#endif
+    for (; i < n; i++)
+        mask |= UINT64(tags[i] == tag) << i;
+
+    return mask;
+}
+
+/**
+ * Bit i of the result is set iff meta[i] == value, for i < n
+ **/
+static inline UINT64 MatchMeta(const UINT32 *meta, UINT32 value, UINT32 n)
+{
+    UINT64 mask = 0;
+    UINT32 i = 0;
+
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi32(value);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(meta + i));
+        UINT64 m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, key)));
+        mask |= m << i;
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE4_2__)
+    const __m128i key4 = _mm_set1_epi32(value);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(meta + i));
+        UINT64 m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, key4)));
+        mask |= m << i;
+    }
+#endif
+    for (; i < n; i++)
+        mask |= UINT64(meta[i] == value) << i;
+
+    return mask;
+}
+
+/**
+ * Minimum and maximum of meta[0..n-1], n > 0
+ **/
+static inline UINT32 MinMeta(const UINT32 *meta, UINT32 n)
+{
+    UINT32 min = meta[0];
+    UINT32 i = 0;
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+    if (n >= 4) {
+        __m128i acc = _mm_loadu_si128((const __m128i *)meta);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = _mm_min_epu32(acc, _mm_loadu_si128((const __m128i *)(meta + i)));
+        acc = _mm_min_epu32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_min_epu32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        min = _mm_cvtsi128_si32(acc);
+    }
+#endif
+    for (; i < n; i++)
+        if (meta[i] < min)
+            min = meta[i];
+
+    return min;
+}
+
+static inline UINT32 MaxMeta(const UINT32 *meta, UINT32 n)
+{
+    UINT32 max = meta[0];
+    UINT32 i = 0;
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+    if (n >= 4) {
+        __m128i acc = _mm_loadu_si128((const __m128i *)meta);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = _mm_max_epu32(acc, _mm_loadu_si128((const __m128i *)(meta + i)));
+        acc = _mm_max_epu32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_max_epu32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        max = _mm_cvtsi128_si32(acc);
+    }
+#endif
+    for (; i < n; i++)
+        if (meta[i] > max)
+            max = meta[i];
+
+    return max;
+}
+
+#endif // SIMD_H
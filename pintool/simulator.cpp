@@ -3,18 +3,29 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstddef>   // offsetof
+#include <cstdio>    // snprintf
+#include <vector>
+#include <atomic>
 
 using namespace std;
 
 #include "globals.h"
-#define STORE_ALLOCATION STORE_ALLOCATE
 #include "cache.h"
+#include "stackdist.h"
+#include "mtcache.h"
+#include "config.h"
+#include "sampling.h"
+#include "tlb.h"
+#include "timing.h"
+#include "dram.h"
+#include "intervals.h"
 
 /* ===================================================================== */
 /* Commandline Switches                                                  */
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE,    "pintool",
-    "o", "cslab_cache.out", "specify dcache file name");
+    "o", "cslab_cache.out", "specify dcache file name (file name prefix with -conf)");
 
 // L1Cache
 KNOB<UINT32> KnobL1CacheSize(KNOB_MODE_WRITEONCE, "pintool",
@@ -32,9 +43,180 @@ KNOB<UINT32> KnobL2BlockSize(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<UINT32> KnobL2Associativity(KNOB_MODE_WRITEONCE, "pintool",
     "L2a","8", "L2 cache associativity (1 for direct mapped)");
 
-// Prefetcher (Hardcoded 0, see below)
-//KNOB<UINT32> KnobL2PrefetchLines(KNOB_MODE_WRITEONCE, "pintool",
-//    "L2prf","0", "Number of lines to prefetch to L2 (0 disables prefetching)");
+// L3Cache, below the L2 of every configuration
+KNOB<UINT32> KnobL3CacheSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L3c","0", "L3 cache size in kilobytes (0 for no L3)");
+KNOB<UINT32> KnobL3BlockSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L3b","64", "L3 cache block size in bytes");
+KNOB<UINT32> KnobL3Associativity(KNOB_MODE_WRITEONCE, "pintool",
+    "L3a","16", "L3 cache associativity (1 for direct mapped)");
+KNOB<UINT32> KnobL3Latency(KNOB_MODE_WRITEONCE, "pintool",
+    "L3lat","40", "L3 hit latency in cycles");
+KNOB<BOOL> KnobL3Inclusive(KNOB_MODE_WRITEONCE, "pintool",
+    "L3incl","1", "the L3 is inclusive of the L1 and the L2");
+
+// Replacement policies
+KNOB<string> KnobL1Policy(KNOB_MODE_WRITEONCE, "pintool",
+    "L1pol","SRRIP", "L1 replacement policy (" + PolicyNames() + ")");
+KNOB<string> KnobL2Policy(KNOB_MODE_WRITEONCE, "pintool",
+    "L2pol","SRRIP", "L2 replacement policy (" + PolicyNames() + ")");
+KNOB<string> KnobL3Policy(KNOB_MODE_WRITEONCE, "pintool",
+    "L3pol","SRRIP", "L3 replacement policy (" + PolicyNames() + ")");
+KNOB<UINT32> KnobRRPVBits(KNOB_MODE_WRITEONCE, "pintool",
+    "rrpv","2", "width of the RRIP re-reference prediction values in bits");
+
+// Write and inclusion policies
+KNOB<BOOL> KnobL1WriteThrough(KNOB_MODE_WRITEONCE, "pintool",
+    "L1wt","0", "the L1 is write-through (stores also write the L2) instead of write-back");
+KNOB<BOOL> KnobL1WriteAllocate(KNOB_MODE_WRITEONCE, "pintool",
+    "L1wa","1", "L1 store misses allocate a line");
+KNOB<BOOL> KnobL2WriteThrough(KNOB_MODE_WRITEONCE, "pintool",
+    "L2wt","0", "the L2 is write-through (writes also go below) instead of write-back");
+KNOB<BOOL> KnobL2WriteAllocate(KNOB_MODE_WRITEONCE, "pintool",
+    "L2wa","1", "L2 misses of the stores the L1 does not keep allocate a line");
+KNOB<BOOL> KnobL2Inclusive(KNOB_MODE_WRITEONCE, "pintool",
+    "L2incl","1", "the L2 is inclusive of the L1");
+
+KNOB<UINT32> KnobL2SetSampling(KNOB_MODE_WRITEONCE, "pintool",
+    "L2ss","1", "simulate one in L2ss L2 sets and scale the L2 misses (1 simulates every set)");
+
+// L2 prefetcher
+KNOB<UINT32> KnobL2PrefetchLines(KNOB_MODE_WRITEONCE, "pintool",
+    "L2prf","0", "Number of lines to prefetch to L2 (0 disables prefetching)");
+KNOB<string> KnobL2Prefetcher(KNOB_MODE_WRITEONCE, "pintool",
+    "L2prfkind","next", "L2 prefetcher: next (next -L2prf lines), stride (PC-indexed stride table) "
+                        "or stream (stream training table)");
+
+// Data TLB
+KNOB<BOOL> KnobTlb(KNOB_MODE_WRITEONCE, "pintool",
+    "tlb","0", "translate every reference through a DTLB and an STLB, walking the page table "
+               "through the caches on misses");
+KNOB<UINT32> KnobDtlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+    "dtlbe","64", "DTLB entries");
+KNOB<UINT32> KnobDtlbAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+    "dtlba","4", "DTLB associativity");
+KNOB<UINT32> KnobStlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+    "stlbe","1536", "STLB entries");
+KNOB<UINT32> KnobStlbAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+    "stlba","12", "STLB associativity");
+KNOB<UINT32> KnobStlbLatency(KNOB_MODE_WRITEONCE, "pintool",
+    "stlblat","7", "cycles of an STLB lookup");
+KNOB<UINT32> KnobPageSize(KNOB_MODE_WRITEONCE, "pintool",
+    "page","4", "page size in kilobytes (4 or 2048)");
+
+// Timing
+KNOB<UINT32> KnobL1Latency(KNOB_MODE_WRITEONCE, "pintool",
+    "L1lat","1", "L1 hit latency in cycles");
+KNOB<UINT32> KnobL2Latency(KNOB_MODE_WRITEONCE, "pintool",
+    "L2lat","15", "L2 hit latency in cycles");
+KNOB<UINT32> KnobMemoryLatency(KNOB_MODE_WRITEONCE, "pintool",
+    "memlat","250", "latency of the references that miss the last level cache, in cycles");
+KNOB<BOOL> KnobOoo(KNOB_MODE_WRITEONCE, "pintool",
+    "ooo","0", "derive the cycles from an out-of-order window where independent misses overlap, "
+               "instead of adding up the latencies of all references");
+KNOB<UINT32> KnobRobEntries(KNOB_MODE_WRITEONCE, "pintool",
+    "rob","128", "reorder buffer entries, in instructions (-ooo)");
+KNOB<UINT32> KnobMshrs(KNOB_MODE_WRITEONCE, "pintool",
+    "mshr","10", "L1 miss status holding registers (-ooo)");
+
+// DRAM
+KNOB<BOOL> KnobDram(KNOB_MODE_WRITEONCE, "pintool",
+    "dram","0", "model the DRAM banks, row buffers and channels below the last level cache "
+                "instead of a fixed -memlat (see dram.h)");
+KNOB<UINT32> KnobDramChannels(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_ch","2", "DRAM channels");
+KNOB<UINT32> KnobDramRanks(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_ranks","1", "DRAM ranks per channel");
+KNOB<UINT32> KnobDramBanks(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_banks","16", "DRAM banks per rank");
+KNOB<UINT32> KnobDramRowSize(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_row","8", "DRAM row size in kilobytes");
+KNOB<string> KnobDramMapping(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_map","RoRaBaCoCh", "DRAM address mapping, from the most significant field down: "
+                             "Ro(w), Ra(nk), Ba(nk), Ch(annel) and Co(lumn), row first");
+KNOB<UINT32> KnobDramCas(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_cas","42", "DRAM column access latency (tCAS) in cycles");
+KNOB<UINT32> KnobDramRcd(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_rcd","42", "DRAM row activation latency (tRCD) in cycles");
+KNOB<UINT32> KnobDramRp(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_rp","42", "DRAM precharge latency (tRP) in cycles");
+KNOB<UINT32> KnobDramBurst(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_burst","10", "cycles of the transfer of a line on a DRAM channel");
+KNOB<UINT32> KnobDramController(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_ctl","100", "cycles of the on-chip network and memory controller, both ways");
+KNOB<UINT32> KnobDramWriteQueue(KNOB_MODE_WRITEONCE, "pintool",
+    "dram_wq","32", "entries of the write queue of every DRAM channel");
+
+// Batched instrumentation
+KNOB<BOOL> KnobBatch(KNOB_MODE_WRITEONCE, "pintool",
+    "batch","0", "buffer memory references and simulate them in batches");
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+    "bufpages","1024", "number of 4KB pages in each per-thread reference buffer (batch mode)");
+
+// Multiple configurations in one run
+KNOB<string> KnobConfigs(KNOB_MODE_APPEND, "pintool",
+    "conf","", "extra L2 configuration <size>_<assoc>_<block size>[_<policy>[_<L2 policy>]], "
+               "may be repeated; each one is written to <o>_L2_<policy>_<size>_<assoc>_<block size>.out "
+               "and -L2c/-L2a/-L2b are ignored");
+KNOB<UINT32> KnobWorkers(KNOB_MODE_WRITEONCE, "pintool",
+    "workers","0", "number of threads simulating the configurations (0 simulates in the application threads)");
+KNOB<UINT32> KnobBatchSlots(KNOB_MODE_WRITEONCE, "pintool",
+    "batches","4", "number of full reference buffers that can wait for the worker threads");
+
+// Stack distance mode
+KNOB<BOOL> KnobStackDistance(KNOB_MODE_WRITEONCE, "pintool",
+    "stackdist","0", "simulate every LRU L2 with -L2b byte blocks in one pass; reports are written to "
+                     "<o>_L2_LRU_<size>_<assoc>_<block size>.out");
+KNOB<UINT32> KnobSDMinSets(KNOB_MODE_WRITEONCE, "pintool",
+    "sdminsets","16", "smallest number of L2 sets in stack distance mode");
+KNOB<UINT32> KnobSDMaxSets(KNOB_MODE_WRITEONCE, "pintool",
+    "sdmaxsets","16384", "largest number of L2 sets in stack distance mode");
+KNOB<UINT32> KnobSDMaxAssoc(KNOB_MODE_WRITEONCE, "pintool",
+    "sdmaxassoc","16", "largest L2 associativity in stack distance mode");
+
+// Region of interest
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool",
+    "ff","0", "number of instructions to skip at the start of the region of interest");
+KNOB<UINT64> KnobWarmup(KNOB_MODE_WRITEONCE, "pintool",
+    "warmup","0", "number of instructions simulated after -ff to warm the caches up, without statistics");
+KNOB<UINT64> KnobMeasure(KNOB_MODE_WRITEONCE, "pintool",
+    "measure","0", "number of instructions simulated after the warmup (0 until the end of the region of interest)");
+KNOB<BOOL> KnobRoiMagic(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_magic","0", "the region of interest starts at an xchg %bx,%bx instruction and ends at an "
+                     "xchg %cx,%cx (see roi.h), instead of spanning the whole program");
+KNOB<string> KnobRoiFunc(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_func","", "the region of interest starts when the named function is called and ends when it returns");
+
+// Multithreaded applications
+KNOB<BOOL> KnobMultithreaded(KNOB_MODE_WRITEONCE, "pintool",
+    "mt","0", "give every application thread a private L1, kept coherent with MESI, and share "
+              "the L2 between them; the other modes simulate the threads' references in one L1");
+KNOB<UINT32> KnobStripes(KNOB_MODE_WRITEONCE, "pintool",
+    "stripes","256", "number of locks striped over the shared L2 sets (-mt)");
+
+// Sampled simulation of the measured region
+KNOB<UINT64> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool",
+    "smp_period","0", "simulate one sample of -smp_size instructions in detail every smp_period "
+                      "instructions of the measured region (0 simulates all of it)");
+KNOB<UINT64> KnobSampleSize(KNOB_MODE_WRITEONCE, "pintool",
+    "smp_size","10000", "number of instructions in each sample");
+KNOB<string> KnobSampleWarming(KNOB_MODE_WRITEONCE, "pintool",
+    "smp_warm","functional", "between samples, keep the caches warm without statistics (functional) "
+                             "or fast-forward without simulating (none)");
+
+// Miss attribution profile
+KNOB<BOOL> KnobProfile(KNOB_MODE_WRITEONCE, "pintool",
+    "prof","0", "attribute the L1 and L2 misses to the instructions and data regions, "
+                "in <output>.prof and <output>.prof.csv");
+KNOB<UINT32> KnobProfileTop(KNOB_MODE_WRITEONCE, "pintool",
+    "prof_top","20", "instructions and data regions listed in the miss profile");
+KNOB<UINT32> KnobProfileRegion(KNOB_MODE_WRITEONCE, "pintool",
+    "prof_region","4096", "size of the data regions of the miss profile in bytes");
+
+// Interval time series
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "interval","0", "append the statistics of every interval of this many measured instructions "
+                    "to <output>.intervals.csv (0 disables)");
 
 /* ===================================================================== */
 
@@ -42,24 +224,137 @@ KNOB<UINT32> KnobL2Associativity(KNOB_MODE_WRITEONCE, "pintool",
 /* Global Variables                                                      */
 /* ===================================================================== */
 
-// LRU Policy
-// typedef TWO_LEVEL_CACHE<CACHE_SET::LRU> CACHE_T; // This is where the replacement policy is chosen
+// The replacement policies are chosen at startup (-L1pol/-L2pol). The
+// concrete TWO_LEVEL_CACHE type is only known to the analysis routines
+// below, which are instantiated for every policy pair.
+typedef CACHE_BASE CACHE_T;
 
-// Random Policy
-//typedef TWO_LEVEL_CACHE<CACHE_SET::Random> CACHE_T;
+// A memory reference as recorded in the trace buffer (batch mode only). In
+// ROI mode and with -ooo the buffer also holds instruction counts, in ROI
+// mode ROI end markers, and once filtered, the sample boundaries.
+struct MEMREF
+{
+    ADDRINT addr;  // or the count of a MEMREF_INSTRUCTIONS or MEMREF_SAMPLE_END record
+    ADDRINT pc;    // of the instruction, for the loads and stores only
+    UINT32 type;   // CACHE_T::ACCESS_TYPE or MEMREF_*
+};
+enum {
+    MEMREF_INSTRUCTIONS = CACHE_T::ACCESS_TYPE_NUM, // a basic block was entered
+    MEMREF_ROI_END,                                 // the region of interest ended
+    MEMREF_SAMPLE_BEGIN,
+    MEMREF_SAMPLE_END,                              // after `addr` sampled instructions
+    MEMREF_WARM = 0x8                               // flag of the references between samples
+};
+BUFFER_ID buffer_id;
+
+// Batches are simulated with statistics reset before refs[resetAt], where
+// the warmup ends, or not reset at all
+const UINT64 NO_RESET = ~UINT64(0);
 
-// LFU Policy
-//typedef TWO_LEVEL_CACHE<CACHE_SET::LFU> CACHE_T;
+// With -interval, an interval ends before refs[at] of a batch, after
+// `instructions` measured instructions
+struct INTERVAL_END
+{
+    UINT64 at;
+    UINT64 instructions;
+};
+std::vector<INTERVAL_END> interval_ends;   // of the batch being filtered
+UINT64 next_interval_end;                  // in measured instructions
+
+/**
+ * One simulated cache hierarchy. All configurations see the same reference
+ * stream; only the cycles spent in the memory hierarchy differ.
+ **/
+struct SIM_CONFIG : public CACHE_CONFIG
+{
+    CACHE_T *cache;
+    TLB *tlb;           // NULL without -tlb
+    OOO_TIMING *timing; // NULL without -ooo
+    MISS_PROFILE *profile; // NULL without -prof
+    INTERVAL_STATS *intervals; // NULL without -interval
+    UINT64 cycles;      // memory hierarchy cycles, translation included, without -ooo
+    SAMPLE_STATS samples;
 
-// LIP Policy
-//typedef TWO_LEVEL_CACHE<CACHE_SET::LIP> CACHE_T;
+    // Feeds a batch of references to `cache`, instantiated for its type
+    VOID (*simulate)(SIM_CONFIG *config, const MEMREF *refs, UINT64 num);
+};
+std::vector<SIM_CONFIG> configs;
 
-// SRRIP Policy
-typedef TWO_LEVEL_CACHE<CACHE_SET::SRRIP> CACHE_T;
-CACHE_T *two_level_cache;
+// Analysis routines specialized for the policies of configs[0]
+AFUNPTR load_fn, store_fn;
 
-UINT64 total_cycles, total_instructions;
-std::ofstream outFile;
+// Stack distance mode replaces the configurations with a single engine
+STACK_DISTANCE_BASE *stack_distance;
+VOID (*stack_distance_simulate)(const MEMREF *refs, UINT64 num);
+
+UINT64 total_instructions;   // simulated with statistics
+
+PREFETCHER_KIND l2_prefetcher;  // parsed -L2prfkind
+WRITE_POLICY write_policy;      // -L1wt, -L1wa, -L2wt, -L2wa and -L2incl
+DRAM_PARAMS dram_params;        // -dram_*
+
+// With -ooo, the instruction counts go through the reference buffer, so
+// the timing model sees where the basic blocks start
+BOOL ooo_timing;
+
+// The instruction counts go through the reference buffer: in ROI mode, with
+// -ooo and with -interval
+BOOL buffered_counts;
+
+// Multithreaded mode (-mt) replaces configs[0].cache with a hierarchy of
+// per-thread L1s and a shared L2 with the MESI directory. Every thread keeps its state in a Pin
+// tool register, so the analysis routines get it without a TLS lookup.
+SHARED_L2_CACHE_BASE *shared_cache;
+REG thread_reg;
+
+/**
+ * Region of interest (ROI) control. The phases follow each other in this
+ * order, skipping the empty ones, and each one only inserts its own
+ * instrumentation: the code cache is flushed with PIN_RemoveInstrumentation()
+ * on every change, so the application runs almost natively until the
+ * warmup and after the ROI.
+ **/
+enum ROI_PHASE
+{
+    ROI_WAIT,           // for the ROI start marker or function
+    ROI_FAST_FORWARD,   // -ff instructions, only counted per basic block
+    ROI_WARMUP,         // -warmup instructions, simulated without statistics
+    ROI_MEASURE,        // -measure instructions or until the ROI end
+    ROI_DONE,
+    ROI_SAMPLE_GAP      // alternates with ROI_MEASURE, see below
+};
+BOOL roi_mode;          // any ROI or sampling switch given
+std::atomic<UINT32> roi_phase(ROI_MEASURE);
+INT64 ff_left;          // instructions left to fast-forward, over all threads
+UINT64 warmup_instructions;
+UINT64 measure_instructions; // since the warmup, sampled or not
+ADDRINT roi_func_low, roi_func_high; // code of -roi_func
+
+/**
+ * Sampling (-smp_period): every period of the measure phase starts with a
+ * sample simulated in detail. The rest of the period either only warms the
+ * caches up (functional warming) or is fast-forwarded in the
+ * ROI_SAMPLE_GAP phase, which counts instructions as -ff does.
+ **/
+BOOL sampling;
+BOOL functional_warming;
+BOOL in_sample;
+UINT64 period_instructions;  // since the start of the current period
+UINT64 sample_instructions;  // since the start of the current sample
+
+/**
+ * Miss profile (-prof): the instructions are named after their routine and
+ * the data regions after the section of the image they start in. The
+ * sections are recorded as the images load, since they may be unloaded
+ * by the time Fini writes the profile.
+ **/
+struct IMAGE_SECTION
+{
+    ADDRINT low;
+    ADDRINT high;
+    string name;    // <image>:<section>
+};
+std::vector<IMAGE_SECTION> image_sections;
 
 /* ===================================================================== */
 
@@ -74,30 +369,44 @@ INT32 Usage()
 
 /* ===================================================================== */
 
-VOID Load(ADDRINT addr)
+template <class CACHE, bool TRANSLATE>
+VOID Load(ADDRINT pc, ADDRINT addr)
 {
+    SIM_CONFIG &config = configs[0];
+    CACHE *cache = static_cast<CACHE *>(config.cache);
+
     // get the address translation from Virtual to Physical address space
     // note: only for timing simulation purpose
     // "addr" is virtual and remains unchanged for accessing the cache hierarchy
+    if (TRANSLATE)
+        config.cycles += config.tlb->Translate<true>(addr, *cache);
 
     // load the data from the cache hierarchy
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_LOAD);
+    config.cycles += cache->Access(addr, CACHE_T::ACCESS_TYPE_LOAD, pc);
 }
 
-VOID Store(ADDRINT addr)
+template <class CACHE, bool TRANSLATE>
+VOID Store(ADDRINT pc, ADDRINT addr)
 {
+    SIM_CONFIG &config = configs[0];
+    CACHE *cache = static_cast<CACHE *>(config.cache);
+
     // get the address translation from Virtual to Physical address space
     // note: only for timing simulation purpose
     // "addr" is virtual and remains unchanged for accessing the cache hierarchy
-    
+    if (TRANSLATE)
+        config.cycles += config.tlb->Translate<true>(addr, *cache);
+
     // store the data to the cache hierarchy
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_STORE);
+    config.cycles += cache->Access(addr, CACHE_T::ACCESS_TYPE_STORE, pc);
 }
 
+// Every instruction takes one cycle plus the time of its memory accesses.
+// Single threaded applications only: the multithreaded ones need -mt or
+// one of the buffered modes.
 VOID count_instruction()
 {
     total_instructions++;
-    total_cycles++;
 }
 
 VOID Instruction(INS ins, void * v)
@@ -110,11 +419,11 @@ VOID Instruction(INS ins, void * v)
     // two read operands (such as SCAS and CMPS) are correctly handled.
     for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
         if (INS_MemoryOperandIsRead(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Load,
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, load_fn, IARG_INST_PTR,
                                      IARG_MEMORYOP_EA, memOp, IARG_END);
         }
         if (INS_MemoryOperandIsWritten(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Store,
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, store_fn, IARG_INST_PTR,
                                      IARG_MEMORYOP_EA, memOp, IARG_END);
         }
     }
@@ -123,57 +432,1084 @@ VOID Instruction(INS ins, void * v)
     INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
 }
 
+/* ===================================================================== */
+/* Multithreaded mode: each application thread simulates its references */
+/* in its own L1 and its own counters; only L1 misses synchronize, on    */
+/* the lock of the L2 set stripe.                                        */
 /* ===================================================================== */
 
-VOID Fini(int code, VOID * v)
+template <class CACHE>
+VOID PIN_FAST_ANALYSIS_CALL SharedLoad(ADDRINT thread, ADDRINT addr)
+{
+    SHARED_L2_THREAD *self = reinterpret_cast<SHARED_L2_THREAD *>(thread);
+    self->cycles += static_cast<CACHE *>(shared_cache)->Access(self, addr, CACHE_T::ACCESS_TYPE_LOAD);
+}
+
+template <class CACHE>
+VOID PIN_FAST_ANALYSIS_CALL SharedStore(ADDRINT thread, ADDRINT addr)
+{
+    SHARED_L2_THREAD *self = reinterpret_cast<SHARED_L2_THREAD *>(thread);
+    self->cycles += static_cast<CACHE *>(shared_cache)->Access(self, addr, CACHE_T::ACCESS_TYPE_STORE);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL SharedCountBbl(ADDRINT thread, UINT32 numInstructions)
+{
+    reinterpret_cast<SHARED_L2_THREAD *>(thread)->instructions += numInstructions;
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    PIN_SetContextReg(ctxt, thread_reg, ADDRINT(shared_cache->AddThread(tid)));
+}
+
+VOID SharedTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)SharedCountBbl, IARG_FAST_ANALYSIS_CALL,
+                       IARG_REG_VALUE, thread_reg, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            UINT32 memOperands = INS_MemoryOperandCount(ins);
+
+            for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+                if (INS_MemoryOperandIsRead(ins, memOp)) {
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, load_fn, IARG_FAST_ANALYSIS_CALL,
+                                             IARG_REG_VALUE, thread_reg,
+                                             IARG_MEMORYOP_EA, memOp, IARG_END);
+                }
+                if (INS_MemoryOperandIsWritten(ins, memOp)) {
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, store_fn, IARG_FAST_ANALYSIS_CALL,
+                                             IARG_REG_VALUE, thread_reg,
+                                             IARG_MEMORYOP_EA, memOp, IARG_END);
+                }
+            }
+        }
+    }
+}
+
+/* ===================================================================== */
+/* Batch mode: memory references are appended to a per-thread buffer by  */
+/* inlined Pin code and fed to the cache only when the buffer fills up.  */
+/* ===================================================================== */
+
+VOID PIN_FAST_ANALYSIS_CALL count_bbl(UINT32 numInstructions)
+{
+    total_instructions += numInstructions;
+}
+
+template <class CACHE, bool TRANSLATE>
+VOID SimulateBatch(SIM_CONFIG *config, const MEMREF *refs, UINT64 num)
+{
+    CACHE *cache = static_cast<CACHE *>(config->cache);
+    UINT64 cycles = 0;
+
+    for (UINT64 i = 0; i < num; i++) {
+        if (TRANSLATE)
+            cycles += config->tlb->Translate<true>(refs[i].addr, *cache);
+        cycles += cache->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(refs[i].type), refs[i].pc);
+    }
+
+    config->cycles += cycles;
+}
+
+// -ooo: the latencies go to the timing model instead of being added up
+template <class CACHE, bool TRANSLATE>
+VOID SimulateTimedBatch(SIM_CONFIG *config, const MEMREF *refs, UINT64 num)
+{
+    CACHE *cache = static_cast<CACHE *>(config->cache);
+    OOO_TIMING *timing = config->timing;
+
+    for (UINT64 i = 0; i < num; i++) {
+        const UINT32 type = refs[i].type;
+        if (type == MEMREF_INSTRUCTIONS) {
+            timing->Block(refs[i].addr);
+            continue;
+        }
+        cache->SetClock(timing->Issue());
+        UINT64 latency = 0;
+        if (TRANSLATE)
+            latency += config->tlb->Translate<true>(refs[i].addr, *cache);
+        latency += cache->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(type), refs[i].pc);
+        timing->Access(refs[i].addr, type == CACHE_T::ACCESS_TYPE_STORE, latency);
+    }
+}
+
+// Sampling mode: the references between samples only warm the caches up,
+// and the sample boundaries are recorded in the configuration's statistics
+template <class CACHE, bool TRANSLATE>
+VOID SimulateSampledBatch(SIM_CONFIG *config, const MEMREF *refs, UINT64 num)
+{
+    CACHE *cache = static_cast<CACHE *>(config->cache);
+    UINT64 cycles = 0;
+
+    for (UINT64 i = 0; i < num; i++) {
+        const UINT32 type = refs[i].type;
+        if (type < CACHE_T::ACCESS_TYPE_NUM) {
+            if (TRANSLATE)
+                cycles += config->tlb->Translate<true>(refs[i].addr, *cache);
+            cycles += cache->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(type), refs[i].pc);
+        } else if (type & MEMREF_WARM) {
+            if (TRANSLATE)
+                config->tlb->Translate<false>(refs[i].addr, *cache);
+            cache->Warm(refs[i].addr, CACHE_T::ACCESS_TYPE(type & ~MEMREF_WARM), refs[i].pc);
+        } else {
+            config->cycles += cycles;
+            cycles = 0;
+            if (type == MEMREF_SAMPLE_BEGIN)
+                config->samples.Begin(cache->Stats(), config->cycles);
+            else
+                config->samples.End(cache->Stats(), config->cycles, refs[i].addr);
+        }
+    }
+
+    config->cycles += cycles;
+}
+
+template <class ENGINE>
+VOID StackDistanceBatch(const MEMREF *refs, UINT64 num)
+{
+    ENGINE *engine = static_cast<ENGINE *>(stack_distance);
+
+    for (UINT64 i = 0; i < num; i++)
+        engine->Access(refs[i].addr, CACHE_T::ACCESS_TYPE(refs[i].type));
+}
+
+// Cycles of `config` since its statistics were reset, over `instructions`
+UINT64 ElapsedCycles(const SIM_CONFIG *config, UINT64 instructions)
+{
+    return config->timing ? config->timing->Cycles() : instructions + config->cycles;
+}
+
+// The intervals are simulated piecewise, so the references are not
+// checked for their ends one by one
+VOID SimulateConfig(SIM_CONFIG *config, const MEMREF *refs, UINT64 num, UINT64 resetAt,
+                    const std::vector<INTERVAL_END> &intervalEnds)
+{
+    UINT64 done = 0;
+    if (resetAt <= num) {
+        config->simulate(config, refs, resetAt);
+        config->cache->ResetStats();
+        if (config->tlb)
+            config->tlb->ResetStats();
+        if (config->timing)
+            config->timing->ResetStats();
+        if (config->intervals)
+            config->intervals->Reset();
+        config->cycles = 0;
+        done = resetAt;
+    }
+
+    // Intervals only count measured instructions, all after the reset
+    for (UINT32 i = 0; i < intervalEnds.size(); i++) {
+        config->simulate(config, refs + done, intervalEnds[i].at - done);
+        done = intervalEnds[i].at;
+        config->intervals->End(config->cache->Stats(),
+                               ElapsedCycles(config, intervalEnds[i].instructions),
+                               intervalEnds[i].instructions);
+    }
+    config->simulate(config, refs + done, num - done);
+}
+
+VOID SimulateAll(const MEMREF *refs, UINT64 num, UINT64 resetAt,
+                 const std::vector<INTERVAL_END> &intervalEnds)
+{
+    if (stack_distance) {
+        if (resetAt > num) {
+            stack_distance_simulate(refs, num);
+            return;
+        }
+        stack_distance_simulate(refs, resetAt);
+        stack_distance->ResetStats();
+        stack_distance_simulate(refs + resetAt, num - resetAt);
+        return;
+    }
+
+    for (UINT32 i = 0; i < configs.size(); i++)
+        SimulateConfig(&configs[i], refs, num, resetAt, intervalEnds);
+}
+
+/* ===================================================================== */
+/* Region of interest: before the warmup, only the ROI start or the end  */
+/* of the fast-forward are looked for. From the warmup on, instruction   */
+/* counts and ROI end markers go through the reference buffer, so the    */
+/* phase changes are found in program order when it is simulated.        */
+/* ===================================================================== */
+
+// Phase following `phase`, skipping the empty ones
+UINT32 FollowingPhase(UINT32 phase)
+{
+    phase++;
+    if (phase == ROI_FAST_FORWARD && KnobFastForward.Value() == 0)
+        phase++;
+    if (phase == ROI_WARMUP && KnobWarmup.Value() == 0)
+        phase++;
+    return phase;
+}
+
+// Leaves phase `from` for `to`, unless another thread already left it, and
+// has the code re-instrumented for the new phase
+VOID ChangePhase(UINT32 from, UINT32 to)
+{
+    UINT32 expected = from;
+    if (roi_phase.compare_exchange_strong(expected, to))
+        PIN_RemoveInstrumentation();
+}
+
+VOID RoiBegin()
+{
+    ChangePhase(ROI_WAIT, FollowingPhase(ROI_WAIT));
+}
+
+// The ROI ended before the end of the fast-forward or of a sample gap
+VOID RoiEndEarly()
+{
+    const UINT32 phase = roi_phase.load();
+    if (phase == ROI_FAST_FORWARD || phase == ROI_SAMPLE_GAP)
+        ChangePhase(phase, ROI_DONE);
+}
+
+ADDRINT PIN_FAST_ANALYSIS_CALL FastForward(UINT32 numInstructions)
+{
+    ff_left -= numInstructions;
+    return ff_left <= 0;
+}
+
+VOID EndFastForward()
+{
+    const UINT32 phase = roi_phase.load();
+    if (phase == ROI_FAST_FORWARD)
+        ChangePhase(phase, FollowingPhase(phase));
+    else if (phase == ROI_SAMPLE_GAP)
+        ChangePhase(phase, ROI_MEASURE);
+}
+
+// Closes the current sample, if any, with a record of its length
+VOID EndSample(MEMREF *refs, UINT64 *kept)
+{
+    if (!in_sample)
+        return;
+    refs[*kept].addr = sample_instructions;
+    refs[*kept].type = MEMREF_SAMPLE_END;
+    (*kept)++;
+    in_sample = false;
+}
+
+// Follows the sampling periods over a basic block of the measure phase.
+// A basic block belongs to the sample it starts in.
+VOID SampleBlock(MEMREF *refs, UINT64 *kept, UINT64 numInstructions)
+{
+    if (period_instructions >= KnobSamplePeriod.Value())
+        period_instructions = 0;
+
+    const BOOL sample = period_instructions < KnobSampleSize.Value();
+    if (sample && !in_sample) {
+        refs[*kept].addr = 0;
+        refs[*kept].type = MEMREF_SAMPLE_BEGIN;
+        (*kept)++;
+        in_sample = true;
+        sample_instructions = 0;
+    } else if (!sample) {
+        EndSample(refs, kept);
+    }
+
+    period_instructions += numInstructions;
+    if (sample) {
+        sample_instructions += numInstructions;
+        total_instructions += numInstructions;
+    }
+}
+
+/**
+ * Follows the warmup and measure phases through the records of a full
+ * buffer and compacts it to the memory references to simulate, with the
+ * sample boundaries in sampling mode and the instruction counts with -ooo. Returns their number, and in
+ * `resetAt` where the warmup ended, if it did, and in interval_ends where
+ * the intervals of -interval ended. Called with batch_lock held.
+ **/
+UINT64 FilterRoi(MEMREF *refs, UINT64 num, UINT64 *resetAt)
+{
+    UINT64 kept = 0;
+    *resetAt = NO_RESET;
+
+    for (UINT64 i = 0; i < num; i++) {
+        const UINT32 phase = roi_phase.load();
+        if (phase != ROI_WARMUP && phase != ROI_MEASURE)
+            break;
+
+        // Phases end with the last basic block they hold entirely
+        if (refs[i].type == MEMREF_INSTRUCTIONS) {
+            const UINT64 numInstructions = refs[i].addr;
+            if (phase == ROI_WARMUP) {
+                if (warmup_instructions + numInstructions <= KnobWarmup.Value()) {
+                    warmup_instructions += numInstructions;
+                    if (ooo_timing)
+                        refs[kept++] = refs[i];
+                    continue;
+                }
+                roi_phase.store(ROI_MEASURE);
+                *resetAt = kept;
+            }
+            if (KnobMeasure.Value() && measure_instructions + numInstructions > KnobMeasure.Value()) {
+                EndSample(refs, &kept);
+                ChangePhase(ROI_MEASURE, ROI_DONE);
+                break;
+            }
+            measure_instructions += numInstructions;
+            if (sampling) {
+                SampleBlock(refs, &kept, numInstructions);
+            } else {
+                // An interval ends before the first basic block past it
+                if (KnobInterval.Value() && total_instructions >= next_interval_end) {
+                    INTERVAL_END end = { kept, total_instructions };
+                    interval_ends.push_back(end);
+                    next_interval_end = total_instructions + KnobInterval.Value();
+                }
+                total_instructions += numInstructions;
+            }
+            if (ooo_timing)
+                refs[kept++] = refs[i];
+        } else if (refs[i].type == MEMREF_ROI_END) {
+            // Nothing measured if the ROI ends during the warmup
+            if (phase == ROI_WARMUP)
+                *resetAt = kept;
+            EndSample(refs, &kept);
+            ChangePhase(phase, ROI_DONE);
+            break;
+        } else if (!sampling || in_sample) {
+            refs[kept++] = refs[i];
+        } else if (functional_warming) {
+            refs[kept] = refs[i];
+            refs[kept++].type |= MEMREF_WARM;
+        }
+    }
+
+    // Without warming, the rest of the period after a sample is skipped.
+    // The buffer was filled ahead of this point, so its end is already
+    // part of the gap.
+    if (sampling && !functional_warming && !in_sample &&
+        period_instructions >= KnobSampleSize.Value() && roi_phase.load() == ROI_MEASURE) {
+        const UINT64 gap = KnobSamplePeriod.Value() - std::min(period_instructions, KnobSamplePeriod.Value());
+        period_instructions = 0;
+        if (gap > 0) {
+            ff_left = gap;
+            measure_instructions += gap;
+            ChangePhase(ROI_MEASURE, ROI_SAMPLE_GAP);
+        }
+    }
+
+    return kept;
+}
+
+// xchg %reg,%reg, a no-op used as a marker
+BOOL IsMagic(INS ins, REG reg)
+{
+    return INS_IsXchg(ins) && INS_OperandCount(ins) >= 2 &&
+           INS_OperandIsReg(ins, 0) && INS_OperandReg(ins, 0) == reg &&
+           INS_OperandIsReg(ins, 1) && INS_OperandReg(ins, 1) == reg;
+}
+
+BOOL IsRoiBegin(INS ins)
+{
+    return (KnobRoiMagic.Value() && IsMagic(ins, REG_BX)) ||
+           (roi_func_low && INS_Address(ins) == roi_func_low);
+}
+
+// Returns from -roi_func are taken as the end of the ROI, so a recursive
+// function ends it at its innermost call
+BOOL IsRoiEnd(INS ins)
+{
+    return (KnobRoiMagic.Value() && IsMagic(ins, REG_CX)) ||
+           (roi_func_low && INS_IsRet(ins) &&
+            INS_Address(ins) >= roi_func_low && INS_Address(ins) < roi_func_high);
+}
+
+VOID InstrumentRoiBegin(TRACE trace)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            if (IsRoiBegin(ins))
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RoiBegin, IARG_END);
+}
+
+VOID InstrumentFastForward(TRACE trace)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_FAST_ANALYSIS_CALL,
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)EndFastForward, IARG_END);
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            if (IsRoiEnd(ins))
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RoiEndEarly, IARG_END);
+    }
+}
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if (!KnobRoiFunc.Value().empty()) {
+        RTN rtn = RTN_FindByName(img, KnobRoiFunc.Value().c_str());
+        if (RTN_Valid(rtn) && !roi_func_low) {
+            roi_func_low = RTN_Address(rtn);
+            roi_func_high = roi_func_low + RTN_Size(rtn);
+        }
+    }
+
+    if (KnobProfile.Value()) {
+        string image = IMG_Name(img);
+        image = image.substr(image.find_last_of('/') + 1);
+        for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec)) {
+            if (!SEC_Mapped(sec) || SEC_Size(sec) == 0)
+                continue;
+            IMAGE_SECTION section = { SEC_Address(sec), SEC_Address(sec) + SEC_Size(sec),
+                                      image + ":" + SEC_Name(sec) };
+            image_sections.push_back(section);
+        }
+    }
+}
+
+// The image section `addr` is in, "" if none (heap, stack, ...)
+string RegionSymbol(ADDRINT addr)
+{
+    for (UINT32 i = 0; i < image_sections.size(); i++)
+        if (addr >= image_sections[i].low && addr < image_sections[i].high)
+            return image_sections[i].name;
+    return "";
+}
+
+// The routine of the instruction at `pc`, else its image section
+string PcSymbol(ADDRINT pc)
+{
+    PIN_LockClient();
+    const string name = RTN_FindNameByAddress(pc);
+    PIN_UnlockClient();
+    return name.empty() ? RegionSymbol(pc) : name;
+}
+
+/* ===================================================================== */
+/* Worker threads: full buffers are queued in a ring of batch slots and  */
+/* every worker simulates its own share of the configurations on each    */
+/* batch, in order. The application thread gets a recycled buffer back   */
+/* and keeps running while the batch is being simulated.                 */
+/* ===================================================================== */
+
+struct BATCH_SLOT
+{
+    MEMREF *refs;
+    UINT64 num;
+    UINT64 resetAt;
+    std::vector<INTERVAL_END> intervalEnds;
+    std::atomic<UINT32> pending; // workers that have not simulated it yet
+};
+
+struct WORKER
+{
+    std::vector<SIM_CONFIG *> configs;
+    std::atomic<UINT64> done;    // batches simulated so far
+    PIN_THREAD_UID uid;
+};
+
+BATCH_SLOT *batch_slots;
+UINT32 num_batch_slots;
+std::vector<WORKER *> workers;
+std::atomic<UINT64> batches_published(0);
+std::atomic<bool> stop_workers(false);
+PIN_LOCK batch_lock; // serializes the application threads handing over batches
+
+VOID WorkerMain(VOID *arg)
+{
+    WORKER *worker = static_cast<WORKER *>(arg);
+    UINT64 seq = 0;
+
+    while (true) {
+        // Everything published before the stop request is still simulated
+        const bool stopping = stop_workers.load(std::memory_order_acquire);
+        if (seq == batches_published.load(std::memory_order_acquire)) {
+            if (stopping)
+                break;
+            PIN_Yield();
+            continue;
+        }
+
+        BATCH_SLOT &slot = batch_slots[seq % num_batch_slots];
+        for (UINT32 i = 0; i < worker->configs.size(); i++)
+            SimulateConfig(worker->configs[i], slot.refs, slot.num, slot.resetAt, slot.intervalEnds);
+        slot.pending.fetch_sub(1, std::memory_order_release);
+        worker->done.store(++seq, std::memory_order_release);
+    }
+}
+
+// Queues a full buffer for the workers and returns the buffer the
+// application thread should fill next. Called with batch_lock held.
+VOID * PublishBatch(MEMREF *refs, UINT64 num, UINT64 resetAt)
+{
+    const UINT64 seq = batches_published.load(std::memory_order_relaxed);
+    BATCH_SLOT &slot = batch_slots[seq % num_batch_slots];
+
+    // The slot is free once every worker is done with its previous batch
+    while (slot.pending.load(std::memory_order_acquire) != 0)
+        PIN_Yield();
+
+    VOID *next = slot.refs ? slot.refs : PIN_AllocateBuffer(buffer_id);
+    slot.refs = refs;
+    slot.num = num;
+    slot.resetAt = resetAt;
+    slot.intervalEnds.swap(interval_ends);
+    slot.pending.store(workers.size(), std::memory_order_relaxed);
+    batches_published.store(seq + 1, std::memory_order_release);
+    return next;
+}
+
+VOID WaitForWorkers()
+{
+    const UINT64 published = batches_published.load(std::memory_order_acquire);
+    for (UINT32 i = 0; i < workers.size(); i++)
+        while (workers[i]->done.load(std::memory_order_acquire) < published)
+            PIN_Yield();
+}
+
+VOID * BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf,
+                  UINT64 numElements, VOID *v)
 {
-    // Report total instructions and total cycles
-    outFile << "--------\n";
-    outFile << "Total Statistics\n";
-    outFile << "--------\n";
-    outFile << "Total Instructions: " << total_instructions << "\n";
-    outFile << "Total Cycles: " << total_cycles << "\n";
-    outFile << "IPC: " << (double)total_instructions / (double)total_cycles << "\n";
-    outFile << "\n";
+    MEMREF *refs = static_cast<MEMREF *>(buf);
+    VOID *next = buf;
+    UINT64 resetAt = NO_RESET;
 
-    outFile << two_level_cache->PrintCache("");
-    outFile << two_level_cache->StatsLong("");
+    PIN_GetLock(&batch_lock, tid + 1);
+    interval_ends.clear();
+    if (buffered_counts)
+        numElements = FilterRoi(refs, numElements, &resetAt);
 
-    outFile.close();
+    if (workers.empty()) {
+        SimulateAll(refs, numElements, resetAt, interval_ends);
+    } else if (stop_workers.load()) {
+        // Buffers flushed at exit, after the workers were told to stop
+        WaitForWorkers();
+        SimulateAll(refs, numElements, resetAt, interval_ends);
+    } else {
+        next = PublishBatch(refs, numElements, resetAt);
+    }
+    PIN_ReleaseLock(&batch_lock);
+
+    return next;
+}
+
+BOOL StartWorkers(UINT32 numWorkers)
+{
+    num_batch_slots = KnobBatchSlots.Value() > 0 ? KnobBatchSlots.Value() : 1;
+    batch_slots = new BATCH_SLOT[num_batch_slots];
+    for (UINT32 i = 0; i < num_batch_slots; i++) {
+        batch_slots[i].refs = NULL;
+        batch_slots[i].num = 0;
+        batch_slots[i].resetAt = NO_RESET;
+        batch_slots[i].pending = 0;
+    }
+
+    // Configurations are dealt out round-robin
+    for (UINT32 i = 0; i < numWorkers && i < configs.size(); i++) {
+        workers.push_back(new WORKER);
+        workers.back()->done = 0;
+    }
+    for (UINT32 i = 0; i < configs.size(); i++)
+        workers[i % workers.size()]->configs.push_back(&configs[i]);
+
+    for (UINT32 i = 0; i < workers.size(); i++)
+        if (PIN_SpawnInternalThread(WorkerMain, workers[i], 0, &workers[i]->uid) == INVALID_THREADID)
+            return false;
+    return true;
 }
 
-VOID roi_begin()
+// Internal threads have to be gone before Fini runs
+VOID PrepareForFini(VOID *v)
 {
-    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_GetLock(&batch_lock, PIN_ThreadId() + 1);
+    stop_workers.store(true, std::memory_order_release);
+    PIN_ReleaseLock(&batch_lock);
+
+    for (UINT32 i = 0; i < workers.size(); i++)
+        PIN_WaitForThreadTermination(workers[i]->uid, PIN_INFINITE_TIMEOUT, NULL);
 }
 
+VOID Trace(TRACE trace, VOID * v)
+{
+    switch (roi_phase.load()) {
+      case ROI_WAIT:
+        InstrumentRoiBegin(trace);
+        return;
+      case ROI_FAST_FORWARD:
+      case ROI_SAMPLE_GAP:
+        InstrumentFastForward(trace);
+        return;
+      case ROI_DONE:
+        return;
+      default:
+        break;
+    }
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        // Count instructions once per basic block
+        if (buffered_counts) {
+            INS_InsertFillBuffer(BBL_InsHead(bbl), IPOINT_BEFORE, buffer_id,
+                IARG_ADDRINT, ADDRINT(BBL_NumIns(bbl)), offsetof(MEMREF, addr),
+                IARG_UINT32, MEMREF_INSTRUCTIONS, offsetof(MEMREF, type),
+                IARG_END);
+        } else {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_bbl, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        }
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            UINT32 memOperands = INS_MemoryOperandCount(ins);
+
+            // Same operand order as Instruction(), so the cache sees the
+            // exact same reference stream.
+            for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+                if (INS_MemoryOperandIsRead(ins, memOp)) {
+                    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, buffer_id,
+                        IARG_MEMORYOP_EA, memOp, offsetof(MEMREF, addr),
+                        IARG_INST_PTR, offsetof(MEMREF, pc),
+                        IARG_UINT32, CACHE_T::ACCESS_TYPE_LOAD, offsetof(MEMREF, type),
+                        IARG_END);
+                }
+                if (INS_MemoryOperandIsWritten(ins, memOp)) {
+                    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, buffer_id,
+                        IARG_MEMORYOP_EA, memOp, offsetof(MEMREF, addr),
+                        IARG_INST_PTR, offsetof(MEMREF, pc),
+                        IARG_UINT32, CACHE_T::ACCESS_TYPE_STORE, offsetof(MEMREF, type),
+                        IARG_END);
+                }
+            }
+
+            if (roi_mode && IsRoiEnd(ins)) {
+                INS_InsertFillBuffer(ins, IPOINT_BEFORE, buffer_id,
+                    IARG_ADDRINT, ADDRINT(0), offsetof(MEMREF, addr),
+                    IARG_UINT32, MEMREF_ROI_END, offsetof(MEMREF, type),
+                    IARG_END);
+            }
+        }
+    }
+}
+
+/* ===================================================================== */
+
+/**
+ * Creates the cache hierarchy of `config` for its policies and selects the
+ * analysis routines instantiated for it.
+ **/
+struct CACHE_BUILDER
+{
+    SIM_CONFIG *config;
+
+    template <class L1SET, class L2SET>
+    VOID Visit()
+    {
+        if (KnobMultithreaded.Value()) {
+            VisitShared<L1SET, L2SET>();
+            return;
+        }
+
+        typedef TWO_LEVEL_CACHE<L1SET, L2SET> CACHE;
+
+        CACHE *cache = new CACHE("Two level Cache hierarchy",
+                                 KnobL1CacheSize.Value() * KILO,
+                                 KnobL1BlockSize.Value(),
+                                 KnobL1Associativity.Value(),
+                                 config->l2Size * KILO,
+                                 config->l2BlockSize,
+                                 config->l2Associativity,
+                                 KnobL2PrefetchLines.Value(),
+                                 l2_prefetcher,
+                                 KnobL2SetSampling.Value(),
+                                 write_policy,
+                                 KnobL1Latency.Value(),
+                                 KnobL2Latency.Value(),
+                                 KnobMemoryLatency.Value());
+        LOWER_LEVEL_BASE *memory = !KnobDram.Value() ? NULL :
+            new DRAM(dram_params, KnobL3CacheSize.Value() ? KnobL3BlockSize.Value() : config->l2BlockSize);
+        if (KnobL3CacheSize.Value())
+            cache->SetLowerLevels(MakeCacheLevel(KnobL3Policy.Value(), "L3",
+                                                 KnobL3CacheSize.Value() * KILO,
+                                                 KnobL3BlockSize.Value(),
+                                                 KnobL3Associativity.Value(),
+                                                 KnobL3Latency.Value(),
+                                                 cache->MemoryLatency(),
+                                                 KnobL3Inclusive.Value(),
+                                                 memory));
+        else if (memory)
+            cache->SetLowerLevels(memory);
+        config->cache = cache;
+        if (config->profile)
+            cache->SetProfile(config->profile);
+        if (config->tlb)
+            Select<CACHE, true>();
+        else
+            Select<CACHE, false>();
+    }
+
+    // The routines simulating `config`, translating the addresses or not
+    template <class CACHE, bool TRANSLATE>
+    VOID Select()
+    {
+        config->simulate = sampling ? SimulateSampledBatch<CACHE, TRANSLATE> :
+                           config->timing ? SimulateTimedBatch<CACHE, TRANSLATE> :
+                                            SimulateBatch<CACHE, TRANSLATE>;
+        load_fn = (AFUNPTR)Load<CACHE, TRANSLATE>;
+        store_fn = (AFUNPTR)Store<CACHE, TRANSLATE>;
+    }
+
+    template <class L1SET, class L2SET>
+    VOID VisitShared()
+    {
+        typedef SHARED_L2_CACHE<L1SET, L2SET> CACHE;
+
+        shared_cache = new CACHE("Shared L2 Cache hierarchy",
+                                 KnobL1CacheSize.Value() * KILO,
+                                 KnobL1BlockSize.Value(),
+                                 KnobL1Associativity.Value(),
+                                 config->l2Size * KILO,
+                                 config->l2BlockSize,
+                                 config->l2Associativity,
+                                 KnobStripes.Value(),
+                                 write_policy.l1WriteAllocate,
+                                 KnobL1Latency.Value(),
+                                 KnobL2Latency.Value(),
+                                 KnobMemoryLatency.Value());
+        config->cache = shared_cache;
+        load_fn = (AFUNPTR)SharedLoad<CACHE>;
+        store_fn = (AFUNPTR)SharedStore<CACHE>;
+    }
+};
+
+/**
+ * Creates the stack distance engine for the L1 policy named by -L1pol
+ **/
+struct STACK_DISTANCE_BUILDER
+{
+    template <class L1SET>
+    VOID Visit()
+    {
+        typedef STACK_DISTANCE<L1SET> ENGINE;
+
+        stack_distance = new ENGINE(KnobL1CacheSize.Value() * KILO,
+                                    KnobL1BlockSize.Value(),
+                                    KnobL1Associativity.Value(),
+                                    KnobL2BlockSize.Value(),
+                                    KnobSDMinSets.Value(),
+                                    KnobSDMaxSets.Value(),
+                                    KnobSDMaxAssoc.Value(),
+                                    write_policy.l1WriteAllocate);
+        stack_distance_simulate = StackDistanceBatch<ENGINE>;
+    }
+};
+
+/* ===================================================================== */
+
+VOID Fini(int code, VOID * v)
+{
+    if (shared_cache) {
+        WriteReport(configs[0].outFileName, *shared_cache, shared_cache->Instructions(),
+                    shared_cache->MemoryCycles(), shared_cache->ThreadReport());
+        return;
+    }
+
+    if (stack_distance) {
+        stack_distance->Report(KnobOutputFile.Value(), total_instructions);
+        return;
+    }
+
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        string appendix;
+        UINT64 memoryCycles = configs[i].cycles;
+        if (configs[i].tlb)
+            appendix += configs[i].tlb->Report(total_instructions);
+        if (configs[i].timing) {
+            configs[i].timing->Drain();
+            memoryCycles = configs[i].timing->MemoryCycles(total_instructions);
+            appendix += configs[i].timing->Report();
+        }
+        // The last interval, however short
+        if (configs[i].intervals)
+            configs[i].intervals->End(configs[i].cache->Stats(),
+                                      ElapsedCycles(&configs[i], total_instructions), total_instructions);
+        if (sampling)
+            appendix += configs[i].samples.Report(KnobSamplePeriod.Value(), KnobSampleSize.Value(),
+                                                  measure_instructions);
+        WriteReport(configs[i].outFileName, *configs[i].cache,
+                    total_instructions, memoryCycles, appendix);
+        if (configs[i].profile)
+            configs[i].profile->Write(configs[i].outFileName + ".prof", KnobProfileTop.Value(),
+                                      total_instructions, PcSymbol, RegionSymbol);
+    }
+}
 
 /* ===================================================================== */
 
 int main(int argc, char *argv[])
 {
     PIN_InitSymbols();
-    
-    std::srand(21089); // Seed for random number generation
 
     if(PIN_Init(argc,argv))
         return Usage();
 
-    // Open output file
-    outFile.open(KnobOutputFile.Value().c_str());
-
-   // Initialize two level Cache
-    two_level_cache = new CACHE_T("Two level Cache hierarchy",
-                                  KnobL1CacheSize.Value() * KILO,
-                                  KnobL1BlockSize.Value(),
-                                  KnobL1Associativity.Value(),
-                                  KnobL2CacheSize.Value() * KILO,
-                                  KnobL2BlockSize.Value(),
-                                  KnobL2Associativity.Value(),
-				  0);
-				  //KnobL2PrefetchLines.Value()); (I don't want prefetching at all in this run, so hardcode 0)
-
-    INS_AddInstrumentFunction(Instruction, 0);
+    CACHE_SET::SRRIP::RRPVBits = KnobRRPVBits.Value();
+
+    if (!ParsePrefetcher(KnobL2Prefetcher.Value(), l2_prefetcher)) {
+        cerr << "Error: unknown L2 prefetcher " << KnobL2Prefetcher.Value() << endl;
+        return Usage();
+    }
+    if (KnobL2PrefetchLines.Value() > L2_PREFETCHER::MAX_DEGREE) {
+        cerr << "Error: -L2prf is at most " << L2_PREFETCHER::MAX_DEGREE << endl;
+        return Usage();
+    }
+    if (KnobL2PrefetchLines.Value() && (KnobStackDistance.Value() || KnobMultithreaded.Value())) {
+        cerr << "Error: L2 prefetching is not supported in stack distance and -mt modes" << endl;
+        return Usage();
+    }
+
+    write_policy.l1WriteThrough = KnobL1WriteThrough.Value();
+    write_policy.l1WriteAllocate = KnobL1WriteAllocate.Value();
+    write_policy.l2WriteThrough = KnobL2WriteThrough.Value();
+    write_policy.l2WriteAllocate = KnobL2WriteAllocate.Value();
+    write_policy.l2Inclusive = KnobL2Inclusive.Value();
+    if ((KnobStackDistance.Value() || KnobMultithreaded.Value()) &&
+        (write_policy.l1WriteThrough || write_policy.l2WriteThrough || !write_policy.l2WriteAllocate)) {
+        cerr << "Error: stack distance and -mt modes only simulate write-back caches, "
+                "and L2s that allocate every miss" << endl;
+        return Usage();
+    }
+    if (KnobMultithreaded.Value() && !write_policy.l2Inclusive) {
+        cerr << "Error: the shared L2 of -mt is always inclusive" << endl;
+        return Usage();
+    }
+
+    if (KnobL3CacheSize.Value()) {
+        if (!IsPolicyName(KnobL3Policy.Value())) {
+            cerr << "Error: unknown L3 replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+        if (KnobL2SetSampling.Value() > 1 || KnobStackDistance.Value() || KnobMultithreaded.Value()) {
+            cerr << "Error: an L3 is not supported with -L2ss, in stack distance and -mt modes" << endl;
+            return Usage();
+        }
+    }
+
+    if (KnobDram.Value()) {
+        dram_params.channels = KnobDramChannels.Value();
+        dram_params.ranks = KnobDramRanks.Value();
+        dram_params.banks = KnobDramBanks.Value();
+        dram_params.rowSize = KnobDramRowSize.Value() * KILO;
+        dram_params.mapping = KnobDramMapping.Value();
+        dram_params.tCAS = KnobDramCas.Value();
+        dram_params.tRCD = KnobDramRcd.Value();
+        dram_params.tRP = KnobDramRp.Value();
+        dram_params.tBurst = KnobDramBurst.Value();
+        dram_params.controllerLatency = KnobDramController.Value();
+        dram_params.writeQueue = KnobDramWriteQueue.Value();
+        if (KnobL2SetSampling.Value() > 1 || KnobStackDistance.Value() || KnobMultithreaded.Value()) {
+            cerr << "Error: -dram is not supported with -L2ss, in stack distance and -mt modes" << endl;
+            return Usage();
+        }
+    }
+
+    if (KnobTlb.Value()) {
+        if (!TLB::ValidGeometry(KnobDtlbEntries.Value(), KnobDtlbAssociativity.Value()) ||
+            !TLB::ValidGeometry(KnobStlbEntries.Value(), KnobStlbAssociativity.Value())) {
+            cerr << "Error: TLB entries must be a power of 2 sets of -dtlba/-stlba ways" << endl;
+            return Usage();
+        }
+        if (KnobPageSize.Value() != 4 && KnobPageSize.Value() != 2048) {
+            cerr << "Error: -page must be 4 or 2048" << endl;
+            return Usage();
+        }
+        if (KnobStackDistance.Value() || KnobMultithreaded.Value()) {
+            cerr << "Error: -tlb is not supported in stack distance and -mt modes" << endl;
+            return Usage();
+        }
+    }
+
+    ooo_timing = KnobOoo.Value();
+    if (ooo_timing) {
+        if (KnobRobEntries.Value() == 0 || KnobMshrs.Value() == 0) {
+            cerr << "Error: -rob and -mshr must be at least 1" << endl;
+            return Usage();
+        }
+        if (KnobStackDistance.Value() || KnobMultithreaded.Value() || KnobSamplePeriod.Value()) {
+            cerr << "Error: -ooo is not supported in stack distance, -mt and sampling modes" << endl;
+            return Usage();
+        }
+    }
+
+    sampling = KnobSamplePeriod.Value() > 0;
+    if (sampling) {
+        if (KnobSampleSize.Value() == 0 || KnobSampleSize.Value() > KnobSamplePeriod.Value()) {
+            cerr << "Error: -smp_size must be between 1 and -smp_period" << endl;
+            return Usage();
+        }
+        if (KnobSampleWarming.Value() != "functional" && KnobSampleWarming.Value() != "none") {
+            cerr << "Error: unknown warming " << KnobSampleWarming.Value() << endl;
+            return Usage();
+        }
+        if (KnobStackDistance.Value()) {
+            cerr << "Error: sampling is not supported in stack distance mode" << endl;
+            return Usage();
+        }
+        functional_warming = KnobSampleWarming.Value() == "functional";
+    }
+
+    if (KnobProfile.Value()) {
+        if (KnobProfileRegion.Value() == 0 || !IsPowerOf2(KnobProfileRegion.Value())) {
+            cerr << "Error: -prof_region must be a power of 2" << endl;
+            return Usage();
+        }
+        if (KnobL2SetSampling.Value() > 1 || KnobStackDistance.Value() || KnobMultithreaded.Value()) {
+            cerr << "Error: -prof is not supported with -L2ss, in stack distance and -mt modes" << endl;
+            return Usage();
+        }
+    }
+
+    // Samples have statistics of their own
+    if (KnobInterval.Value() && (KnobStackDistance.Value() || KnobMultithreaded.Value() || sampling)) {
+        cerr << "Error: -interval is not supported in stack distance, -mt and sampling modes" << endl;
+        return Usage();
+    }
+    next_interval_end = KnobInterval.Value();
+
+    // Configurations to simulate: either the ones given with -conf or the
+    // single one described by the -L2* knobs, unless the stack distance
+    // engine covers all of them
+    std::vector<string> specs;
+    for (UINT32 i = 0; i < KnobConfigs.NumberOfValues(); i++)
+        if (!KnobConfigs.Value(i).empty())
+            specs.push_back(KnobConfigs.Value(i));
+
+    if (KnobStackDistance.Value()) {
+        STACK_DISTANCE_BUILDER builder;
+        if (PolicyUsesPC(KnobL1Policy.Value())) {
+            cerr << "Error: the stack distance mode does not support PC based policies" << endl;
+            return Usage();
+        }
+        if (!DispatchPolicy(KnobL1Policy.Value(), builder)) {
+            cerr << "Error: unknown replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+        specs.clear();
+    }
+
+    configs.resize(stack_distance ? 0 : specs.empty() ? 1 : specs.size());
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        SIM_CONFIG &config = configs[i];
+        if (specs.empty()) {
+            config.l2Size = KnobL2CacheSize.Value();
+            config.l2Associativity = KnobL2Associativity.Value();
+            config.l2BlockSize = KnobL2BlockSize.Value();
+            config.l1Policy = KnobL1Policy.Value();
+            config.l2Policy = KnobL2Policy.Value();
+            config.outFileName = KnobOutputFile.Value();
+        } else if (!ParseConfig(specs[i], KnobL1Policy.Value(), KnobL2Policy.Value(),
+                                KnobOutputFile.Value(), config)) {
+            cerr << "Error: bad cache configuration " << specs[i] << endl;
+            return Usage();
+        }
+        config.cycles = 0;
+        if (KnobL3CacheSize.Value() && KnobL3BlockSize.Value() < config.l2BlockSize) {
+            cerr << "Error: the L3 blocks must be at least as large as the L2 ones" << endl;
+            return Usage();
+        }
+        if (KnobDram.Value() &&
+            !DRAM::ValidParams(dram_params, KnobL3CacheSize.Value() ? KnobL3BlockSize.Value() : config.l2BlockSize)) {
+            cerr << "Error: DRAM channels, ranks, banks and rows must be powers of 2, rows at least "
+                    "a cache block, and -dram_map a permutation of Ro, Ra, Ba, Ch and Co, row first" << endl;
+            return Usage();
+        }
+        config.tlb = !KnobTlb.Value() ? NULL :
+            new TLB(KnobDtlbEntries.Value(), KnobDtlbAssociativity.Value(),
+                    KnobStlbEntries.Value(), KnobStlbAssociativity.Value(),
+                    KnobPageSize.Value() * KILO, KnobStlbLatency.Value());
+        config.timing = !ooo_timing ? NULL :
+            new OOO_TIMING(KnobRobEntries.Value(), KnobMshrs.Value(),
+                           KnobL1BlockSize.Value(), KnobL1Latency.Value());
+        config.profile = !KnobProfile.Value() ? NULL : new MISS_PROFILE(KnobProfileRegion.Value());
+        config.intervals = !KnobInterval.Value() ? NULL :
+            new INTERVAL_STATS(config.outFileName + ".intervals.csv");
+        if (config.intervals && !config.intervals->Good()) {
+            cerr << "Error: cannot write " << config.outFileName << ".intervals.csv" << endl;
+            return 1;
+        }
+
+        if (PolicyUsesNextUse(config.l1Policy) || PolicyUsesNextUse(config.l2Policy) ||
+            (KnobL3CacheSize.Value() && PolicyUsesNextUse(KnobL3Policy.Value()))) {
+            cerr << "Error: OPT needs the future references, record a trace with the tracer "
+                    "and replay it" << endl;
+            return Usage();
+        }
+
+        // Initialize two level Cache
+        CACHE_BUILDER builder;
+        builder.config = &config;
+        if (!DispatchPolicies(config.l1Policy, config.l2Policy, builder)) {
+            cerr << "Error: unknown replacement policy, valid policies are: "
+                 << PolicyNames() << endl;
+            return Usage();
+        }
+    }
+
+    // Without a start marker or function, the ROI starts with the program
+    roi_mode = KnobFastForward.Value() || KnobWarmup.Value() || KnobMeasure.Value() ||
+               KnobRoiMagic.Value() || !KnobRoiFunc.Value().empty() || sampling;
+    if (roi_mode) {
+        ff_left = KnobFastForward.Value();
+        if (KnobRoiMagic.Value() || !KnobRoiFunc.Value().empty())
+            roi_phase = ROI_WAIT;
+        else
+            roi_phase = FollowingPhase(ROI_WAIT);
+    }
+    if (!KnobRoiFunc.Value().empty() || KnobProfile.Value())
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+    buffered_counts = roi_mode || ooo_timing || KnobInterval.Value();
+
+    if (KnobMultithreaded.Value()) {
+        if (KnobBatch.Value() || configs.size() != 1 || KnobWorkers.Value() > 0 || roi_mode) {
+            cerr << "Error: -mt simulates one configuration, without batches, workers, "
+                    "stack distances, ROI or sampling" << endl;
+            return Usage();
+        }
+        // The shared L2 neither gets the PCs nor serializes its hits
+        if (PolicyUsesPC(configs[0].l1Policy) || PolicyUsesPC(configs[0].l2Policy)) {
+            cerr << "Error: -mt does not support PC based policies" << endl;
+            return Usage();
+        }
+        thread_reg = PIN_ClaimToolRegister();
+        if (!REG_valid(thread_reg)) {
+            cerr << "Error: no Pin tool register left for the thread state" << endl;
+            return 1;
+        }
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        TRACE_AddInstrumentFunction(SharedTrace, 0);
+    }
+    // Several configurations, the ROI phases, sampling, the -ooo timing and
+    // the intervals are only simulated from the reference buffer
+    else if (KnobBatch.Value() || configs.size() != 1 || KnobWorkers.Value() > 0 || buffered_counts) {
+        // Pin calls BufferFull when the buffer is full and when the thread exits
+        buffer_id = PIN_DefineTraceBuffer(sizeof(MEMREF), KnobBufferPages.Value(),
+                                          BufferFull, 0);
+        if (buffer_id == BUFFER_ID_INVALID) {
+            cerr << "Error: could not allocate the reference buffer" << endl;
+            return 1;
+        }
+        TRACE_AddInstrumentFunction(Trace, 0);
+
+        PIN_InitLock(&batch_lock);
+        if (KnobWorkers.Value() > 0 && !stack_distance) {
+            if (!StartWorkers(KnobWorkers.Value())) {
+                cerr << "Error: could not start the worker threads" << endl;
+                return 1;
+            }
+            PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+        }
+    } else {
+        INS_AddInstrumentFunction(Instruction, 0);
+    }
 
     // Called when the instrumented application finishes its execution
     PIN_AddFiniFunction(Fini, 0);
@@ -0,0 +1,245 @@
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include <vector>
+#include <cstdio>    // snprintf
+
+/**
+ * All-associativity LRU simulation of the L2 (Mattson et al. stack
+ * algorithm, restricted to set-associative caches as in Hill & Smith).
+ *
+ * The L1 is simulated exactly. Every L1 miss updates, for each number of
+ * L2 sets S in [minSets, maxSets], the LRU stack of the set it maps to and
+ * records the stack depth at which the block was found. An S-set, A-way
+ * LRU cache hits exactly on the accesses found at depth < A, so one pass
+ * gives the hit/miss counts of every (sets, associativity) combination
+ * with the same block size. Stacks are cut at maxAssoc entries, as deeper
+ * hits are misses for every configuration reported.
+ *
+ * The L2 is treated as non-inclusive: its evictions do not invalidate L1
+ * lines, since they differ from one configuration to the other.
+ **/
+class STACK_DISTANCE_BASE
+{
+  public:
+    typedef CACHE_BASE::ACCESS_TYPE ACCESS_TYPE;
+
+    virtual ~STACK_DISTANCE_BASE() {}
+
+    // Writes one StatsLong() style report per configuration, named
+    // <prefix>_L2_LRU_<size KB>_<assoc>_<block size>.out
+    virtual VOID Report(const string &prefix, UINT64 instructions) const = 0;
+
+    // Zeroes the statistics, keeping the L1 contents and the stacks
+    virtual VOID ResetStats() = 0;
+};
+
+template <class L1SET>
+class STACK_DISTANCE final : public STACK_DISTANCE_BASE
+{
+  private:
+    enum {
+        HIT_L1 = 0,
+        HIT_L2,
+        MISS_L2,
+        ACCESS_RESULT_NUM
+    };
+
+    UINT32 _latencies[ACCESS_RESULT_NUM];
+
+    const UINT32 _l1_cacheSize;
+    const UINT32 _l1_blockSize;
+    const UINT32 _l1_associativity;
+    const UINT32 _l1_lineShift;
+    const UINT32 _l1_setIndexMask;
+    L1SET _l1_sets;
+    const bool _l1_store_allocate;
+    CACHE_STATS _l1_access[CACHE_BASE::ACCESS_TYPE_NUM][CACHE_BASE::HIT_MISS_NUM];
+
+    const UINT32 _l2_blockSize;
+    const UINT32 _l2_lineShift;
+    const UINT32 _minSetsLog;
+    const UINT32 _numSetCounts;  // set counts minSets, 2*minSets, ... maxSets
+    const UINT32 _maxAssoc;
+
+    // Per set count, the stacks of all its sets (MRU first, block numbers)
+    std::vector<ADDRINT *> _stacks;
+
+    // Accesses found at each depth, _maxAssoc meaning not found, indexed by
+    // [set count][access type][depth]
+    std::vector<CACHE_STATS> _depths;
+
+    CACHE_STATS & Depth(UINT32 setCount, UINT32 accessType, UINT32 depth)
+    {
+        return _depths[(setCount * CACHE_BASE::ACCESS_TYPE_NUM + accessType) * (_maxAssoc + 1) + depth];
+    }
+    CACHE_STATS Depth(UINT32 setCount, UINT32 accessType, UINT32 depth) const
+    {
+        return _depths[(setCount * CACHE_BASE::ACCESS_TYPE_NUM + accessType) * (_maxAssoc + 1) + depth];
+    }
+
+    VOID AccessL2(ADDRINT addr, ACCESS_TYPE accessType)
+    {
+        const ADDRINT block = addr >> _l2_lineShift;
+
+        for (UINT32 k = 0; k < _numSetCounts; k++) {
+            const UINT32 setIndex = block & ((1U << (_minSetsLog + k)) - 1);
+            ADDRINT *stack = _stacks[k] + setIndex * _maxAssoc;
+
+            UINT64 found = MatchTags(stack, block, _maxAssoc);
+            UINT32 depth = found ? FirstWay(found) : _maxAssoc;
+            Depth(k, accessType, depth)++;
+
+            // Move the block to the top of the stack
+            for (UINT32 i = (depth < _maxAssoc ? depth : _maxAssoc - 1); i > 0; i--)
+                stack[i] = stack[i - 1];
+            stack[0] = block;
+        }
+    }
+
+  public:
+    STACK_DISTANCE(UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
+                   UINT32 l2BlockSize, UINT32 minSets, UINT32 maxSets, UINT32 maxAssoc,
+                   bool l1StoreAllocate,
+                   UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 15,
+                   UINT32 l2MissLatency = 250)
+      : _l1_cacheSize(l1CacheSize),
+        _l1_blockSize(l1BlockSize),
+        _l1_associativity(l1Associativity),
+        _l1_lineShift(FloorLog2(l1BlockSize)),
+        _l1_setIndexMask((l1CacheSize / (l1Associativity * l1BlockSize)) - 1),
+        _l1_sets(_l1_setIndexMask + 1, l1Associativity),
+        _l1_store_allocate(l1StoreAllocate),
+        _l2_blockSize(l2BlockSize),
+        _l2_lineShift(FloorLog2(l2BlockSize)),
+        _minSetsLog(FloorLog2(minSets)),
+        _numSetCounts(FloorLog2(maxSets) - FloorLog2(minSets) + 1),
+        _maxAssoc(maxAssoc)
+    {
+        ASSERTX(IsPowerOf2(_l1_blockSize));
+        ASSERTX(IsPowerOf2(_l1_setIndexMask + 1));
+        ASSERTX(IsPowerOf2(_l2_blockSize));
+        ASSERTX(IsPowerOf2(minSets) && IsPowerOf2(maxSets) && minSets <= maxSets);
+        ASSERTX(maxAssoc > 0 && maxAssoc <= SIMD_MAX_WAYS);
+        ASSERTX(_l1_blockSize <= _l2_blockSize);
+
+        _latencies[HIT_L1] = l1HitLatency;
+        _latencies[HIT_L2] = l2HitLatency;
+        _latencies[MISS_L2] = l2MissLatency;
+
+        for (UINT32 k = 0; k < _numSetCounts; k++) {
+            const UINT32 entries = (minSets << k) * _maxAssoc;
+            ADDRINT *stack = new ADDRINT[entries];
+            for (UINT32 i = 0; i < entries; i++)
+                stack[i] = INVALID_TAG;
+            _stacks.push_back(stack);
+        }
+        ResetStats();
+    }
+
+    ~STACK_DISTANCE()
+    {
+        for (UINT32 k = 0; k < _numSetCounts; k++)
+            delete [] _stacks[k];
+    }
+
+    VOID ResetStats() override
+    {
+        _depths.assign(_numSetCounts * CACHE_BASE::ACCESS_TYPE_NUM * (_maxAssoc + 1), 0);
+
+        for (UINT32 accessType = 0; accessType < CACHE_BASE::ACCESS_TYPE_NUM; accessType++)
+        {
+            _l1_access[accessType][false] = 0;
+            _l1_access[accessType][true] = 0;
+        }
+    }
+
+    VOID Access(ADDRINT addr, ACCESS_TYPE accessType)
+    {
+        CACHE_TAG l1Tag = addr >> _l1_lineShift;
+        const UINT32 l1SetIndex = l1Tag & _l1_setIndexMask;
+        l1Tag = l1Tag >> FloorLog2(_l1_setIndexMask + 1);
+
+        const bool l1Hit = _l1_sets.Find(l1SetIndex, l1Tag);
+        _l1_access[accessType][l1Hit]++;
+        if (l1Hit)
+            return;
+
+        // On miss, loads always allocate, stores optionally
+        if (accessType == CACHE_BASE::ACCESS_TYPE_LOAD || _l1_store_allocate)
+            _l1_sets.Replace(l1SetIndex, l1Tag);
+
+        AccessL2(addr, accessType);
+    }
+
+    VOID Report(const string &prefix, UINT64 instructions) const override
+    {
+        for (UINT32 k = 0; k < _numSetCounts; k++) {
+            const UINT32 numSets = 1U << (_minSetsLog + k);
+
+            for (UINT32 assoc = 1; assoc <= _maxAssoc; assoc *= 2) {
+                const UINT64 size = UINT64(numSets) * assoc * _l2_blockSize;
+                if (size < _l1_cacheSize || size % KILO)
+                    continue;
+
+                CACHE_BASE::COUNTERS stats;
+                UINT64 cycles = instructions;
+                for (UINT32 t = 0; t < CACHE_BASE::ACCESS_TYPE_NUM; t++) {
+                    CACHE_STATS hits = 0, misses = 0;
+                    for (UINT32 d = 0; d <= _maxAssoc; d++)
+                        (d < assoc ? hits : misses) += Depth(k, t, d);
+
+                    stats.l1[t][true] = _l1_access[t][true];
+                    stats.l1[t][false] = _l1_access[t][false];
+                    stats.l2[t][true] = hits;
+                    stats.l2[t][false] = misses;
+
+                    cycles += (_l1_access[t][true] + _l1_access[t][false]) * _latencies[HIT_L1]
+                              + (hits + misses) * _latencies[HIT_L2]
+                              + misses * _latencies[MISS_L2];
+                }
+
+                char name[64];
+                snprintf(name, sizeof(name), "_L2_LRU_%04u_%02u_%03u.out",
+                         UINT32(size / KILO), assoc, _l2_blockSize);
+                std::ofstream out((prefix + name).c_str());
+
+                out << "--------\n";
+                out << "Total Statistics\n";
+                out << "--------\n";
+                out << "Total Instructions: " << instructions << "\n";
+                out << "Total Cycles: " << cycles << "\n";
+                out << "IPC: " << (double)instructions / (double)cycles << "\n";
+                out << "\n";
+
+                out << "--------\n";
+                out << "Stack distance LRU simulation\n";
+                out << "--------\n";
+                out << "  L1-Data Cache:\n";
+                out << "    Size(KB):       " << dec2str(_l1_cacheSize / KILO, 5) << "\n";
+                out << "    Block Size(B):  " << dec2str(_l1_blockSize, 5) << "\n";
+                out << "    Associativity:  " << dec2str(_l1_associativity, 5) << "\n";
+                out << "\n";
+                out << "  L2-Data Cache:\n";
+                out << "    Size(KB):       " << dec2str(size / KILO, 5) << "\n";
+                out << "    Block Size(B):  " << dec2str(_l2_blockSize, 5) << "\n";
+                out << "    Associativity:  " << dec2str(assoc, 5) << "\n";
+                out << "\n";
+                out << "Latencies: " << dec2str(_latencies[HIT_L1], 4) << " "
+                                     << dec2str(_latencies[HIT_L2], 4) << " "
+                                     << dec2str(_latencies[MISS_L2], 4) << "\n";
+                out << "L1-Sets: " << dec2str(_l1_setIndexMask + 1, 4) << " - "
+                    << _l1_sets.Name() << " - assoc: " << dec2str(_l1_associativity, 3) << "\n";
+                out << "L2-Sets: " << dec2str(numSets, 4) << " - LRU - assoc: "
+                    << dec2str(assoc, 3) << "\n";
+                out << "Store_allocation: " << (_l1_store_allocate ? "Yes" : "No") << "\n";
+                out << "L2_inclusive: No\n";
+                out << "\n";
+
+                out << CACHE_BASE::FormatStats(stats, "");
+            }
+        }
+    }
+};
+
+#endif // STACKDIST_H
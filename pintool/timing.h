@@ -0,0 +1,220 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstring>   // memset
+#include <deque>
+#include <vector>
+#include <sstream>
+
+/**
+ * Memory-level parallelism aware timing of one cache configuration (-ooo),
+ * in place of the sum of the latencies of every reference.
+ *
+ * Instructions dispatch in order, one per cycle, into a reorder buffer of
+ * `robEntries` instructions, and retire in order: an instruction cannot
+ * dispatch before the load `robEntries` instructions older has completed.
+ * A reference issues when its instruction dispatches and takes the latency
+ * the cache hierarchy returned for it. The ones slower than an L1 hit are
+ * misses and need one of `mshrs` miss status holding registers, waiting for
+ * the first one to free up if they are all busy; the references to a line
+ * whose miss is still in flight merge into its MSHR and complete with it.
+ * Independent misses within the window thus overlap.
+ *
+ * Stores retire through the store buffer without waiting for their data,
+ * but their misses hold an MSHR like the loads.
+ *
+ * The buffers only record the basic blocks, not where each reference is
+ * within its block: a block's references are taken to be its first
+ * instructions, one per instruction.
+ **/
+class OOO_TIMING
+{
+  public:
+    struct COUNTERS
+    {
+        UINT64 primaryMisses;      // allocated an MSHR
+        UINT64 secondaryMisses;    // merged into an in-flight MSHR
+        UINT64 mshrStallCycles;    // misses waiting for a free MSHR
+        UINT64 robStallCycles;     // dispatch waiting for the head of the ROB
+        UINT64 missCycles;         // latencies of the primary misses
+        UINT64 busyCycles;         // with at least one primary miss in flight
+        UINT64 serialCycles;       // latencies of all references
+    };
+
+  private:
+    struct LOAD
+    {
+        UINT64 index;   // of its instruction
+        UINT64 done;    // completion cycle
+    };
+
+    struct MSHR
+    {
+        ADDRINT line;
+        UINT64 done;
+    };
+
+    const UINT32 _rob_entries;
+    const UINT32 _line_shift;
+    const UINT32 _hit_latency;
+
+    std::deque<LOAD> _loads;      // that may still hold the ROB, oldest first
+    std::vector<MSHR> _mshrs;
+
+    UINT64 _next;        // instructions dispatched
+    UINT64 _clock;       // cycle of the next dispatch
+    UINT64 _retired;     // completion of the loads that left the window
+    UINT64 _pending;     // instructions of the current block not dispatched yet
+    UINT64 _issue;       // cycle of the last reference issued
+    UINT64 _done;        // last completion of a reference
+    UINT64 _busy_until;  // last completion of a primary miss
+    UINT64 _start;       // cycle of the last statistics reset
+
+    COUNTERS _stats;
+
+    // Dispatches `num` instructions, stalling on the loads they push out
+    // of the ROB
+    VOID Dispatch(UINT64 num)
+    {
+        const UINT64 last = _next + num;
+        while (!_loads.empty() && _loads.front().index + _rob_entries < last) {
+            const UINT64 held = _loads.front().index + _rob_entries;
+            _clock += held - _next;
+            _next = held;
+            _retired = std::max(_retired, _loads.front().done);
+            _loads.pop_front();
+            if (_retired > _clock) {
+                _stats.robStallCycles += _retired - _clock;
+                _clock = _retired;
+            }
+        }
+        _clock += last - _next;
+        _next = last;
+    }
+
+  public:
+    OOO_TIMING(UINT32 robEntries, UINT32 mshrs, UINT32 lineSize, UINT32 hitLatency)
+      : _rob_entries(robEntries),
+        _line_shift(FloorLog2(lineSize)),
+        _hit_latency(hitLatency),
+        _next(0), _clock(0), _retired(0), _pending(0), _issue(0), _done(0), _busy_until(0), _start(0)
+    {
+        ASSERTX(robEntries > 0 && mshrs > 0);
+        MSHR empty = { 0, 0 };
+        _mshrs.assign(mshrs, empty);
+        ResetStats();
+    }
+
+    VOID ResetStats()
+    {
+        memset(&_stats, 0, sizeof(_stats));
+        _start = _clock;
+    }
+    const COUNTERS &Stats() const { return _stats; }
+
+    // A basic block of `numInstructions` instructions is entered
+    VOID Block(UINT64 numInstructions)
+    {
+        Dispatch(_pending);
+        _pending = numInstructions;
+    }
+
+    // Dispatches the instruction of the next reference of the current block
+    // and returns the cycle it issues at, short of waiting for an MSHR
+    UINT64 Issue()
+    {
+        if (_pending) {
+            Dispatch(1);
+            _pending--;
+        }
+        _issue = _next ? _clock - 1 : _clock;
+        return _issue;
+    }
+
+    // The reference to `addr` issued last took `latency` cycles
+    VOID Access(ADDRINT addr, bool store, UINT64 latency)
+    {
+        UINT64 issue = _issue;
+        UINT64 done = issue + latency;
+        _stats.serialCycles += latency;
+
+        const ADDRINT line = addr >> _line_shift;
+        MSHR *free = &_mshrs[0];
+        MSHR *inflight = NULL;
+        for (UINT32 i = 0; i < _mshrs.size(); i++) {
+            if (_mshrs[i].line == line && _mshrs[i].done > issue)
+                inflight = &_mshrs[i];
+            if (_mshrs[i].done < free->done)
+                free = &_mshrs[i];
+        }
+
+        if (inflight) {
+            done = std::max(inflight->done, issue + _hit_latency);
+            _stats.secondaryMisses++;
+        } else if (latency > _hit_latency) {
+            if (free->done > issue) {
+                _stats.mshrStallCycles += free->done - issue;
+                issue = free->done;
+                done = issue + latency;
+            }
+            free->line = line;
+            free->done = done;
+            _stats.primaryMisses++;
+            _stats.missCycles += latency;
+
+            // Misses issue in order, so the busy periods only grow at the end
+            _stats.busyCycles += done - std::max(issue, std::min(_busy_until, done));
+            _busy_until = std::max(_busy_until, done);
+        }
+
+        // Loads that complete before the ROB wraps around never hold it
+        if (!store && done > issue + _rob_entries) {
+            LOAD load = { _next ? _next - 1 : 0, done };
+            _loads.push_back(load);
+        }
+        _done = std::max(_done, done);
+    }
+
+    // Dispatches the rest of the current block, at the end of the simulation
+    VOID Drain()
+    {
+        Dispatch(_pending);
+        _pending = 0;
+    }
+
+    // Cycles since the last statistics reset, until the last reference completed
+    UINT64 Cycles() const { return std::max(_clock, _done) - _start; }
+
+    // Cycles on top of one per instruction, for WriteReport()
+    UINT64 MemoryCycles(UINT64 instructions) const
+    {
+        return Cycles() > instructions ? Cycles() - instructions : 0;
+    }
+
+    // The timing section of the report
+    string Report() const
+    {
+        const UINT32 headerWidth = 24;
+        std::ostringstream out;
+
+        out << "--------\n";
+        out << "MLP Timing Statistics\n";
+        out << "--------\n";
+        out << "ROB: " << _rob_entries << " instructions, MSHRs: " << _mshrs.size()
+            << ", L1 hit: " << _hit_latency << " cycles\n";
+        out << "\n";
+
+        out << ljstr("Primary-Misses: ", headerWidth) << dec2str(_stats.primaryMisses, 12) << "\n";
+        out << ljstr("Secondary-Misses: ", headerWidth) << dec2str(_stats.secondaryMisses, 12) << "\n";
+        out << ljstr("MSHR-Stall-Cycles: ", headerWidth) << dec2str(_stats.mshrStallCycles, 12) << "\n";
+        out << ljstr("ROB-Stall-Cycles: ", headerWidth) << dec2str(_stats.robStallCycles, 12) << "\n";
+        out << ljstr("Miss-Busy-Cycles: ", headerWidth) << dec2str(_stats.busyCycles, 12) << "\n";
+        out << ljstr("Average-MLP: ", headerWidth)
+            << fltstr(_stats.busyCycles ? (double)_stats.missCycles / _stats.busyCycles : 0, 2, 12) << "\n";
+        out << ljstr("Serial-Memory-Cycles: ", headerWidth) << dec2str(_stats.serialCycles, 12) << "\n";
+        out << "\n";
+        return out.str();
+    }
+};
+
+#endif // TIMING_H
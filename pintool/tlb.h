@@ -0,0 +1,177 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <cstring>   // memset
+#include <sstream>
+
+/**
+ * Data TLB of one cache configuration: a first level DTLB backed by a
+ * second level STLB, both LRU, and a page walker for the misses of both.
+ *
+ * Walks read one 8-byte entry per level of an x86-64 style radix page
+ * table (4 levels with 4KB pages, 3 with 2MB pages) through the cache
+ * hierarchy, like loads, so they compete with the application for the
+ * caches and cost what their accesses cost. The page tables are laid out
+ * contiguously, level by level, in the upper half of the address space,
+ * which the application never touches.
+ *
+ * Addresses stay virtual: the caches are still indexed with them, and
+ * translation only adds its time. A DTLB hit is free, as it overlaps with
+ * the L1 access.
+ **/
+class TLB
+{
+  public:
+    struct COUNTERS
+    {
+        CACHE_STATS dtlb[CACHE_BASE::HIT_MISS_NUM];
+        CACHE_STATS stlb[CACHE_BASE::HIT_MISS_NUM];
+        CACHE_STATS walkReferences;
+        UINT64 walkCycles;
+    };
+
+  private:
+    static const ADDRINT PAGE_TABLE_BASE = ADDRINT(0xffff800000000000ULL);
+    static const UINT32 LEVEL_SHIFT = 44;     // address space of each table level
+    static const UINT32 INDEX_BITS = 9;       // per level
+
+    const UINT32 _dtlb_entries;
+    const UINT32 _dtlb_associativity;
+    const UINT32 _stlb_entries;
+    const UINT32 _stlb_associativity;
+    const UINT32 _page_shift;
+    const UINT32 _levels;
+    const UINT32 _stlb_latency;
+
+    const UINT32 _dtlb_setIndexMask;
+    const UINT32 _stlb_setIndexMask;
+
+    CACHE_SET::LRU _dtlb;
+    CACHE_SET::LRU _stlb;
+
+    COUNTERS _stats;
+
+    static VOID SplitPage(ADDRINT page, UINT32 setIndexMask, CACHE_TAG &tag, UINT32 &setIndex)
+    {
+        setIndex = page & setIndexMask;
+        tag = page >> FloorLog2(setIndexMask + 1);
+    }
+
+    // Address of the entry of `page` in the table of `level` (0 is the root)
+    ADDRINT EntryAddress(ADDRINT page, UINT32 level) const
+    {
+        const ADDRINT entry = page >> (INDEX_BITS * (_levels - 1 - level));
+        return PAGE_TABLE_BASE + (ADDRINT(level) << LEVEL_SHIFT) + entry * 8;
+    }
+
+  public:
+    TLB(UINT32 dtlbEntries, UINT32 dtlbAssociativity,
+        UINT32 stlbEntries, UINT32 stlbAssociativity,
+        UINT32 pageSize, UINT32 stlbLatency = 7)
+      : _dtlb_entries(dtlbEntries),
+        _dtlb_associativity(dtlbAssociativity),
+        _stlb_entries(stlbEntries),
+        _stlb_associativity(stlbAssociativity),
+        _page_shift(FloorLog2(pageSize)),
+        _levels(pageSize >= 2 * MEGA ? 3 : 4),
+        _stlb_latency(stlbLatency),
+        _dtlb_setIndexMask(dtlbEntries / dtlbAssociativity - 1),
+        _stlb_setIndexMask(stlbEntries / stlbAssociativity - 1),
+        _dtlb(_dtlb_setIndexMask + 1, dtlbAssociativity),
+        _stlb(_stlb_setIndexMask + 1, stlbAssociativity)
+    {
+        ASSERTX(IsPowerOf2(pageSize));
+        ASSERTX(IsPowerOf2(_dtlb_setIndexMask + 1));
+        ASSERTX(IsPowerOf2(_stlb_setIndexMask + 1));
+        ResetStats();
+    }
+
+    // Whether a TLB level of `entries` entries can be `associativity`-way
+    static bool ValidGeometry(UINT32 entries, UINT32 associativity)
+    {
+        return associativity && entries % associativity == 0 && IsPowerOf2(entries / associativity);
+    }
+
+    VOID ResetStats() { memset(&_stats, 0, sizeof(_stats)); }
+    const COUNTERS &Stats() const { return _stats; }
+
+    /**
+     * Returns the cycles to translate `addr`, walking the page table
+     * through `cache` on an STLB miss. Statistics, including the ones of
+     * the walk's cache accesses, are only updated if COUNT is set.
+     **/
+    template <bool COUNT, class CACHE>
+    UINT32 Translate(ADDRINT addr, CACHE &cache)
+    {
+        const ADDRINT page = addr >> _page_shift;
+        CACHE_TAG tag;
+        UINT32 setIndex;
+
+        SplitPage(page, _dtlb_setIndexMask, tag, setIndex);
+        const bool dtlbHit = _dtlb.Find(setIndex, tag);
+        if (COUNT)
+            _stats.dtlb[dtlbHit]++;
+        if (dtlbHit)
+            return 0;
+        _dtlb.Replace(setIndex, tag);
+
+        SplitPage(page, _stlb_setIndexMask, tag, setIndex);
+        const bool stlbHit = _stlb.Find(setIndex, tag);
+        if (COUNT)
+            _stats.stlb[stlbHit]++;
+        if (stlbHit)
+            return _stlb_latency;
+        _stlb.Replace(setIndex, tag);
+
+        UINT32 cycles = 0;
+        for (UINT32 level = 0; level < _levels; level++) {
+            if (COUNT)
+                cycles += cache.Access(EntryAddress(page, level), CACHE_BASE::ACCESS_TYPE_LOAD);
+            else
+                cache.Warm(EntryAddress(page, level), CACHE_BASE::ACCESS_TYPE_LOAD);
+        }
+        if (COUNT) {
+            _stats.walkReferences += _levels;
+            _stats.walkCycles += cycles;
+        }
+        return _stlb_latency + cycles;
+    }
+
+    // The TLB section of the report, with MPKIs over `instructions`
+    string Report(UINT64 instructions) const
+    {
+        const double kilo = instructions ? instructions / 1000.0 : 1;
+        const CACHE_STATS dtlbAccesses = _stats.dtlb[true] + _stats.dtlb[false];
+        const CACHE_STATS stlbAccesses = _stats.stlb[true] + _stats.stlb[false];
+        const CACHE_STATS walks = _stats.stlb[false];
+        const UINT32 headerWidth = 20;
+        std::ostringstream out;
+
+        out << "--------\n";
+        out << "TLB Statistics\n";
+        out << "--------\n";
+        out << "DTLB: " << _dtlb_entries << " entries, " << _dtlb_associativity << "-way; "
+            << "STLB: " << _stlb_entries << " entries, " << _stlb_associativity << "-way, "
+            << _stlb_latency << " cycles\n";
+        out << "Page Size(KB): " << (UINT64(1) << _page_shift) / KILO << ", "
+            << _levels << "-level page walks\n";
+        out << "\n";
+
+        out << ljstr("DTLB-Hits: ", headerWidth) << dec2str(_stats.dtlb[true], 12) << "\n";
+        out << ljstr("DTLB-Misses: ", headerWidth) << dec2str(_stats.dtlb[false], 12) << "  "
+            << fltstr(dtlbAccesses ? 100.0 * _stats.dtlb[false] / dtlbAccesses : 0, 2, 6) << "%\n";
+        out << ljstr("DTLB-MPKI: ", headerWidth) << fltstr(_stats.dtlb[false] / kilo, 3, 12) << "\n";
+        out << ljstr("STLB-Hits: ", headerWidth) << dec2str(_stats.stlb[true], 12) << "\n";
+        out << ljstr("STLB-Misses: ", headerWidth) << dec2str(_stats.stlb[false], 12) << "  "
+            << fltstr(stlbAccesses ? 100.0 * _stats.stlb[false] / stlbAccesses : 0, 2, 6) << "%\n";
+        out << ljstr("STLB-MPKI: ", headerWidth) << fltstr(_stats.stlb[false] / kilo, 3, 12) << "\n";
+        out << ljstr("Walk-References: ", headerWidth) << dec2str(_stats.walkReferences, 12) << "\n";
+        out << ljstr("Walk-Cycles: ", headerWidth) << dec2str(_stats.walkCycles, 12) << "\n";
+        out << ljstr("Avg-Walk-Cycles: ", headerWidth)
+            << fltstr(walks ? (double)_stats.walkCycles / walks : 0, 2, 12) << "\n";
+        out << "\n";
+        return out.str();
+    }
+};
+
+#endif // TLB_H
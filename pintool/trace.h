@@ -0,0 +1,323 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#include "lz4_block.h"
+
+/**
+ * Memory reference trace files, written by the tracer pintool (tracer.cpp)
+ * and read by the replay tool (replay.cpp).
+ *
+ * A trace is a TRACE_FILE_HEADER followed by chunks, each one a
+ * TRACE_CHUNK_HEADER and its payload. Chunks are self-contained: their
+ * payload decodes without the preceding chunks. The decoded payload holds
+ * one record per reference, as LEB128 varints:
+ *
+ *   zigzag(addr - previous addr) << 2 | has_gap << 1 | is_store
+ *   [instructions retired since the previous reference, if has_gap]
+ *   zigzag(pc - previous pc), since version 2
+ *
+ * The previous address and pc are 0 at the start of each chunk; the pc of
+ * the references of version 1 traces is 0. Instructions
+ * retired after the last reference of a chunk are implied by the chunk
+ * header. Address deltas must fit in 61 bits, which user space addresses
+ * do. Headers are stored in the (little endian) host byte order.
+ *
+ * The chunks are followed by an index, one TRACE_INDEX_ENTRY per chunk, and
+ * a TRACE_FOOTER locating it, so readers can seek to an instruction count.
+ * A trace without them (e.g. its writer was killed) can still be read by
+ * walking the chunk headers.
+ **/
+
+#define TRACE_MAGIC "CSLBTRC"
+#define TRACE_VERSION 2
+#define TRACE_CHUNK_MAGIC 0x4b4e4843  // "CHNK"
+#define TRACE_INDEX_MAGIC 0x58444e49  // "INDX"
+
+// Same values as CACHE_BASE::ACCESS_TYPE
+enum {
+    TRACE_LOAD = 0,
+    TRACE_STORE = 1
+};
+
+// Payload encodings
+enum {
+    TRACE_CODEC_NONE = 0,   // the varint records as is
+    TRACE_CODEC_LZ4 = 1     // the varint records in an LZ4 block
+};
+
+struct TRACE_FILE_HEADER
+{
+    char magic[8];          // TRACE_MAGIC
+    UINT32 version;         // TRACE_VERSION
+    UINT32 reserved;
+};
+
+struct TRACE_CHUNK_HEADER
+{
+    UINT32 magic;           // TRACE_CHUNK_MAGIC
+    UINT32 codec;           // TRACE_CODEC_*
+    UINT32 numRefs;
+    UINT32 rawBytes;        // size of the decoded payload
+    UINT32 storedBytes;     // size of the payload in the file
+    UINT32 reserved;
+    UINT64 firstInstruction; // instructions retired before the chunk
+    UINT64 numInstructions;  // instructions retired within the chunk
+};
+
+struct TRACE_INDEX_ENTRY
+{
+    UINT64 offset;           // of the chunk header in the file
+    UINT64 firstInstruction; // same as in the chunk header
+};
+
+struct TRACE_FOOTER
+{
+    UINT64 indexOffset;
+    UINT64 numChunks;
+    UINT32 magic;            // TRACE_INDEX_MAGIC
+    UINT32 reserved;
+};
+
+/**
+ * A decoded reference
+ **/
+struct TRACE_REF
+{
+    ADDRINT addr;
+    ADDRINT pc;             // of the instruction
+    UINT64 instructions;    // retired up to and including this one's basic block
+    UINT32 type;            // TRACE_LOAD or TRACE_STORE
+};
+
+static inline UINT8 *PutVarint(UINT8 *p, UINT64 v)
+{
+    while (v >= 0x80) {
+        *p++ = UINT8(v) | 0x80;
+        v >>= 7;
+    }
+    *p++ = UINT8(v);
+    return p;
+}
+
+// Signed deltas as varints: small magnitudes in few bytes
+static inline UINT64 ZigZag(ADDRINT delta)
+{
+    return (UINT64(delta) << 1) ^ UINT64(INT64(delta) >> 63);
+}
+static inline ADDRINT UnZigZag(UINT64 v)
+{
+    return ADDRINT((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static inline const UINT8 *GetVarint(const UINT8 *p, const UINT8 *end, UINT64 &v)
+{
+    v = 0;
+    for (UINT32 shift = 0; p < end && shift < 64; shift += 7) {
+        const UINT8 b = *p++;
+        v |= UINT64(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+/**
+ * Appends references to a trace file, one chunk of `chunkRefs` references
+ * at a time. Not thread safe.
+ **/
+class TRACE_WRITER
+{
+  private:
+    FILE *_file;
+    UINT32 _codec;
+    UINT32 _chunkRefs;
+
+    std::vector<UINT8> _raw;      // records of the current chunk
+    std::vector<UINT8> _packed;   // compressed records
+    UINT8 *_end;                  // end of the records in _raw
+    TRACE_CHUNK_HEADER _chunk;
+    ADDRINT _lastAddr;
+    ADDRINT _lastPC;
+    UINT64 _instructions;         // retired so far
+    UINT64 _lastRefInstructions;  // retired at the last reference
+    UINT64 _offset;               // bytes written so far
+    std::vector<TRACE_INDEX_ENTRY> _index;
+    bool _ok;
+
+    VOID Write(const VOID *data, size_t size)
+    {
+        if (size && fwrite(data, 1, size, _file) != size)
+            _ok = false;
+        _offset += size;
+    }
+
+    VOID FlushChunk()
+    {
+        _chunk.numInstructions = _instructions - _chunk.firstInstruction;
+        _chunk.rawBytes = UINT32(_end - &_raw[0]);
+
+        const UINT8 *payload = &_raw[0];
+        _chunk.codec = TRACE_CODEC_NONE;
+        _chunk.storedBytes = _chunk.rawBytes;
+        if (_codec == TRACE_CODEC_LZ4) {
+            size_t packed = LZ4_BLOCK::Compress(&_raw[0], _chunk.rawBytes, &_packed[0]);
+            if (packed < _chunk.rawBytes) {
+                _chunk.codec = TRACE_CODEC_LZ4;
+                _chunk.storedBytes = UINT32(packed);
+                payload = &_packed[0];
+            }
+        }
+
+        TRACE_INDEX_ENTRY entry;
+        entry.offset = _offset;
+        entry.firstInstruction = _chunk.firstInstruction;
+        _index.push_back(entry);
+
+        Write(&_chunk, sizeof(_chunk));
+        Write(payload, _chunk.storedBytes);
+
+        StartChunk();
+    }
+
+    VOID StartChunk()
+    {
+        memset(&_chunk, 0, sizeof(_chunk));
+        _chunk.magic = TRACE_CHUNK_MAGIC;
+        _chunk.firstInstruction = _instructions;
+        _end = &_raw[0];
+        _lastAddr = 0;
+        _lastPC = 0;
+        _lastRefInstructions = _instructions;
+    }
+
+  public:
+    TRACE_WRITER() : _file(NULL), _ok(false) {}
+    ~TRACE_WRITER() { Close(); }
+
+    bool Open(const std::string &fileName, UINT32 codec, UINT32 chunkRefs)
+    {
+        _file = fopen(fileName.c_str(), "wb");
+        if (!_file)
+            return false;
+
+        _codec = codec;
+        _chunkRefs = chunkRefs > 0 ? chunkRefs : 1;
+        // Worst case record: three 10 byte varints
+        _raw.resize(size_t(_chunkRefs) * 30);
+        if (_codec == TRACE_CODEC_LZ4)
+            _packed.resize(LZ4_BLOCK::Bound(_raw.size()));
+        _instructions = 0;
+        _offset = 0;
+        _index.clear();
+        _ok = true;
+
+        TRACE_FILE_HEADER header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = TRACE_VERSION;
+        Write(&header, sizeof(header));
+
+        StartChunk();
+        return _ok;
+    }
+
+    VOID Instructions(UINT64 num)
+    {
+        _instructions += num;
+    }
+
+    VOID Reference(ADDRINT addr, ADDRINT pc, UINT32 type)
+    {
+        const UINT64 gap = _instructions - _lastRefInstructions;
+
+        _end = PutVarint(_end, ZigZag(addr - _lastAddr) << 2 | UINT64(gap != 0) << 1 | (type == TRACE_STORE));
+        if (gap)
+            _end = PutVarint(_end, gap);
+        _end = PutVarint(_end, ZigZag(pc - _lastPC));
+
+        _lastAddr = addr;
+        _lastPC = pc;
+        _lastRefInstructions = _instructions;
+        if (++_chunk.numRefs == _chunkRefs)
+            FlushChunk();
+    }
+
+    /**
+     * Writes the last chunk, which also carries the instructions retired
+     * after the last reference, and the index. Returns false if any write
+     * failed.
+     **/
+    bool Close()
+    {
+        if (!_file)
+            return _ok;
+
+        if (_chunk.numRefs || _instructions != _chunk.firstInstruction)
+            FlushChunk();
+
+        TRACE_FOOTER footer;
+        memset(&footer, 0, sizeof(footer));
+        footer.indexOffset = _offset;
+        footer.numChunks = _index.size();
+        footer.magic = TRACE_INDEX_MAGIC;
+        Write(_index.empty() ? NULL : &_index[0], _index.size() * sizeof(TRACE_INDEX_ENTRY));
+        Write(&footer, sizeof(footer));
+        if (fclose(_file) != 0)
+            _ok = false;
+        _file = NULL;
+        return _ok;
+    }
+
+    UINT64 Instructions() const { return _instructions; }
+};
+
+/**
+ * Decodes the payload of one chunk of a trace of version `version`.
+ * `scratch` holds the decompressed records. Returns false on malformed
+ * input.
+ **/
+static bool DecodeTraceChunk(const TRACE_CHUNK_HEADER &chunk, const UINT8 *payload, UINT32 version,
+                             std::vector<TRACE_REF> &refs, std::vector<UINT8> &scratch)
+{
+    const UINT8 *p = payload;
+    if (chunk.codec == TRACE_CODEC_LZ4) {
+        scratch.resize(chunk.rawBytes);
+        if (chunk.rawBytes && !LZ4_BLOCK::Decompress(payload, chunk.storedBytes,
+                                                     &scratch[0], chunk.rawBytes))
+            return false;
+        p = scratch.empty() ? NULL : &scratch[0];
+    } else if (chunk.codec != TRACE_CODEC_NONE || chunk.storedBytes != chunk.rawBytes) {
+        return false;
+    }
+    const UINT8 *end = p + chunk.rawBytes;
+
+    refs.resize(chunk.numRefs);
+    ADDRINT addr = 0, pc = 0;
+    UINT64 instructions = chunk.firstInstruction;
+    for (UINT32 i = 0; i < chunk.numRefs; i++) {
+        UINT64 v, gap = 0, pcDelta = 0;
+        if (!(p = GetVarint(p, end, v)))
+            return false;
+        if (v & 2 && !(p = GetVarint(p, end, gap)))
+            return false;
+        if (version >= 2 && !(p = GetVarint(p, end, pcDelta)))
+            return false;
+
+        addr += UnZigZag(v >> 2);
+        pc += UnZigZag(pcDelta);
+        instructions += gap;
+
+        refs[i].addr = addr;
+        refs[i].pc = pc;
+        refs[i].instructions = instructions;
+        refs[i].type = (v & 1) ? TRACE_STORE : TRACE_LOAD;
+    }
+    return p == end && instructions <= chunk.firstInstruction + chunk.numInstructions;
+}
+
+#endif // TRACE_H
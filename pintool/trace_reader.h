@@ -0,0 +1,318 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/**
+ * Reads a trace file (see trace.h) mapped in memory. Decoder threads
+ * decompress and decode up to `ahead` chunks in advance, in a ring of
+ * slots, while the caller simulates the current one. A region of the
+ * trace, given in retired instructions, can be selected; the index footer
+ * is used to start at the first chunk of the region.
+ *
+ * Open() the trace, optionally SetRegion(), Start() the decoders, then
+ * call Next() until it returns false. Not meant for pintools: it uses the
+ * host C++ runtime's threads and mmap.
+ **/
+class TRACE_READER
+{
+  private:
+    struct SLOT
+    {
+        std::vector<TRACE_REF> refs;
+        std::vector<UINT8> scratch;
+        bool ready;
+        bool ok;
+    };
+
+    const UINT8 *_data;
+    size_t _size;
+    UINT32 _version;
+    std::vector<TRACE_INDEX_ENTRY> _index;
+    std::string _error;
+
+    // Region: chunks [_begin, _end) hold the instructions (_start, _stop]
+    UINT64 _start, _stop;
+    UINT64 _begin, _end;
+
+    std::vector<SLOT> _slots;
+    std::vector<std::thread> _decoders;
+    std::mutex _lock;
+    std::condition_variable _changed;
+    UINT64 _claimed;     // next chunk a decoder will take
+    UINT64 _consumed;    // next chunk Next() will return
+    bool _holding;       // Next() returned a slot not released yet
+    bool _stopping;
+
+    bool Fail(const std::string &error)
+    {
+        _error = error;
+        return false;
+    }
+
+    TRACE_CHUNK_HEADER ChunkHeader(UINT64 chunk) const
+    {
+        TRACE_CHUNK_HEADER header;
+        memcpy(&header, _data + _index[chunk].offset, sizeof(header));
+        return header;
+    }
+
+    // Fills `refs` with the references of `chunk` that are in the region
+    bool Decode(UINT64 chunk, std::vector<TRACE_REF> &refs, std::vector<UINT8> &scratch) const
+    {
+        const TRACE_CHUNK_HEADER header = ChunkHeader(chunk);
+        const UINT8 *payload = _data + _index[chunk].offset + sizeof(header);
+        if (header.magic != TRACE_CHUNK_MAGIC ||
+            header.storedBytes > _size - (payload - _data) ||
+            !DecodeTraceChunk(header, payload, _version, refs, scratch))
+            return false;
+
+        // References are in instruction order
+        if (_start > header.firstInstruction || _stop < header.firstInstruction + header.numInstructions) {
+            std::vector<TRACE_REF>::iterator first = refs.begin(), last = refs.end();
+            while (first != last && first->instructions <= _start)
+                ++first;
+            while (last != first && (last - 1)->instructions > _stop)
+                --last;
+            refs.erase(last, refs.end());
+            refs.erase(refs.begin(), first);
+        }
+        return true;
+    }
+
+    VOID DecoderMain()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        while (true) {
+            // A slot is free once the chunk `ahead` places before is consumed
+            while (!_stopping && _claimed < _end && _claimed >= _consumed + _slots.size())
+                _changed.wait(lock);
+            if (_stopping || _claimed >= _end)
+                return;
+
+            const UINT64 chunk = _claimed++;
+            SLOT &slot = _slots[chunk % _slots.size()];
+            lock.unlock();
+            const bool ok = Decode(chunk, slot.refs, slot.scratch);
+            lock.lock();
+
+            slot.ok = ok;
+            slot.ready = true;
+            _changed.notify_all();
+        }
+    }
+
+    // Rebuilds the index of a trace without footer from its chunk headers
+    bool ScanChunks()
+    {
+        UINT64 offset = sizeof(TRACE_FILE_HEADER);
+        while (offset < _size) {
+            TRACE_CHUNK_HEADER header;
+            if (_size - offset < sizeof(header))
+                return Fail("truncated chunk header");
+            memcpy(&header, _data + offset, sizeof(header));
+            if (header.magic != TRACE_CHUNK_MAGIC)
+                return Fail("corrupted chunk header");
+            if (header.storedBytes > _size - offset - sizeof(header))
+                return Fail("truncated chunk");
+
+            TRACE_INDEX_ENTRY entry;
+            entry.offset = offset;
+            entry.firstInstruction = header.firstInstruction;
+            _index.push_back(entry);
+            offset += sizeof(header) + header.storedBytes;
+        }
+        return true;
+    }
+
+    VOID StopDecoders()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stopping = true;
+        }
+        _changed.notify_all();
+        for (UINT32 i = 0; i < _decoders.size(); i++)
+            _decoders[i].join();
+        _decoders.clear();
+    }
+
+  public:
+    TRACE_READER()
+      : _data(NULL), _size(0), _version(0), _start(0), _stop(~UINT64(0)), _begin(0), _end(0),
+        _claimed(0), _consumed(0), _holding(false), _stopping(false) {}
+
+    ~TRACE_READER()
+    {
+        StopDecoders();
+        if (_data)
+            munmap(const_cast<UINT8 *>(_data), _size);
+    }
+
+    bool Open(const std::string &fileName)
+    {
+        const int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return Fail("cannot open " + fileName);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            _size = st.st_size;
+            void *data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            _data = data == MAP_FAILED ? NULL : static_cast<const UINT8 *>(data);
+        }
+        close(fd);
+        if (!_data) {
+            _size = 0;
+            return Fail("cannot map " + fileName);
+        }
+        madvise(const_cast<UINT8 *>(_data), _size, MADV_SEQUENTIAL);
+
+        TRACE_FILE_HEADER header;
+        if (_size < sizeof(header))
+            return Fail(fileName + " is not a trace file");
+        memcpy(&header, _data, sizeof(header));
+        if (memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+            return Fail(fileName + " is not a trace file");
+        if (header.version < 1 || header.version > TRACE_VERSION)
+            return Fail(fileName + " has an unsupported trace version");
+        _version = header.version;
+
+        TRACE_FOOTER footer;
+        bool indexed = false;
+        if (_size >= sizeof(header) + sizeof(footer)) {
+            memcpy(&footer, _data + _size - sizeof(footer), sizeof(footer));
+            indexed = footer.magic == TRACE_INDEX_MAGIC &&
+                      footer.indexOffset >= sizeof(header) &&
+                      footer.indexOffset <= _size - sizeof(footer) &&
+                      footer.numChunks == (_size - sizeof(footer) - footer.indexOffset) / sizeof(TRACE_INDEX_ENTRY);
+        }
+        if (indexed) {
+            _index.resize(footer.numChunks);
+            if (footer.numChunks)
+                memcpy(&_index[0], _data + footer.indexOffset, footer.numChunks * sizeof(TRACE_INDEX_ENTRY));
+            for (UINT64 i = 0; i < _index.size(); i++)
+                if (_index[i].offset + sizeof(TRACE_CHUNK_HEADER) > footer.indexOffset)
+                    return Fail(fileName + " has a corrupted index");
+        } else if (!ScanChunks()) {
+            return false;
+        }
+
+        _end = _index.size();
+        return true;
+    }
+
+    /**
+     * Instructions retired over the whole trace
+     **/
+    UINT64 Instructions() const
+    {
+        if (_index.empty())
+            return 0;
+        const TRACE_CHUNK_HEADER last = ChunkHeader(_index.size() - 1);
+        return last.firstInstruction + last.numInstructions;
+    }
+
+    /**
+     * Restricts Next() to the references of instructions (start, stop].
+     * Must be called before the first Next().
+     **/
+    VOID SetRegion(UINT64 start, UINT64 stop)
+    {
+        _start = start;
+        _stop = stop;
+
+        // First chunk holding instructions after `start`, first one
+        // starting at or after `stop`
+        struct BY_INSTRUCTION
+        {
+            bool operator()(UINT64 n, const TRACE_INDEX_ENTRY &e) const { return n < e.firstInstruction; }
+            bool operator()(const TRACE_INDEX_ENTRY &e, UINT64 n) const { return e.firstInstruction < n; }
+        };
+        _begin = std::upper_bound(_index.begin(), _index.end(), start, BY_INSTRUCTION()) - _index.begin();
+        _begin = _begin > 0 ? _begin - 1 : 0;
+        _end = std::lower_bound(_index.begin(), _index.end(), stop, BY_INSTRUCTION()) - _index.begin();
+        if (_end < _begin)
+            _end = _begin;
+    }
+
+    /**
+     * Starts `decoders` threads decoding up to `ahead` chunks in advance.
+     * Without decoders, Next() decodes each chunk itself.
+     **/
+    VOID Start(UINT32 decoders, UINT32 ahead)
+    {
+        _slots.resize(ahead > 0 ? ahead : 1);
+        for (UINT32 i = 0; i < _slots.size(); i++)
+            _slots[i].ready = false;
+        _claimed = _consumed = _begin;
+
+        for (UINT32 i = 0; i < decoders; i++)
+            _decoders.push_back(std::thread(&TRACE_READER::DecoderMain, this));
+    }
+
+    /**
+     * Returns the references of the next chunk in the region, valid until
+     * the following call. Returns false at the end of the region or on
+     * error, in which case Error() is not empty.
+     **/
+    bool Next(const TRACE_REF *&refs, UINT64 &num)
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        if (_holding) {
+            _slots[_consumed % _slots.size()].ready = false;
+            _consumed++;
+            _holding = false;
+            _changed.notify_all();
+        }
+        if (_consumed >= _end)
+            return false;
+
+        SLOT &slot = _slots[_consumed % _slots.size()];
+        if (_decoders.empty()) {
+            slot.ok = Decode(_consumed, slot.refs, slot.scratch);
+            slot.ready = true;
+        }
+        while (!slot.ready)
+            _changed.wait(lock);
+        if (!slot.ok)
+            return Fail("corrupted chunk " + std::to_string(_consumed));
+
+        _holding = true;
+        refs = slot.refs.empty() ? NULL : &slot.refs[0];
+        num = slot.refs.size();
+        return true;
+    }
+
+    /**
+     * The chunks of the region, which Next() returns one by one, for
+     * readers that need them in another order: ReadChunk() decodes the
+     * references of chunk `i` of the region into `refs`. Does not need
+     * Start().
+     **/
+    UINT64 RegionChunks() const { return _end - _begin; }
+    bool ReadChunk(UINT64 i, std::vector<TRACE_REF> &refs, std::vector<UINT8> &scratch)
+    {
+        if (!Decode(_begin + i, refs, scratch))
+            return Fail("corrupted chunk " + std::to_string(_begin + i));
+        return true;
+    }
+
+    const std::string &Error() const { return _error; }
+};
+
+#endif // TRACE_READER_H
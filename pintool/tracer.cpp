@@ -0,0 +1,164 @@
+#include "pin.H"
+
+#include <iostream>
+#include <cstddef>   // offsetof
+
+using namespace std;
+
+#include "trace.h"
+
+/* ===================================================================== */
+/* Commandline Switches                                                  */
+/* ===================================================================== */
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "cslab_cache.trace", "specify trace file name");
+KNOB<string> KnobCodec(KNOB_MODE_WRITEONCE, "pintool",
+    "codec", "lz4", "chunk compression (lz4 or none)");
+KNOB<UINT32> KnobChunkRefs(KNOB_MODE_WRITEONCE, "pintool",
+    "chunk", "262144", "number of memory references in each trace chunk");
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+    "bufpages", "1024", "number of 4KB pages in each per-thread reference buffer");
+
+/* ===================================================================== */
+/* Global Variables                                                      */
+/* ===================================================================== */
+
+// Buffer entries: memory references and basic block instruction counts, in
+// program order
+enum {
+    ENTRY_LOAD = TRACE_LOAD,
+    ENTRY_STORE = TRACE_STORE,
+    ENTRY_INSTRUCTIONS      // `value` instructions were retired
+};
+
+struct ENTRY
+{
+    ADDRINT value;
+    ADDRINT pc;     // of the loads and stores only
+    UINT32 kind;
+};
+
+BUFFER_ID buffer_id;
+TRACE_WRITER writer;
+PIN_LOCK writer_lock;
+
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool records the memory references of an application for\n"
+            "the trace-driven replay tool.\n\n";
+    cerr << KNOB_BASE::StringKnobSummary();
+    cerr << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+
+// Buffers of different threads are appended as a whole, so the references
+// of a multithreaded application are interleaved at buffer granularity.
+VOID * BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf,
+                  UINT64 numElements, VOID *v)
+{
+    const ENTRY *entries = static_cast<ENTRY *>(buf);
+
+    PIN_GetLock(&writer_lock, tid + 1);
+    for (UINT64 i = 0; i < numElements; i++) {
+        if (entries[i].kind == ENTRY_INSTRUCTIONS)
+            writer.Instructions(entries[i].value);
+        else
+            writer.Reference(entries[i].value, entries[i].pc, entries[i].kind);
+    }
+    PIN_ReleaseLock(&writer_lock);
+
+    return buf;
+}
+
+VOID Trace(TRACE trace, VOID * v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        // Count instructions once per basic block
+        INS_InsertFillBuffer(BBL_InsHead(bbl), IPOINT_BEFORE, buffer_id,
+            IARG_ADDRINT, ADDRINT(BBL_NumIns(bbl)), offsetof(ENTRY, value),
+            IARG_UINT32, ENTRY_INSTRUCTIONS, offsetof(ENTRY, kind),
+            IARG_END);
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            UINT32 memOperands = INS_MemoryOperandCount(ins);
+
+            // Same operand order as the simulator
+            for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+                if (INS_MemoryOperandIsRead(ins, memOp)) {
+                    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, buffer_id,
+                        IARG_MEMORYOP_EA, memOp, offsetof(ENTRY, value),
+                        IARG_INST_PTR, offsetof(ENTRY, pc),
+                        IARG_UINT32, ENTRY_LOAD, offsetof(ENTRY, kind),
+                        IARG_END);
+                }
+                if (INS_MemoryOperandIsWritten(ins, memOp)) {
+                    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, buffer_id,
+                        IARG_MEMORYOP_EA, memOp, offsetof(ENTRY, value),
+                        IARG_INST_PTR, offsetof(ENTRY, pc),
+                        IARG_UINT32, ENTRY_STORE, offsetof(ENTRY, kind),
+                        IARG_END);
+                }
+            }
+        }
+    }
+}
+
+/* ===================================================================== */
+
+VOID Fini(int code, VOID * v)
+{
+    const UINT64 instructions = writer.Instructions();
+    if (!writer.Close())
+        cerr << "Error: could not write " << KnobOutputFile.Value() << endl;
+    else
+        cerr << "Traced " << instructions << " instructions to "
+             << KnobOutputFile.Value() << endl;
+}
+
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    if (PIN_Init(argc, argv))
+        return Usage();
+
+    UINT32 codec;
+    if (KnobCodec.Value() == "lz4")
+        codec = TRACE_CODEC_LZ4;
+    else if (KnobCodec.Value() == "none")
+        codec = TRACE_CODEC_NONE;
+    else {
+        cerr << "Error: unknown codec " << KnobCodec.Value() << endl;
+        return Usage();
+    }
+
+    if (!writer.Open(KnobOutputFile.Value(), codec, KnobChunkRefs.Value())) {
+        cerr << "Error: could not create " << KnobOutputFile.Value() << endl;
+        return 1;
+    }
+
+    // Pin calls BufferFull when the buffer is full and when the thread exits
+    buffer_id = PIN_DefineTraceBuffer(sizeof(ENTRY), KnobBufferPages.Value(),
+                                      BufferFull, 0);
+    if (buffer_id == BUFFER_ID_INVALID) {
+        cerr << "Error: could not allocate the reference buffer" << endl;
+        return 1;
+    }
+    PIN_InitLock(&writer_lock);
+
+    TRACE_AddInstrumentFunction(Trace, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -12,6 +12,14 @@ inputBase="/home/john/Adv_Comp_Arch/advcomparch-ex2-helpcode/spec_benchmarks"
 ## Triples of <cache_size>_<associativity>_<block_size>
 CONFS="2048_16_256" # 256_8_256 512_8_256 1024_16_256
 
+## Replacement policy of both cache levels (LRU Random LFU LIP SRRIP BIP BRRIP DIP DRRIP SHiP Hawkeye)
+POLICY="SRRIP"
+
+## Simulate all CONFS in a single PIN run per benchmark (1) or one run per conf (0)
+SINGLE_PASS=0
+## Worker threads simulating the configurations in single-pass mode
+WORKERS=4
+
 L1size=32
 L1assoc=4
 L1bsize=32
@@ -37,6 +45,22 @@ for folder in "$inputBase"/*; do
             # Old speccmds.cmd has arguments before the ./ execution. We don't want these. Extract everything from the first occurrence of "./", including "./"
             clean_cmd=$(echo "$line" | sed -n 's/.*\(\.\/.*\)/\1/p')
 
+	    outBenchFolder="$outDir/$BENCH"
+	    mkdir -p "$outBenchFolder"  # Create internal folders if they don't already exist
+
+	    if [ "$SINGLE_PASS" -eq 1 ]; then
+		# One run for all configurations, each one is written to
+		# <prefix>_L2_<policy>_<size>_<assoc>_<bsize>.out
+		confArgs=""
+		for conf in $CONFS; do
+		    confArgs="$confArgs -conf ${conf}_${POLICY}"
+		done
+		pin_cmd="$PIN_EXE -t $PIN_TOOL -workers $WORKERS -o $outBenchFolder/$BENCH.cslab_cache_stats -L1c ${L1size} -L1a ${L1assoc} -L1b ${L1bsize}$confArgs -- $clean_cmd "
+		echo "PIN_CMD: $pin_cmd"
+		/bin/bash -c "$pin_cmd"
+		exit 0
+	    fi
+
 	    # For each benchmark, run with all the different input combinations from "CONFS" list
             for conf in $CONFS; do
 	    	## Get parameters
@@ -45,13 +69,11 @@ for folder in "$inputBase"/*; do
 	    	L2bsize=$(echo $conf | cut -d'_' -f3)
 
             	# Create and set output file path
-		outFile=$(printf "%s.cslab_cache_stats_L2_SRRIP_%04d_%02d_%03d.out" $BENCH ${L2size} ${L2assoc} ${L2bsize})
-		outBenchFolder="$outDir/$BENCH"
-		mkdir -p "$outBenchFolder"  # Create internal folders if they don't already exist
+		outFile=$(printf "%s.cslab_cache_stats_L2_%s_%04d_%02d_%03d.out" $BENCH ${POLICY} ${L2size} ${L2assoc} ${L2bsize})
 		pinOutFile="$outBenchFolder/$outFile"
 
             	# PIN command
-		pin_cmd="$PIN_EXE -t $PIN_TOOL -o $pinOutFile -L1c ${L1size} -L1a ${L1assoc} -L1b ${L1bsize} -L2c ${L2size} -L2a ${L2assoc} -L2b ${L2bsize} -- $clean_cmd "
+		pin_cmd="$PIN_EXE -t $PIN_TOOL -batch 1 -o $pinOutFile -L1c ${L1size} -L1a ${L1assoc} -L1b ${L1bsize} -L2c ${L2size} -L2a ${L2assoc} -L2b ${L2bsize} -L1pol ${POLICY} -L2pol ${POLICY} -- $clean_cmd "
             	
 		echo "PIN_CMD: $pin_cmd"
 	